@@ -3,9 +3,11 @@
 #include <cstdint>
 #include <cstdlib>
 #include <string>
+#include <vector>
 #include <io.h>
 #include <string>
 #include "json.h"
+#include "intern.h"
 
 typedef enum {
 	BSON_EOO = 0,
@@ -75,13 +77,20 @@ namespace bson {
 
 		return bytes;
 	}
+	// declared here so the element dispatch below does not pick the template
+	inline size_t write(const char* key, const json::string& val, char*&  buf);
+	inline size_t write(const char* key, const json::array& val, char*& buf);
+	inline size_t write_typed(const char* key, const json::element& val, char*& buf);
+	inline size_t write(const char* key, const json::byte& val, char*& buf);
+	inline size_t write(const char* key, json::object* val, char*& buf);
+
 	// specializations
 	inline size_t write(const char* key, const json::element& val, char*& buf)
 	{
 		return val.type == JSON_NUMBER ? write(key, val.data.number, buf)
-			:  val.type == JSON_STRING ? write(key, val.data.string, buf)
+			:  val.type == JSON_STRING ? write(key, val.str(), buf)
 			:  val.type == JSON_OBJECT ? write(key, val.data.object, buf)
-			:  val.type == JSON_ARRAY ? write(key, val.data.array, buf)
+			:  val.type == JSON_ARRAY ? (val.flags & JSON_FLAG_TYPED ? write_typed(key, val, buf) : write(key, val.data.array, buf))
 			:  val.type == JSON_BYTE ? write(key, val.data.byte, buf)
 //	BSON_UNDEFINED = 6,
 //	BSON_OID = 7,
@@ -131,6 +140,35 @@ namespace bson {
 	{
 		return write(key, json::string_(strlen(val), val), buf);
 	}
+	// array keys "0", "1", ... counted in decimal text
+	struct index_key {
+		char s[24];
+		size_t n; // digits
+
+		index_key()
+			: n(1)
+		{
+			s[0] = '0';
+			s[1] = 0;
+		}
+		void next(void)
+		{
+			size_t i = n;
+
+			while (i > 0 && s[i - 1] == '9')
+				s[--i] = '0';
+			if (i > 0) {
+				++s[i - 1];
+			}
+			else { // 99 becomes 100
+				s[0] = '1';
+				s[n++] = '0';
+				s[n] = 0;
+			}
+		}
+	};
+
+	// embedded document with keys "0", "1", ...: int32 length, elements, null
 	inline size_t write(const char* key, const json::array& val, char*& buf)
 	{
 		size_t bytes = 1;
@@ -143,11 +181,54 @@ namespace bson {
 		*buf++ = *key++; // null terminate key
 		++bytes;
 
-		for (long long i = 0; i < val.size; ++i) {
-			bytes += write(std::to_string(i).c_str(), val.element[i], buf);
+		char* len = buf;
+		buf += 4;
+		size_t size = 4;
+		index_key k;
+		for (size_t i = 0; i < val.size; ++i, k.next())
+			size += write(k.s, val.element[i], buf);
+		*buf++ = 0;
+		++size;
+		*(int32_t*)len = static_cast<int32_t>(size);
+
+		return bytes + size;
+	}
+	// same bytes as the elements would be, without looking at each one
+	inline size_t write_typed(const char* key, const json::element& val, char*& buf)
+	{
+		size_t bytes = 1;
+		*buf++ = BSON_ARRAY;
+
+		while (*key) {
+			*buf++ = *key++;
+			++bytes;
 		}
-		
-		return bytes;
+		*buf++ = *key++; // null terminate key
+		++bytes;
+
+		json_element_type t = val.typed();
+		char bt = t == JSON_NUMBER ? BSON_DOUBLE : t == JSON_INT32 ? BSON_INT : BSON_LONG;
+		size_t w = json::typed_width(t);
+		const char* p = reinterpret_cast<const char*>(val.data.array.element);
+
+		char* len = buf;
+		buf += 4;
+		size_t size = 4;
+		index_key k;
+		for (size_t i = 0; i < val.data.array.size; ++i, k.next()) {
+			*buf++ = bt;
+			memcpy(buf, k.s, k.n + 1);
+			buf += k.n + 1;
+			memcpy(buf, p, w);
+			buf += w;
+			p += w;
+			size += 2 + k.n + w;
+		}
+		*buf++ = 0;
+		++size;
+		*(int32_t*)len = static_cast<int32_t>(size);
+
+		return bytes + size;
 	}
 	inline size_t write(const char* key, const json::byte& val, char*& buf)
 	{
@@ -164,6 +245,8 @@ namespace bson {
 		*(uint32_t*)buf = val.size;
 		buf += 4;
 		bytes += 4;
+		*buf++ = BSON_BIN_BINARY;
+		++bytes;
 		
 		memcpy(buf, val.data, val.size);
 		buf += val.size;
@@ -172,6 +255,360 @@ namespace bson {
 		return bytes;
 	}
 
+	// embedded document: int32 length, elements, null
+	// O is json::object or json::flat_object
+	template<class O>
+	inline size_t write_object(const char* key, const O& val, char*& buf)
+	{
+		size_t bytes = 1;
+		*buf++ = BSON_OBJECT;
+
+		while (*key) {
+			*buf++ = *key++;
+			++bytes;
+		}
+		*buf++ = *key++; // null terminate key
+		++bytes;
+
+		char* len = buf;
+		buf += 4;
+		size_t size = 4;
+		for (typename O::const_iterator i = val.begin(); i != val.end(); ++i)
+			size += write(i->first.c_str(), i->second, buf);
+		*buf++ = 0;
+		++size;
+		*(int32_t*)len = static_cast<int32_t>(size);
+
+		return bytes + size;
+	}
+	inline size_t write(const char* key, json::object* val, char*& buf)
+	{
+		return write_object(key, *val, buf);
+	}
+	inline size_t write(const char* key, const json::object& val, char*& buf)
+	{
+		return write_object(key, val, buf);
+	}
+	inline size_t write(const char* key, const json::flat_object& val, char*& buf)
+	{
+		return write_object(key, val, buf);
+	}
+
+	//
+	// building documents
+	//
+
+	// Documents in a buffer that grows as needed. Lengths of documents and arrays
+	// are reserved when they are opened and patched when they are closed.
+	//	bson::builder b;
+	//	b.begin();
+	//	b.append("name", "x");
+	//	b.begin_array("tags"); b.append("0", "a"); b.end();
+	//	b.end();
+	//	send(b.data(), b.size());
+	//	b.clear(); // keeps the memory for the next batch
+	// Documents added one after another form a batch.
+	class builder {
+		json::buffer buf_;
+		std::vector<size_t> open_; // offsets of the lengths of open documents
+
+		builder(const builder&);
+		builder& operator=(const builder&);
+
+		// type and null terminated key, returns where the value goes
+		char* element(bson_type t, const char* key, size_t value_size)
+		{
+			size_t n = strlen(key);
+			char* p = buf_.reserve(1 + n + 1 + value_size);
+			*p++ = static_cast<char>(t);
+			memcpy(p, key, n + 1);
+
+			return p + n + 1;
+		}
+		// p is just past the last byte written
+		void advance(const char* p)
+		{
+			buf_.advance(p - (buf_.data() + buf_.size()));
+		}
+		void open(void)
+		{
+			open_.push_back(buf_.size());
+			buf_.reserve(4);
+			buf_.advance(4);
+		}
+		template<class O>
+		void members(const O& o)
+		{
+			for (typename O::const_iterator i = o.begin(); i != o.end(); ++i)
+				append(i->first.c_str(), i->second);
+		}
+		// BSON has no unsigned 64 bit type, larger values become the nearest double
+		builder& append_unsigned(const char* key, uint64_t u)
+		{
+			if (u > static_cast<uint64_t>(INT64_MAX))
+				return append(key, static_cast<double>(u));
+
+			return append_int64(key, static_cast<int64_t>(u));
+		}
+	public:
+		explicit builder(size_t capacity = 256)
+			: buf_(capacity)
+		{ }
+
+		// start a top level document
+		void begin(void)
+		{
+			ensure (open_.empty());
+			open();
+		}
+		// start an embedded document or array, keys of arrays are "0", "1", ...
+		void begin_object(const char* key)
+		{
+			ensure (!open_.empty());
+			element(BSON_OBJECT, key, 0);
+			buf_.advance(strlen(key) + 2);
+			open();
+		}
+		void begin_array(const char* key)
+		{
+			ensure (!open_.empty());
+			element(BSON_ARRAY, key, 0);
+			buf_.advance(strlen(key) + 2);
+			open();
+		}
+		// close the innermost document and patch its length
+		void end(void)
+		{
+			ensure (!open_.empty());
+			buf_.put(0);
+			size_t at = open_.back();
+			int32_t n = static_cast<int32_t>(buf_.size() - at);
+			memcpy(buf_.data() + at, &n, 4);
+			open_.pop_back();
+		}
+
+		// whole documents
+		void document(const json::object& o)
+		{
+			begin();
+			members(o);
+			end();
+		}
+		void document(const json::flat_object& o)
+		{
+			begin();
+			members(o);
+			end();
+		}
+		void document(const json::interned_object& o)
+		{
+			begin();
+			members(o);
+			end();
+		}
+
+		// scalars
+		builder& append(const char* key, double x)
+		{
+			char* p = element(BSON_DOUBLE, key, 8);
+			memcpy(p, &x, 8);
+			advance(p + 8);
+
+			return *this;
+		}
+		builder& append(const char* key, const json::string& s)
+		{
+			char* p = element(BSON_STRING, key, 4 + s.size + 1);
+			int32_t n = static_cast<int32_t>(s.size + 1);
+			memcpy(p, &n, 4);
+			memcpy(p + 4, s.data, s.size);
+			p[4 + s.size] = 0;
+			advance(p + 4 + s.size + 1);
+
+			return *this;
+		}
+		builder& append(const char* key, const char* s)
+		{
+			return append(key, json::string_(strlen(s), s));
+		}
+		builder& append(const char* key, const std::string& s)
+		{
+			return append(key, json::string_(s.size(), s.data()));
+		}
+		builder& append(const char* key, bool b)
+		{
+			char* p = element(BSON_BOOL, key, 1);
+			*p = b;
+			advance(p + 1);
+
+			return *this;
+		}
+		builder& append_int32(const char* key, int32_t i)
+		{
+			char* p = element(BSON_INT, key, 4);
+			memcpy(p, &i, 4);
+			advance(p + 4);
+
+			return *this;
+		}
+		builder& append_int64(const char* key, int64_t i)
+		{
+			char* p = element(BSON_LONG, key, 8);
+			memcpy(p, &i, 8);
+			advance(p + 8);
+
+			return *this;
+		}
+		// int is BSON_INT, wider and unsigned types BSON_LONG, whatever the value
+		builder& append(const char* key, int i)
+		{
+			return append_int32(key, i);
+		}
+		builder& append(const char* key, long i)
+		{
+			return append_int64(key, i);
+		}
+		builder& append(const char* key, long long i)
+		{
+			return append_int64(key, i);
+		}
+		builder& append(const char* key, unsigned i)
+		{
+			return append_int64(key, i);
+		}
+		builder& append(const char* key, unsigned long i)
+		{
+			return append_unsigned(key, i);
+		}
+		builder& append(const char* key, unsigned long long i)
+		{
+			return append_unsigned(key, i);
+		}
+		// milliseconds since the epoch, named as int64_t is time_t on most platforms
+		builder& append_date(const char* key, int64_t d)
+		{
+			char* p = element(BSON_DATE, key, 8);
+			memcpy(p, &d, 8);
+			advance(p + 8);
+
+			return *this;
+		}
+		builder& append(const char* key, const json::byte& b, bson_subtype sub = BSON_BIN_BINARY)
+		{
+			char* p = element(BSON_BINDATA, key, 4 + 1 + b.size);
+			int32_t n = static_cast<int32_t>(b.size);
+			memcpy(p, &n, 4);
+			p[4] = static_cast<char>(sub);
+			memcpy(p + 5, b.data, b.size);
+			advance(p + 5 + b.size);
+
+			return *this;
+		}
+		builder& append_null(const char* key)
+		{
+			element(BSON_NULL, key, 0);
+			buf_.advance(strlen(key) + 2);
+
+			return *this;
+		}
+		// a value already in BSON form, such as an OID or a regular expression
+		builder& append_raw(const char* key, bson_type t, const char* v, size_t n)
+		{
+			char* p = element(t, key, n);
+			memcpy(p, v, n);
+			advance(p + n);
+
+			return *this;
+		}
+
+		// containers are written member by member
+		builder& append(const char* key, const json::object& o)
+		{
+			begin_object(key);
+			members(o);
+			end();
+
+			return *this;
+		}
+		builder& append(const char* key, const json::flat_object& o)
+		{
+			begin_object(key);
+			members(o);
+			end();
+
+			return *this;
+		}
+		builder& append(const char* key, const json::element& e)
+		{
+			switch (e.type) {
+			case JSON_STRING:
+				return append(key, e.str());
+			case JSON_NUMBER:
+				return append(key, e.data.number);
+			case JSON_OBJECT:
+				return append(key, *e.data.object);
+			case JSON_ARRAY: {
+				if (e.flags & JSON_FLAG_TYPED) {
+					// at most 20 digits for a key
+					char* p = buf_.reserve(1 + strlen(key) + 1 + 4 + e.data.array.size*(2 + 20 + 8) + 1);
+					char* q = p;
+					size_t n = write_typed(key, e, q);
+					advance(p + n);
+
+					return *this;
+				}
+				begin_array(key);
+				index_key k;
+				for (size_t i = 0; i < e.data.array.size; ++i, k.next())
+					append(k.s, e.data.array.element[i]);
+				end();
+
+				return *this;
+			}
+			case JSON_TRUE:
+				return append(key, true);
+			case JSON_FALSE:
+				return append(key, false);
+			case JSON_BYTE:
+				return append(key, e.data.byte);
+			case JSON_INT32:
+				return append_int32(key, e.data.int32);
+			case JSON_INT64:
+				return append_int64(key, e.data.int64);
+			case JSON_DATE:
+				return append_date(key, e.data.date);
+			case JSON_NULL:
+				return append_null(key);
+			default: // undefined is not written
+				return *this;
+			}
+		}
+		builder& append(const char* key, const json::value& v)
+		{
+			return append(key, static_cast<const json::element&>(v));
+		}
+
+		// every document added since the last clear
+		const char* data(void) const
+		{
+			return buf_.data();
+		}
+		size_t size(void) const
+		{
+			return buf_.size();
+		}
+		std::string str(void) const
+		{
+			return buf_.str();
+		}
+		// start over, keeping the memory
+		void clear(void)
+		{
+			buf_.clear();
+			open_.clear();
+		}
+	};
+
 	//
 	// reading objects
 	//
@@ -189,6 +626,16 @@ namespace bson {
 
 		return key;
 	}
+	// interned, no allocation once the name has been seen
+	inline json::key key(const char*& s, json::key_pool& pool)
+	{
+		size_t n = strlen(s);
+		json::key key(s, n, pool);
+
+		s += n + 1;
+
+		return key;
+	}
 	
 	// read a T off the string
 	template<typename T>
@@ -199,6 +646,18 @@ namespace bson {
 
 		return t;
 	}
+	// int32 length, subtype, bytes
+	template<>
+	inline json::byte value<json::byte>(const char*& buf)
+	{
+		json::byte val;
+		val.size = *(int32_t*)buf;
+		buf += 4 + 1;
+		val.data = reinterpret_cast<const uint8_t*>(buf);
+		buf += val.size;
+
+		return val;
+	}
 	template<>
 	inline json::string value<json::string>(const char*& buf)
 	{
@@ -215,6 +674,7 @@ namespace bson {
 	{
 		json::element e;
 
+		e.flags = JSON_FLAG_VIEW; // refers to buf
 		switch (type) {
 		case BSON_DOUBLE:
 			e.type = JSON_NUMBER;
@@ -224,14 +684,18 @@ namespace bson {
 			e.type = JSON_STRING;
 			e.data.string = value<json::string>(buf);
 			break;
+		// embedded documents are skipped here, read_document decodes them
 		case BSON_OBJECT:
-			e.type = JSON_OBJECT;
-			e.data.object = value<json::object*>(buf);
+			e.type = JSON_NULL;
+			buf += *(int32_t*)buf;
 			break;
 		// arrays have the form {'0':item0, '1', item1, ...}
+		// skipped here, read_array decodes them
 		case BSON_ARRAY:
 			e.type = JSON_ARRAY;
 			e.data.array.size = 0;
+			e.data.array.element = 0;
+			buf += *(int32_t*)buf;
 			break;
 		case BSON_BINDATA:
 			e.type = JSON_BYTE;
@@ -270,12 +734,72 @@ namespace bson {
 		return e;
 	}
 
+	inline void read_array(const char*& buf, json::value& v);
+	inline void read_document(const char*& buf, json::value& v);
+
+	// value of type t, embedded documents and arrays are decoded recursively
+	inline void read_value(bson_type t, const char*& buf, json::value& v)
+	{
+		if (t == BSON_ARRAY)
+			read_array(buf, v);
+		else if (t == BSON_OBJECT)
+			read_document(buf, v);
+		else
+			v = bson::value(t, buf);
+	}
+
+	// embedded array, buf is at its length
+	// Numeric arrays are read as elements, pack() stores them as typed arrays.
+	inline void read_array(const char*& buf, json::value& v)
+	{
+		const char* end = buf + *(int32_t*)buf - 1; // terminating null
+		const char* p = buf + 4;
+		json::value a(0);
+
+		while (p < end) {
+			bson_type t = type(p);
+			p += strlen(p) + 1;
+			read_value(t, p, a.emplace_back());
+		}
+
+		v.swap(a);
+		buf = end + 1;
+	}
+	// embedded document, buf is at its length
+	inline void read_document(const char*& buf, json::value& v)
+	{
+		const char* end = buf + *(int32_t*)buf - 1; // terminating null
+		const char* p = buf + 4;
+		json::value o;
+		json::object& m = json::parse::make_object(o);
+
+		while (p < end) {
+			bson_type t = type(p);
+			std::string k = bson::key(p);
+			read_value(t, p, m[k]);
+		}
+
+		v.swap(o);
+		buf = end + 1;
+	}
+
 	inline std::pair<std::string,json::value> read(const char*& buf)
 	{
 		bson_type t = type(buf);
 
 		std::string key = bson::key(buf);
-		json::value value = bson::value(t, buf);
+		json::value value;
+		read_value(t, buf, value);
+
+		return std::make_pair(key, value);
+	}
+	inline std::pair<json::key,json::value> read(const char*& buf, json::key_pool& pool)
+	{
+		bson_type t = type(buf);
+
+		json::key key = bson::key(buf, pool);
+		json::value value;
+		read_value(t, buf, value);
 
 		return std::make_pair(key, value);
 	}
@@ -0,0 +1,337 @@
+// file.h - memory mapped files of concatenated BSON documents
+// A file_reader maps a file such as a mongodump .bson file read only and finds
+// the documents by their length prefixes, without reading the elements:
+//	bson::file_reader r("users.bson");
+//	json::pool p;
+//	std::atomic<size_t> n(0);
+//	bool ok = r.for_each([&n](size_t offset, const bson::document_view& d) {
+//		n += d["active"].boolean();
+//	}, p);
+// for_each goes through the file a window at a time and releases the pages it
+// is done with, so files larger than memory only ever have about one window
+// resident. index() builds a table of all document offsets for random access.
+// Views refer to the mapping and are valid while the reader is open.
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "pool.h"
+#include "view.h"
+
+namespace bson {
+
+	// whole file mapped read only
+	class mapped_file {
+		const char* data_;
+		size_t size_;
+#ifdef _WIN32
+		HANDLE file_;
+		HANDLE map_;
+#else
+		int fd_;
+#endif
+
+		mapped_file(const mapped_file&);
+		mapped_file& operator=(const mapped_file&);
+	public:
+		enum advice { NORMAL, SEQUENTIAL, RANDOM, WILLNEED, DONTNEED };
+
+		mapped_file()
+			: data_(0), size_(0)
+#ifdef _WIN32
+			, file_(INVALID_HANDLE_VALUE), map_(0)
+#else
+			, fd_(-1)
+#endif
+		{ }
+		explicit mapped_file(const char* path)
+			: data_(0), size_(0)
+#ifdef _WIN32
+			, file_(INVALID_HANDLE_VALUE), map_(0)
+#else
+			, fd_(-1)
+#endif
+		{
+			open(path);
+		}
+		~mapped_file()
+		{
+			close();
+		}
+
+		// false if the file cannot be opened or does not fit in the address space
+		bool open(const char* path)
+		{
+			close();
+#ifdef _WIN32
+			HANDLE f = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+			LARGE_INTEGER n;
+			if (f == INVALID_HANDLE_VALUE)
+				return false;
+			if (!GetFileSizeEx(f, &n) || static_cast<uint64_t>(n.QuadPart) > SIZE_MAX) {
+				CloseHandle(f);
+				return false;
+			}
+
+			if (n.QuadPart) { // empty files cannot be mapped
+				HANDLE m = CreateFileMappingA(f, 0, PAGE_READONLY, 0, 0, 0);
+				const void* p = m ? MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0) : 0;
+				if (!p) {
+					if (m)
+						CloseHandle(m);
+					CloseHandle(f);
+					return false;
+				}
+				map_ = m;
+				data_ = static_cast<const char*>(p);
+			}
+			file_ = f;
+			size_ = static_cast<size_t>(n.QuadPart);
+#else
+			int fd = ::open(path, O_RDONLY);
+			struct stat st;
+			if (fd < 0)
+				return false;
+			if (fstat(fd, &st) != 0 || static_cast<uint64_t>(st.st_size) > SIZE_MAX) {
+				::close(fd);
+				return false;
+			}
+
+			if (st.st_size) { // empty files cannot be mapped
+				void* p = mmap(0, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+				if (p == MAP_FAILED) {
+					::close(fd);
+					return false;
+				}
+				data_ = static_cast<const char*>(p);
+			}
+			fd_ = fd;
+			size_ = static_cast<size_t>(st.st_size);
+#endif
+
+			return true;
+		}
+		void close(void)
+		{
+#ifdef _WIN32
+			if (data_)
+				UnmapViewOfFile(data_);
+			if (map_)
+				CloseHandle(map_);
+			if (file_ != INVALID_HANDLE_VALUE)
+				CloseHandle(file_);
+			file_ = INVALID_HANDLE_VALUE;
+			map_ = 0;
+#else
+			if (data_)
+				munmap(const_cast<char*>(data_), size_);
+			if (fd_ >= 0)
+				::close(fd_);
+			fd_ = -1;
+#endif
+			data_ = 0;
+			size_ = 0;
+		}
+
+		bool is_open(void) const
+		{
+#ifdef _WIN32
+			return file_ != INVALID_HANDLE_VALUE;
+#else
+			return fd_ >= 0;
+#endif
+		}
+		const char* data(void) const
+		{
+			return data_;
+		}
+		size_t size(void) const
+		{
+			return size_;
+		}
+
+		static size_t page_size(void)
+		{
+#ifdef _WIN32
+			SYSTEM_INFO si;
+			GetSystemInfo(&si);
+
+			return si.dwPageSize;
+#else
+			return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+		}
+		// Hint how [offset, offset + n) will be read, offset is rounded down to a page.
+		// DONTNEED drops the pages, they are read from the file again if touched.
+		// Windows only has DONTNEED, which takes the pages out of the working set.
+		void advise(size_t offset, size_t n, advice a) const
+		{
+			size_t page = page_size();
+			size_t b = offset/page*page;
+			if (!data_ || b >= size_)
+				return;
+			n = n + (offset - b) < size_ - b ? n + (offset - b) : size_ - b;
+#ifdef _WIN32
+			if (a == DONTNEED)
+				VirtualUnlock(const_cast<char*>(data_) + b, n); // fails as not locked, but unmaps
+#else
+			static const int advice[] = { MADV_NORMAL, MADV_SEQUENTIAL, MADV_RANDOM, MADV_WILLNEED, MADV_DONTNEED };
+			madvise(const_cast<char*>(data_) + b, n, advice[a]);
+#endif
+		}
+	};
+
+	// documents of a mapped file, one after the other
+	class file_reader {
+		mapped_file file_;
+		std::vector<size_t> offsets_;
+
+		file_reader(const file_reader&);
+		file_reader& operator=(const file_reader&);
+	public:
+		file_reader()
+		{ }
+		explicit file_reader(const char* path)
+		{
+			open(path);
+		}
+
+		// map the file for reading from start to end
+		bool open(const char* path)
+		{
+			offsets_.clear();
+			if (!file_.open(path))
+				return false;
+			file_.advise(0, file_.size(), mapped_file::SEQUENTIAL);
+
+			return true;
+		}
+		void close(void)
+		{
+			offsets_.clear();
+			file_.close();
+		}
+		bool is_open(void) const
+		{
+			return file_.is_open();
+		}
+		const mapped_file& file(void) const
+		{
+			return file_;
+		}
+
+		// bytes of the document at offset, 0 if none fits there
+		size_t document_size(size_t offset) const
+		{
+			int32_t n;
+
+			if (offset > file_.size() || file_.size() - offset < 5)
+				return 0;
+			const char* p = file_.data() + offset;
+			memcpy(&n, p, 4);
+			if (n < 5 || static_cast<size_t>(n) > file_.size() - offset || p[n - 1] != 0)
+				return 0;
+
+			return static_cast<size_t>(n);
+		}
+		document_view document(size_t offset) const
+		{
+			return document_view(file_.data() + offset, file_.size() - offset);
+		}
+
+		// Offsets of all the documents, found by skipping from length to length.
+		// Returns false if the file does not end with a whole document, the
+		// documents before that are indexed.
+		bool index(void)
+		{
+			size_t at = 0, n;
+
+			offsets_.clear();
+			while ((n = document_size(at)) != 0) {
+				offsets_.push_back(at);
+				at += n;
+			}
+
+			return at == file_.size();
+		}
+		// documents found by index()
+		size_t size(void) const
+		{
+			return offsets_.size();
+		}
+		const std::vector<size_t>& offsets(void) const
+		{
+			return offsets_;
+		}
+		document_view operator[](size_t i) const
+		{
+			return document(offsets_[i]);
+		}
+
+		// Calls f(offset, document) for every document on the pool threads, in no
+		// particular order, so f must be thread safe. Tasks get about chunk bytes
+		// of documents. The file is read window bytes at a time, and the pages of
+		// a window are released once all its documents have been visited.
+		// Returns false if the file does not end with a whole document, the
+		// documents before that are still visited.
+		template<class F>
+		bool for_each(F f, json::pool& p, size_t chunk = 1 << 20, size_t window = 256 << 20)
+		{
+			const char* b = file_.data();
+			size_t at = 0;       // end of the documents found so far
+			size_t released = 0; // pages before this are released
+			size_t page = mapped_file::page_size();
+			std::vector<std::pair<size_t,size_t>> c;
+
+			while (at < file_.size()) {
+				// chunks of whole documents up to the end of the window
+				size_t stop = file_.size() - at > window ? at + window : file_.size();
+				c.clear();
+				while (at < stop) {
+					size_t first = at, n;
+					while (at - first < chunk && (n = document_size(at)) != 0)
+						at += n;
+					if (at == first)
+						break;
+					c.push_back(std::make_pair(first, at));
+				}
+				if (c.empty())
+					return false; // not a document at at
+
+				for (size_t i = 0; i < c.size(); ++i) {
+					p.submit([b, &c, &f, i]() {
+						for (size_t o = c[i].first; o < c[i].second; ) {
+							document_view d(b + o, c[i].second - o);
+							f(o, d);
+							o += d.size();
+						}
+					});
+				}
+				p.wait();
+
+				if (at/page*page > released) {
+					file_.advise(released, at/page*page - released, mapped_file::DONTNEED);
+					released = at/page*page;
+				}
+			}
+
+			return true;
+		}
+	};
+
+} // namespace bson
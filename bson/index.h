@@ -0,0 +1,322 @@
+// index.h - constant time field and array element lookups in a BSON document
+// A document_index records where every element of a document starts, in one
+// pass over the bytes. Fields are found through a hash table keyed by the
+// enclosing document and the key, array elements through a list of offsets
+// per array:
+//	bson::document_view d(buf, n);
+//	bson::document_index x(d);
+//	bson::element_view items = x.field("items");
+//	double price = x.field(x.element(items, 12345), "price").number();
+// The index refers to the document by offsets only. save() turns it into bytes
+// that can be stored next to the document and load() reads them back.
+// Duplicate keys find the first element, like document_view::find.
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "flat_map.h"
+#include "hash.h"
+#include "view.h"
+
+namespace bson {
+
+	class document_index {
+		// field of the document at parent, offset 0 is an empty slot
+		struct field_slot {
+			uint32_t hash;
+			uint32_t parent;
+			uint32_t offset;
+		};
+		// elements of the array at offset are offsets_[first, first + count)
+		struct array_slot {
+			uint32_t offset;
+			uint32_t first;
+			uint32_t count;
+		};
+
+		document_view d_;
+		std::vector<field_slot> fields_;  // open addressing, power of 2 size
+		std::vector<array_slot> arrays_;  // open addressing, power of 2 size
+		std::vector<uint32_t> offsets_;
+		size_t field_count_;
+		size_t array_count_;
+
+		static uint32_t hash(uint32_t parent, const char* key, size_t n)
+		{
+			return json::key_hash(key, n) ^ (parent*0x9E3779B1u);
+		}
+		static uint32_t hash(uint32_t offset)
+		{
+			return offset*0x9E3779B1u;
+		}
+
+		uint32_t offset(const char* p) const
+		{
+			return static_cast<uint32_t>(p - d_.data());
+		}
+		element_view at(uint32_t offset) const
+		{
+			return element_view(d_.data() + offset, d_.data() + d_.size() - 1);
+		}
+
+		template<class S>
+		static void grow(std::vector<S>& t)
+		{
+			std::vector<S> u(t.empty() ? 16 : 2*t.size());
+			size_t mask = u.size() - 1;
+
+			for (size_t i = 0; i < t.size(); ++i) {
+				if (t[i].offset) {
+					size_t j = slot_hash(t[i]) & mask;
+					while (u[j].offset)
+						j = (j + 1) & mask;
+					u[j] = t[i];
+				}
+			}
+			t.swap(u);
+		}
+		static uint32_t slot_hash(const field_slot& s)
+		{
+			return s.hash;
+		}
+		static uint32_t slot_hash(const array_slot& s)
+		{
+			return hash(s.offset);
+		}
+
+		void add_field(uint32_t parent, const element_view& e)
+		{
+			if (2*(field_count_ + 1) > fields_.size())
+				grow(fields_);
+
+			json::string k = e.key();
+			field_slot s = { hash(parent, k.data, k.size), parent, offset(k.data - 1) };
+			size_t mask = fields_.size() - 1;
+			size_t j = s.hash & mask;
+			for (; fields_[j].offset; j = (j + 1) & mask)
+				if (fields_[j].hash == s.hash && fields_[j].parent == parent && at(fields_[j].offset).key() == k)
+					return; // first one wins
+			fields_[j] = s;
+			++field_count_;
+		}
+		void add_array(uint32_t at, uint32_t first, uint32_t count)
+		{
+			if (2*(array_count_ + 1) > arrays_.size())
+				grow(arrays_);
+
+			array_slot s = { at, first, count };
+			size_t mask = arrays_.size() - 1;
+			size_t j = hash(at) & mask;
+			while (arrays_[j].offset)
+				j = (j + 1) & mask;
+			arrays_[j] = s;
+			++array_count_;
+		}
+
+		// d starts at offset at
+		void walk(const document_view& d, uint32_t at, bool array)
+		{
+			uint32_t first = static_cast<uint32_t>(offsets_.size());
+
+			for (document_view::iterator i = d.begin(); i != d.end(); ++i) {
+				if (array)
+					offsets_.push_back(offset(i->key().data - 1));
+				else
+					add_field(at, *i);
+			}
+			if (array)
+				add_array(at, first, static_cast<uint32_t>(offsets_.size()) - first);
+
+			// embedded documents after this one so its offsets stay together
+			for (document_view::iterator i = d.begin(); i != d.end(); ++i)
+				if (i->type() == BSON_OBJECT || i->type() == BSON_ARRAY)
+					walk(i->document(), offset(i->raw().data), i->type() == BSON_ARRAY);
+		}
+
+		bool fail(void)
+		{
+			clear();
+
+			return false;
+		}
+
+		const array_slot* find_array(const element_view& a) const
+		{
+			if (a.type() != BSON_ARRAY || arrays_.empty())
+				return 0;
+
+			uint32_t at = offset(a.raw().data);
+			size_t mask = arrays_.size() - 1;
+			for (size_t j = hash(at) & mask; arrays_[j].offset; j = (j + 1) & mask)
+				if (arrays_[j].offset == at)
+					return &arrays_[j];
+
+			return 0;
+		}
+		element_view find(uint32_t parent, const char* key, size_t n) const
+		{
+			if (fields_.empty())
+				return element_view();
+
+			uint32_t h = hash(parent, key, n);
+			size_t mask = fields_.size() - 1;
+			for (size_t j = h & mask; fields_[j].offset; j = (j + 1) & mask) {
+				const field_slot& s = fields_[j];
+				if (s.hash == h && s.parent == parent) {
+					element_view e = at(s.offset);
+					if (e.key().size == n && 0 == memcmp(e.key().data, key, n))
+						return e;
+				}
+			}
+
+			return element_view();
+		}
+	public:
+		document_index()
+			: field_count_(0), array_count_(0)
+		{ }
+		explicit document_index(const document_view& d)
+			: field_count_(0), array_count_(0)
+		{
+			build(d);
+		}
+
+		// index every field and array element of d
+		void build(const document_view& d)
+		{
+			clear();
+			d_ = d;
+			if (d.valid())
+				walk(d, 0, false);
+		}
+		void clear(void)
+		{
+			d_ = document_view();
+			fields_.clear();
+			arrays_.clear();
+			offsets_.clear();
+			field_count_ = 0;
+			array_count_ = 0;
+		}
+		const document_view& document(void) const
+		{
+			return d_;
+		}
+
+		// top level field, invalid if there is none
+		element_view field(const char* key) const
+		{
+			return find(0, key, strlen(key));
+		}
+		// field of an embedded document of this document
+		element_view field(const element_view& parent, const char* key) const
+		{
+			if (parent.type() != BSON_OBJECT)
+				return element_view();
+
+			return find(offset(parent.raw().data), key, strlen(key));
+		}
+		element_view field(const element_view& parent, const char* key, size_t n) const
+		{
+			if (parent.type() != BSON_OBJECT)
+				return element_view();
+
+			return find(offset(parent.raw().data), key, n);
+		}
+		// element i of an embedded array of this document, invalid if out of range
+		element_view element(const element_view& array, size_t i) const
+		{
+			const array_slot* s = find_array(array);
+
+			return s && i < s->count ? at(offsets_[s->first + i]) : element_view();
+		}
+		// number of elements of an embedded array
+		size_t size(const element_view& array) const
+		{
+			const array_slot* s = find_array(array);
+
+			return s ? s->count : 0;
+		}
+
+		// The index as bytes, to be stored with the document.
+		// Layout: document size, field table size, array table size,
+		// offset count, low and high half of json::hash_bytes of the
+		// document, then the three tables, all as native uint32.
+		std::string save(void) const
+		{
+			uint64_t dh = json::hash_bytes(d_.data(), d_.size());
+			uint32_t h[6] = {
+				static_cast<uint32_t>(d_.size()),
+				static_cast<uint32_t>(fields_.size()),
+				static_cast<uint32_t>(arrays_.size()),
+				static_cast<uint32_t>(offsets_.size()),
+				static_cast<uint32_t>(dh),
+				static_cast<uint32_t>(dh >> 32)
+			};
+			std::string s(reinterpret_cast<const char*>(h), sizeof(h));
+
+			if (!fields_.empty())
+				s.append(reinterpret_cast<const char*>(&fields_[0]), fields_.size()*sizeof(field_slot));
+			if (!arrays_.empty())
+				s.append(reinterpret_cast<const char*>(&arrays_[0]), arrays_.size()*sizeof(array_slot));
+			if (!offsets_.empty())
+				s.append(reinterpret_cast<const char*>(&offsets_[0]), offsets_.size()*sizeof(uint32_t));
+
+			return s;
+		}
+		// an index saved for d, false if it does not fit d or was saved for
+		// other bytes
+		bool load(const document_view& d, const char* p, size_t n)
+		{
+			uint32_t h[6];
+
+			clear();
+			if (n < sizeof(h))
+				return false;
+			memcpy(h, p, sizeof(h));
+			if (h[0] != d.size() || n != sizeof(h) + uint64_t(h[1])*sizeof(field_slot) + uint64_t(h[2])*sizeof(array_slot) + uint64_t(h[3])*sizeof(uint32_t))
+				return false;
+			if ((h[1] & (h[1] - 1)) || (h[2] & (h[2] - 1)))
+				return false; // table sizes are powers of 2
+			if (json::hash_bytes(d.data(), d.size()) != (uint64_t(h[5]) << 32 | h[4]))
+				return false;
+
+			p += sizeof(h);
+			fields_.resize(h[1]);
+			arrays_.resize(h[2]);
+			offsets_.resize(h[3]);
+			if (h[1])
+				memcpy(&fields_[0], p, h[1]*sizeof(field_slot));
+			p += h[1]*sizeof(field_slot);
+			if (h[2])
+				memcpy(&arrays_[0], p, h[2]*sizeof(array_slot));
+			p += h[2]*sizeof(array_slot);
+			if (h[3])
+				memcpy(&offsets_[0], p, h[3]*sizeof(uint32_t));
+
+			// the bytes are not trusted, every offset must be inside d
+			for (size_t i = 0; i < fields_.size(); ++i) {
+				if (fields_[i].offset >= d.size())
+					return fail();
+				field_count_ += fields_[i].offset != 0;
+			}
+			for (size_t i = 0; i < arrays_.size(); ++i) {
+				const array_slot& a = arrays_[i];
+				if (a.offset >= d.size() || a.first > offsets_.size() || a.count > offsets_.size() - a.first)
+					return fail();
+				array_count_ += a.offset != 0;
+			}
+			for (size_t i = 0; i < offsets_.size(); ++i)
+				if (offsets_[i] >= d.size())
+					return fail();
+			// lookups stop at an empty slot
+			if ((h[1] && field_count_ == h[1]) || (h[2] && array_count_ == h[2]))
+				return fail();
+			d_ = d;
+
+			return true;
+		}
+	};
+
+} // namespace bson
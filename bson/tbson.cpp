@@ -1,7 +1,14 @@
 // tbon.cpp - test bson
+#include <atomic>
 #include <cassert>
+#include <cstdio>
+#include <fstream>
 #include <iostream>
 #include "bson.h"
+#include "view.h"
+#include "index.h"
+#include "transcode.h"
+#include "file.h"
 
 //using namespace std;
 using namespace bson;
@@ -59,11 +66,515 @@ void test_write(void)
 	assert (kv.second == false);
 }
 
+void test_write_object(void)
+{
+	char buf[1024];
+	char* s = buf;
+
+	json::flat_object o;
+	o["b"] = json::value(true);
+	o["a"] = "x";
+
+	size_t n = write("o", o, s);
+	assert (n == static_cast<size_t>(s - buf));
+	// type, "o\0", length, {type, "b\0", bool}, {type, "a\0", length, "x\0"}, null
+	assert (n == 1 + 2 + 4 + (1 + 2 + 1) + (1 + 2 + 4 + 2) + 1);
+	assert (buf[0] == BSON_OBJECT);
+	assert (*(int32_t*)(buf + 3) == static_cast<int32_t>(n - 3));
+	assert (buf[7] == BSON_BOOL && buf[11] == BSON_STRING);
+	assert (buf[n - 1] == 0);
+
+	const char* t = buf + 7;
+	json::pair kv = read(t);
+	assert (kv.first == "b" && kv.second == true);
+	kv = read(t);
+	assert (kv.first == "a" && kv.second == "x");
+
+	// embedded documents and arrays of documents read back as they were written
+	json::value doc;
+	const char* j = "{\"u\": {\"id\": 1, \"tags\": [{\"k\": \"a\"}, {\"k\": \"b\", \"v\": [2.5]}]}, \"n\": {}}";
+	bool ok = json::parse::read_value(j, j + strlen(j), doc);
+	assert (ok);
+	s = buf;
+	n = write("d", doc, s);
+	t = buf;
+	kv = read(t);
+	assert (kv.first == "d" && t == buf + n);
+	assert (json::to_string(kv.second) == json::to_string(doc));
+	assert (kv.second.data.object->find("u")->second.data.object->find("id")->second == json::int32_(1));
+
+	bson::builder b;
+	b.document(*doc.data.object);
+	json::value w;
+	ok = bson::document_view(b.data(), b.size())["u"]["tags"].get(w);
+	assert (ok && json::to_string(w) == json::to_string(doc.data.object->find("u")->second.data.object->find("tags")->second));
+}
+
+void test_read_interned(void)
+{
+	json::key_pool pool;
+	const char* t = hw + 4;
+
+	std::pair<json::key,json::value> kv = read(t, pool);
+	assert (kv.first == json::key("hello", 5, pool) && kv.second == "world");
+	assert (*t == 0 && pool.size() == 1);
+
+	t = hw + 4;
+	kv = read(t, pool);
+	assert (pool.size() == 1); // same name, same storage
+}
+
+void test_typed_array(void)
+{
+	char buf[1024], buf2[1024];
+	char* s = buf;
+	char* s2 = buf2;
+
+	double x[] = { 0.5, 1.5, 2.5, 3.5, 4.5, 5.5, 6.5, 7.5, 8.5, 9.5, 10.5 };
+	json::value t(x, 11);
+	json::value e(11);
+	for (int i = 0; i < 11; ++i)
+		e[i] = x[i];
+
+	// typed arrays encode to the same bytes as their elements
+	size_t n = write("a", t, s);
+	size_t n2 = write("a", e, s2);
+	assert (n == n2 && 0 == memcmp(buf, buf2, n));
+	// type, "a\0", length, 10 x {type, "i\0", double}, {type, "10\0", double}, null
+	assert (n == 1 + 2 + 4 + 10*(1 + 2 + 8) + (1 + 3 + 8) + 1);
+	assert (*(int32_t*)(buf + 3) == static_cast<int32_t>(n - 3));
+
+	int32_t y[] = { 7, -8 };
+	n += write("b", json::value(y, 2), s);
+	n += write("c", "end", s);
+
+	// read as elements, typed only when packed
+	const char* r = buf;
+	json::pair kv = read(r);
+	assert (kv.first == "a" && kv.second.typed() == JSON_UNDEFINED && kv.second == t);
+	bool packed = kv.second.pack();
+	assert (packed && kv.second.span<double>().size == 11 && kv.second.span<double>()[10] == 10.5);
+	kv = read(r);
+	packed = kv.second.pack();
+	assert (kv.first == "b" && packed && kv.second.span<int32_t>()[1] == -8);
+	kv = read(r);
+	assert (kv.first == "c" && kv.second == "end" && r == buf + n);
+
+	// mixed arrays are read as elements
+	json::value m(2);
+	m[0] = 1.5;
+	m[1] = "s";
+	s = buf;
+	n = write("m", m, s);
+	r = buf;
+	kv = read(r);
+	assert (kv.second.typed() == JSON_UNDEFINED && kv.second[0] == 1.5 && kv.second[1] == "s" && r == s);
+}
+
+void test_builder(void)
+{
+	bson::builder b(16); // grows as needed
+
+	b.begin();
+	b.append("hello", "world");
+	b.end();
+	assert (b.size() == 0x16 && 0 == memcmp(b.data(), hw, b.size()));
+
+	// nested documents get their lengths patched
+	json::object o;
+	o["a"] = json::value(1.5);
+	json::value tags(2);
+	tags[0] = "x";
+	tags[1] = json::value(true);
+	o["t"] = tags;
+	size_t at = b.size();
+	b.begin();
+	b.append("o", o);
+	b.begin_array("list");
+	b.append("0", json::int32_(7));
+	b.append("1", std::string("a string that does not fit the initial capacity"));
+	b.end();
+	b.append_null("n");
+	b.end();
+
+	const char* d = b.data() + at;
+	assert (*(int32_t*)d == static_cast<int32_t>(b.size() - at) && b.data()[b.size() - 1] == 0);
+	const char* r = d + 4;
+	bson_type bt = type(r);
+	std::string k = key(r);
+	assert (bt == BSON_OBJECT && k == "o");
+	const char* e = r + *(int32_t*)r; // end of "o"
+	r += 4;
+	json::pair kv = read(r);
+	assert (kv.first == "a" && kv.second == 1.5);
+	kv = read(r);
+	assert (kv.first == "t" && kv.second.data.array.size == 2 && kv.second[0] == "x" && kv.second[1] == true);
+	assert (*r == 0 && r + 1 == e);
+	r = e;
+	kv = read(r);
+	assert (kv.first == "list" && kv.second[0] == json::int32_(7));
+	assert (kv.second[1] == "a string that does not fit the initial capacity");
+	bt = type(r);
+	k = key(r);
+	assert (bt == BSON_NULL && k == "n" && *r == 0);
+
+	// whole documents from objects, typed arrays in bulk
+	json::flat_object f;
+	double x[] = { 1, 2, 3 };
+	f["v"] = json::value(x, 3);
+	b.clear();
+	b.document(f);
+	r = b.data() + 4;
+	kv = read(r);
+	assert (kv.first == "v" && kv.second == f["v"]);
+	assert (*r == 0 && r + 1 == b.data() + b.size());
+
+	// reuse keeps the memory
+	const char* p = b.data();
+	b.clear();
+	b.document(f);
+	assert (b.data() == p);
+}
+
+void test_document_view(void)
+{
+	bson::builder b;
+	b.begin();
+	b.begin_object("user");
+	b.append("id", 42);
+	b.append("name", "ann");
+	b.end();
+	b.begin_array("tags");
+	b.append("0", "a");
+	b.append("1", "b");
+	b.end();
+	b.append("price", 2.5);
+	uint8_t y[] = { 1, 2, 3 };
+	b.append("bin", json::byte_(3, y));
+	b.append_null("n");
+	b.append("l", static_cast<int64_t>(INT64_C(1) << 40)); // not a date
+	b.end();
+
+	bson::document_view d(b.data(), b.size());
+	assert (d.valid() && d.size() == b.size());
+	const char* keys[] = { "user", "tags", "price", "bin", "n", "l" };
+	size_t n = 0;
+	for (bson::document_view::iterator i = d.begin(); i != d.end(); ++i, ++n)
+		assert (i->key() == keys[n]);
+	assert (n == 6);
+
+	// typed accessors refer to the document
+	assert (d["price"].type() == BSON_DOUBLE && d["price"].number() == 2.5);
+	assert (d["user"]["id"].int32() == 42 && d["user"]["name"].str() == "ann");
+	assert (d["user"]["name"].str().data > b.data() && d["user"]["name"].str().data < b.data() + b.size());
+	assert (d["tags"][1].str() == "b" && !d["tags"][2].valid() && d["tags"].document().valid());
+	json::byte by = d["bin"].bytes();
+	assert (by.size == 3 && by.data[2] == 3);
+	assert (d["n"].null() && d["l"].int64() == INT64_C(1) << 40 && d["user"]["id"].int64() == 42);
+	assert (!d["missing"].valid() && d["missing"].number() == 0 && !d["price"]["x"].valid());
+	assert (d["price"].raw().size == 8);
+	assert (d["l"].type() == BSON_LONG && d["l"].date() == 0);
+
+	// every integer type has its overload, none are ambiguous
+	bson::builder w;
+	w.begin();
+	w.append("ll", -3LL);
+	w.append("u", 4000000000u);
+	w.append("z", sizeof(int));
+	w.append("ull", UINT64_MAX);
+	w.end();
+	bson::document_view dw(w.data(), w.size());
+	assert (dw["ll"].type() == BSON_LONG && dw["ll"].int64() == -3);
+	assert (dw["u"].type() == BSON_LONG && dw["u"].int64() == 4000000000LL);
+	assert (dw["z"].type() == BSON_LONG && dw["z"].int64() == 4);
+	assert (dw["ull"].type() == BSON_DOUBLE && dw["ull"].number() == 18446744073709551616.0);
+
+	// decoded copies
+	json::value v;
+	bool ok = d["user"].get(v);
+	assert (ok && v.type == JSON_OBJECT && v.data.object->find("name")->second == "ann");
+	ok = d["tags"].get(v);
+	assert (ok && v.type == JSON_ARRAY && v[0] == "a");
+
+	// bytes that do not fit end the iteration
+	std::string c(b.data(), b.size());
+	assert (!bson::document_view(c.data(), c.size() - 1).valid());
+	*(int32_t*)&c[4 + 1 + 5] = 1000; // length of "user"
+	bson::document_view bad(c.data(), c.size());
+	assert (bad.valid() && bad.begin() == bad.end() && !bad["price"].valid());
+
+	// strings hold at least their terminator
+	b.clear();
+	b.begin();
+	b.append("s", "ab");
+	b.end();
+	c.assign(b.data(), b.size());
+	assert (bson::document_view(c.data(), c.size())["s"].str() == "ab");
+	c[4 + 1 + 2] = 0; // length of "s"
+	assert (!bson::document_view(c.data(), c.size())["s"].valid());
+	c.assign(b.data(), b.size());
+	c[4 + 1 + 2 + 4 + 2] = 'c'; // terminator of "s"
+	assert (!bson::document_view(c.data(), c.size())["s"].valid());
+
+	// inner lengths of arrays are checked when decoding
+	const char big[] = "\x16\0\0\0\x04" "a\0" "\x0e\0\0\0\x02" "0\0" "\0\0\xff\x7f" "x\0" "\0" "\0";
+	bson::document_view g(big, sizeof(big) - 1);
+	assert (g.valid() && g["a"].valid() && !g["a"][0].valid());
+	ok = g["a"].get(v);
+	assert (ok && v.type == JSON_ARRAY && v.data.array.size == 0);
+}
+
+void test_document_index(void)
+{
+	bson::builder b;
+	b.begin();
+	b.append("id", 7);
+	b.begin_array("items");
+	for (int i = 0; i < 1000; ++i) {
+		b.begin_object(std::to_string(i).c_str());
+		b.append("n", i);
+		b.begin_array("v");
+		b.append("0", i*0.5);
+		b.end();
+		b.end();
+	}
+	b.end();
+	b.begin_object("user");
+	b.append("name", "ann");
+	b.append("id", 42);
+	b.end();
+	b.append("id", 8); // duplicate, not found
+	b.end();
+
+	bson::document_view d(b.data(), b.size());
+	bson::document_index x(d);
+	assert (x.field("id").int32() == 7 && !x.field("missing").valid());
+	bson::element_view items = x.field("items");
+	assert (items.type() == BSON_ARRAY && x.size(items) == 1000);
+	for (size_t i = 0; i < 1000; i += 37) {
+		bson::element_view e = x.element(items, i);
+		assert (x.field(e, "n").int32() == static_cast<int32_t>(i));
+		assert (x.element(x.field(e, "v"), 0).number() == i*0.5);
+	}
+	assert (!x.element(items, 1000).valid() && !x.element(x.field("user"), 0).valid());
+	bson::element_view user = x.field("user");
+	assert (x.field(user, "id").int32() == 42 && x.field(user, "name").str() == "ann");
+	assert (!x.field(user, "n").valid() && !x.field(items, "0").valid());
+	// elements agree with the view
+	assert (x.element(items, 999).raw().data == d["items"][999].raw().data);
+
+	// saved next to the document
+	std::string s = x.save();
+	bson::document_index y;
+	bool ok = y.load(d, s.data(), s.size());
+	assert (ok && y.field(y.element(y.field("items"), 500), "n").int32() == 500);
+	ok = y.load(d, s.data(), s.size() - 1);
+	assert (!ok && !y.field("id").valid());
+	bson::document_view other(b.data() + 4 + 1 + 3 + 4 + 1 + 6, b.size()); // items
+	ok = y.load(other, s.data(), s.size());
+	assert (!ok);
+	std::string same(b.data(), b.size()); // same size and shape, other bytes
+	same[same.find("ann")] = 'b';
+	bson::document_view sd(same.data(), same.size());
+	ok = y.load(sd, s.data(), s.size());
+	assert (!ok && sd.valid() && bson::document_index(sd).save().size() == s.size());
+
+	// saved bytes are checked against the document before use
+	uint32_t h[6];
+	memcpy(h, s.data(), sizeof(h));
+	size_t a = sizeof(h) + h[1]*3*4; // array slots: offset, first, count
+	while (*reinterpret_cast<const uint32_t*>(&s[a]) == 0)
+		a += 3*4;
+	std::string bad = s;
+	uint32_t huge = 0xFFFFFFF0u;
+	memcpy(&bad[a + 4], &huge, 4); // first
+	ok = y.load(d, bad.data(), bad.size());
+	assert (!ok && !y.field("id").valid());
+	bad = s;
+	memcpy(&bad[a + 8], &huge, 4); // count
+	ok = y.load(d, bad.data(), bad.size());
+	assert (!ok);
+	bad = s;
+	memcpy(&bad[bad.size() - 4], &huge, 4); // last element offset
+	ok = y.load(d, bad.data(), bad.size());
+	assert (!ok);
+	ok = y.load(d, s.data(), s.size());
+	assert (ok && y.size(y.field("items")) == 1000);
+}
+
+void test_transcode(void)
+{
+	bson::builder b;
+	b.begin();
+	b.append("s", "a\"b");
+	b.append("i", 7);
+	b.append_int64("l", INT64_C(1) << 40);
+	b.append("x", 2.0);
+	b.append_date("d", 1500000000000LL);
+	uint8_t y[] = { 1, 2, 3, 4 };
+	b.append("bin", json::byte_(4, y), BSON_BIN_UUID);
+	b.begin_array("a");
+	b.append("0", true);
+	b.append_null("1");
+	b.begin_object("2");
+	b.end();
+	b.end();
+	const char oid[] = "\x5a\x1b\x00\x01\x02\x03\x04\x05\x06\x07\x08\xff";
+	b.append_raw("o", BSON_OID, oid, 12);
+	b.append_raw("r", BSON_REGEX, "^a\0i", 5);
+	uint32_t ts[] = { 2, 1 };
+	b.append_raw("t", BSON_TIMESTAMP, reinterpret_cast<const char*>(ts), 8);
+	b.append_raw("u", BSON_UNDEFINED, "", 0);
+	b.append("inf", std::numeric_limits<double>::infinity());
+	b.end();
+	bson::document_view d(b.data(), b.size());
+
+	std::string plain = bson::to_json(d);
+	assert (plain == "{\"s\":\"a\\\"b\",\"i\":7,\"l\":1099511627776,\"x\":2.0,\"d\":1500000000000,"
+		"\"bin\":\"AQIDBA==\",\"a\":[true,null,{}],\"o\":\"5a1b000102030405060708ff\",\"r\":null,"
+		"\"t\":null,\"u\":null,\"inf\":null}");
+	std::string ext = bson::to_json(d, true);
+	assert (ext == "{\"s\":\"a\\\"b\",\"i\":7,\"l\":{\"$numberLong\":\"1099511627776\"},\"x\":2.0,"
+		"\"d\":{\"$date\":{\"$numberLong\":\"1500000000000\"}},"
+		"\"bin\":{\"$binary\":{\"base64\":\"AQIDBA==\",\"subType\":\"03\"}},\"a\":[true,null,{}],"
+		"\"o\":{\"$oid\":\"5a1b000102030405060708ff\"},"
+		"\"r\":{\"$regularExpression\":{\"pattern\":\"^a\",\"options\":\"i\"}},"
+		"\"t\":{\"$timestamp\":{\"t\":1,\"i\":2}},\"u\":{\"$undefined\":true},"
+		"\"inf\":{\"$numberDouble\":\"Infinity\"}}");
+
+	// extended JSON reads back to the same bytes
+	bson::builder c;
+	const char* p = ext.data();
+	bool ok = bson::from_json(p, ext.data() + ext.size(), c);
+	assert (ok && p == ext.data() + ext.size());
+	assert (c.str() == b.str());
+
+	// plain JSON keeps numbers, not dates or binary
+	c.clear();
+	p = plain.data();
+	ok = bson::from_json(p, plain.data() + plain.size(), c);
+	assert (ok);
+	bson::document_view e(c.data(), c.size());
+	assert (e["i"].type() == BSON_INT && e["l"].type() == BSON_LONG && e["x"].type() == BSON_DOUBLE);
+	assert (e["d"].int64() == 1500000000000LL && e["bin"].str() == "AQIDBA==" && e["a"][2].type() == BSON_OBJECT);
+	assert (bson::to_json(e) == plain);
+
+	// one document per top level object, $ keys only matter as the first key of a nested object
+	c.clear();
+	const char* two = "{\"$oid\": 1, \"n\": {\"a\": {\"$numberInt\": \"5\"}, \"$b\": 2}} {\"w\": [{\"$numberLong\": \"-3\"}]}";
+	p = two;
+	ok = bson::from_json(p, two + strlen(two), c);
+	assert (ok);
+	ok = bson::from_json(p, two + strlen(two), c);
+	assert (ok);
+	bson::document_view f(c.data(), c.size());
+	bson::document_view g(c.data() + f.size(), c.size() - f.size());
+	assert (f["$oid"].int32() == 1 && f["n"]["a"].type() == BSON_INT && f["n"]["a"].int32() == 5 && f["n"]["$b"].int32() == 2);
+	assert (g["w"][0].type() == BSON_LONG && g["w"][0].int64() == -3);
+
+	// errors
+	const char* bad[] = {
+		"[1]", "1", "{\"a\": {\"$numberLong\": 5}}", "{\"a\": {\"$oid\": \"12\"}}",
+		"{\"a\": {\"$date\": {\"$numberLong\": \"x\"}}}", "{\"a\": {\"$numberInt\": \"1\", \"b\": 2}}",
+		"{\"a\": {\"$binary\": {\"base64\": \"AQ=\", \"subType\": \"00\"}}}", "{\"a\": 1"
+	};
+	for (size_t i = 0; i < sizeof(bad)/sizeof(bad[0]); ++i) {
+		bson::builder z;
+		p = bad[i];
+		ok = bson::from_json(p, bad[i] + strlen(bad[i]), z);
+		assert (!ok);
+	}
+	std::string cut = b.str();
+	cut[cut.size() - 1 - 8 - 4 - 1] = 99; // unknown type of "inf"
+	assert (bson::to_json(bson::document_view(cut.data(), cut.size())).empty());
+}
+
+void test_file_reader(void)
+{
+	const char* path = "tbson_file_reader.bson";
+	bson::builder b;
+	int64_t expect = 0;
+	for (int32_t i = 0; i < 5000; ++i) {
+		b.begin();
+		b.append("i", i);
+		b.append("s", std::string(i % 50, 'x'));
+		b.end();
+		expect += i;
+	}
+	{
+		std::ofstream os(path, std::ios::binary);
+		os.write(b.data(), b.size());
+	}
+
+	bson::file_reader r(path);
+	assert (r.is_open() && r.file().size() == b.size());
+	bool ok = r.index();
+	assert (ok && r.size() == 5000 && r[4999]["i"].int32() == 4999);
+	assert (r[1].data() == r.file().data() + r.offsets()[1]);
+
+	// small chunks and windows so there are many of both
+	json::pool p(4);
+	std::atomic<int64_t> sum(0);
+	std::atomic<size_t> n(0);
+	auto f = [&sum, &n, &r](size_t offset, const bson::document_view& d) {
+		sum += d["i"].int32();
+		n += d.data() == r.file().data() + offset;
+	};
+	ok = r.for_each(f, p, 1000, 20000);
+	assert (ok && sum == expect && n == 5000);
+
+	// a cut off last document
+	{
+		std::ofstream os(path, std::ios::binary);
+		os.write(b.data(), b.size() - 3);
+	}
+	ok = r.open(path);
+	assert (ok);
+	ok = r.index();
+	assert (!ok && r.size() == 4999);
+	sum = 0;
+	n = 0;
+	ok = r.for_each(f, p, 1000, 20000);
+	assert (!ok && n == 4999 && sum == expect - 4999);
+	r.close();
+
+	// empty and missing files
+	{
+		std::ofstream os(path, std::ios::binary);
+	}
+	ok = r.open(path);
+	assert (ok && r.file().size() == 0);
+	ok = r.index();
+	assert (ok && r.size() == 0);
+	ok = r.for_each(f, p);
+	assert (ok);
+	r.close();
+	std::remove(path);
+	ok = r.open(path);
+	assert (!ok && !r.is_open());
+}
+
 int main()
 {
 	test_read();
 
 	test_write();
 
+	test_write_object();
+
+	test_read_interned();
+
+	test_typed_array();
+
+	test_builder();
+
+	test_document_view();
+
+	test_document_index();
+
+	test_transcode();
+
+	test_file_reader();
+
 	return 0;
 } 
\ No newline at end of file
@@ -0,0 +1,620 @@
+// transcode.h - BSON to JSON text and back without building json::value trees
+// BSON goes through a document_view into a json::writer, JSON text goes
+// through the SAX parser into a builder. Only the output grows with the input:
+//	std::string text = bson::to_json(bson::document_view(p, n));
+//	bson::builder b;
+//	const char* s = text.data();
+//	bool ok = bson::from_json(s, s + text.size(), b);
+// Plain JSON writes numbers as they are, dates as integers, binary as base64
+// strings and OIDs as hex strings. Types that JSON has nothing for are null.
+// Extended JSON (canonical MongoDB Extended JSON v2, except that doubles and
+// int32 are plain numbers) wraps the others so they read back as they were:
+//	int64       {"$numberLong": "123"}
+//	date        {"$date": {"$numberLong": "1500000000000"}}
+//	binary      {"$binary": {"base64": "AQID", "subType": "00"}}
+//	OID         {"$oid": "5a1b..."}
+//	regex       {"$regularExpression": {"pattern": "^a", "options": "i"}}
+//	timestamp   {"$timestamp": {"t": 1, "i": 2}}
+//	undefined   {"$undefined": true}
+//	code        {"$code": "..."}, symbol {"$symbol": "..."}
+//	inf, nan    {"$numberDouble": "Infinity"}
+// from_json reads both forms, plus $numberInt. Integers become int32 when
+// they fit, int64 otherwise, and other numbers doubles, like json::parse.
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+#include "sax.h"
+#include "writer.h"
+#include "bson.h"
+#include "view.h"
+
+namespace bson {
+
+	//
+	// BSON to JSON
+	//
+
+	namespace transcode {
+
+		// {"$name": "s"}
+		inline void wrap(json::writer& w, const char* name, const char* s, size_t n)
+		{
+			w.begin_object();
+			w.key(name);
+			w.value(s, n);
+			w.end_object();
+		}
+		inline void wrap(json::writer& w, const char* name, const char* s)
+		{
+			wrap(w, name, s, strlen(s));
+		}
+		inline void wrap_integer(json::writer& w, const char* name, int64_t i)
+		{
+			char s[21];
+
+			wrap(w, name, s, json::format_integer(i, s));
+		}
+		inline void hex(const char* p, size_t n, char* s)
+		{
+			static const char digits[] = "0123456789abcdef";
+
+			for (size_t i = 0; i < n; ++i) {
+				*s++ = digits[(p[i] >> 4) & 0xF];
+				*s++ = digits[p[i] & 0xF];
+			}
+		}
+
+	} // namespace transcode
+
+	inline bool to_json(json::writer& w, const document_view& d, bool array, bool extended);
+
+	// value of e, false if e or anything in it does not fit
+	inline bool to_json(json::writer& w, const element_view& e, bool extended = false)
+	{
+		json::string r = e.raw();
+		char s[24];
+
+		switch (e.type()) {
+		case BSON_DOUBLE:
+			if (extended && (e.number() != e.number() || e.number() - e.number() != 0))
+				transcode::wrap(w, "$numberDouble", e.number() != e.number() ? "NaN" : e.number() < 0 ? "-Infinity" : "Infinity");
+			else
+				w.value(e.number());
+			break;
+		case BSON_STRING:
+			w.value(e.str().data, e.str().size);
+			break;
+		case BSON_OBJECT:
+			return to_json(w, e.document(), false, extended);
+		case BSON_ARRAY:
+			return to_json(w, e.document(), true, extended);
+		case BSON_BINDATA:
+			if (extended) {
+				w.begin_object();
+				w.key("$binary");
+				w.begin_object();
+				w.key("base64");
+				w.value(e.bytes());
+				w.key("subType");
+				transcode::hex(r.data + 4, 1, s);
+				w.value(s, 2);
+				w.end_object();
+				w.end_object();
+			}
+			else {
+				w.value(e.bytes());
+			}
+			break;
+		case BSON_OID:
+			transcode::hex(r.data, 12, s);
+			if (extended)
+				transcode::wrap(w, "$oid", s, 24);
+			else
+				w.value(s, 24);
+			break;
+		case BSON_BOOL:
+			w.value(e.boolean());
+			break;
+		case BSON_DATE:
+			if (extended) {
+				w.begin_object();
+				w.key("$date");
+				transcode::wrap_integer(w, "$numberLong", e.date());
+				w.end_object();
+			}
+			else {
+				w.value(e.date());
+			}
+			break;
+		case BSON_INT:
+			w.value(e.int32());
+			break;
+		case BSON_LONG:
+			if (extended)
+				transcode::wrap_integer(w, "$numberLong", e.int64());
+			else
+				w.value(e.int64());
+			break;
+		case BSON_REGEX:
+			if (extended) {
+				size_t n = strlen(r.data);
+				w.begin_object();
+				w.key("$regularExpression");
+				w.begin_object();
+				w.key("pattern");
+				w.value(r.data, n);
+				w.key("options");
+				w.value(r.data + n + 1, r.size - n - 2);
+				w.end_object();
+				w.end_object();
+			}
+			else {
+				w.null();
+			}
+			break;
+		case BSON_TIMESTAMP:
+			if (extended) {
+				uint32_t u[2]; // increment, seconds
+				memcpy(u, r.data, 8);
+				w.begin_object();
+				w.key("$timestamp");
+				w.begin_object();
+				w.key("t");
+				w.value(static_cast<int64_t>(u[1]));
+				w.key("i");
+				w.value(static_cast<int64_t>(u[0]));
+				w.end_object();
+				w.end_object();
+			}
+			else {
+				w.null();
+			}
+			break;
+		case BSON_UNDEFINED:
+			if (extended) {
+				w.begin_object();
+				w.key("$undefined");
+				w.value(true);
+				w.end_object();
+			}
+			else {
+				w.null();
+			}
+			break;
+		case BSON_CODE:
+		case BSON_SYMBOL:
+			if (extended)
+				transcode::wrap(w, e.type() == BSON_CODE ? "$code" : "$symbol", e.str().data, e.str().size);
+			else
+				w.value(e.str().data, e.str().size);
+			break;
+		case BSON_EOO:
+			return false;
+		default: // null, deprecated DBRef and code with scope
+			w.null();
+		}
+
+		return true;
+	}
+	// d as a JSON object, or array if array is true
+	inline bool to_json(json::writer& w, const document_view& d, bool array, bool extended)
+	{
+		if (!d.valid())
+			return false;
+
+		const char* at = d.data() + 4;
+		if (array)
+			w.begin_array();
+		else
+			w.begin_object();
+		for (document_view::iterator i = d.begin(); i != d.end(); ++i) {
+			if (!array)
+				w.key(i->key().data, i->key().size);
+			if (!to_json(w, *i, extended))
+				return false;
+			at = i->next();
+		}
+		if (array)
+			w.end_array();
+		else
+			w.end_object();
+
+		return at == d.data() + d.size() - 1; // every element read
+	}
+	// false if d is not valid BSON, w is then left partly written
+	inline bool to_json(json::writer& w, const document_view& d, bool extended = false)
+	{
+		return to_json(w, d, false, extended);
+	}
+	// empty if d is not valid BSON
+	inline std::string to_json(const document_view& d, bool extended = false, int indent = 0)
+	{
+		json::buffer buf(2*d.size() + 16);
+		json::writer w(buf, indent);
+
+		return to_json(w, d, extended) ? buf.str() : std::string();
+	}
+
+	//
+	// JSON to BSON
+	//
+
+	// SAX handler that appends one document to a builder for each top level object
+	class json_handler : public json::sax::handler {
+		enum wrapper_type {
+			NONE, NUMBER_INT, NUMBER_LONG, NUMBER_DOUBLE, DATE, BINARY, OID,
+			REGEX, TIMESTAMP, UNDEFINED, CODE, SYMBOL
+		};
+		struct level {
+			bool array;
+			index_key index;
+		};
+
+		builder& out_;
+		std::vector<level> levels_;
+		std::string key_;    // key of the next value
+		bool pending_;       // an object was started that may be a wrapper
+		std::string object_; // key of that object
+		// extended JSON wrapper being read
+		wrapper_type wrapper_;
+		int depth_;          // 1 inside the nested object of $date, $binary, ...
+		bool read_;          // the value of the wrapper has been read
+		std::string field_;  // key in the nested object
+		std::string a_, b_;  // $numberLong or base64 or pattern, subType or options
+		int64_t t_, i_;      // timestamp
+		std::string bytes_;
+
+		// key for a value in the current document
+		const char* next_key(void)
+		{
+			level& l = levels_.back();
+			if (l.array) {
+				key_.assign(l.index.s, l.index.n);
+				l.index.next();
+			}
+
+			return key_.c_str();
+		}
+		void push(bool array)
+		{
+			levels_.push_back(level());
+			levels_.back().array = array;
+		}
+		// the pending object is not a wrapper after all
+		void flush(void)
+		{
+			out_.begin_object(object_.c_str());
+			push(false);
+			pending_ = false;
+		}
+		// a plain value may go here
+		bool scalar(void) const
+		{
+			return !levels_.empty() && wrapper_ == NONE; // top level must be an object
+		}
+
+		static wrapper_type wrapper(const json::string& k)
+		{
+			static const char* names[] = {
+				"", "$numberInt", "$numberLong", "$numberDouble", "$date", "$binary", "$oid",
+				"$regularExpression", "$timestamp", "$undefined", "$code", "$symbol"
+			};
+
+			if (k.size < 2 || k.data[0] != '$')
+				return NONE;
+			for (int i = NUMBER_INT; i <= SYMBOL; ++i)
+				if (k == names[i])
+					return static_cast<wrapper_type>(i);
+
+			return NONE;
+		}
+		static bool integer_text(const std::string& s, int64_t& i)
+		{
+			const char* b = s.data();
+			json::element n;
+
+			if (!json::parse::scan_number(b, s.data() + s.size(), n) || b != s.data() + s.size())
+				return false;
+			if (n.type == JSON_INT32)
+				i = n.data.int32;
+			else if (n.type == JSON_INT64)
+				i = n.data.int64;
+			else
+				return false;
+
+			return true;
+		}
+		// append the wrapper that just ended
+		bool end_wrapper(void)
+		{
+			const char* k = object_.c_str();
+			wrapper_type t = wrapper_;
+			int64_t i;
+			char raw[12];
+
+			wrapper_ = NONE;
+			if (!read_)
+				return false;
+
+			switch (t) {
+			case NUMBER_INT:
+				if (!integer_text(a_, i) || i < INT32_MIN || i > INT32_MAX)
+					return false;
+				out_.append(k, static_cast<int32_t>(i));
+				break;
+			case NUMBER_LONG:
+				if (!integer_text(a_, i))
+					return false;
+				out_.append_int64(k, i);
+				break;
+			case NUMBER_DOUBLE: {
+				double x;
+				const char* b = a_.data();
+				if (a_ == "Infinity")
+					x = std::numeric_limits<double>::infinity();
+				else if (a_ == "-Infinity")
+					x = -std::numeric_limits<double>::infinity();
+				else if (a_ == "NaN")
+					x = std::numeric_limits<double>::quiet_NaN();
+				else if (!json::parse::read_double(b, a_.data() + a_.size(), x) || b != a_.data() + a_.size())
+					return false;
+				out_.append(k, x);
+				break;
+			}
+			case DATE:
+				if (!integer_text(a_, i))
+					return false;
+				out_.append_date(k, i);
+				break;
+			case BINARY: {
+				int h = b_.size() == 2 ? json::parse::hex(b_[0]) : -1;
+				int l = b_.size() == 2 ? json::parse::hex(b_[1]) : -1;
+				if (h < 0 || l < 0 || !json::parse::read_base64(a_.data(), a_.size(), bytes_))
+					return false;
+				out_.append(k, json::byte_(bytes_.size(), reinterpret_cast<const uint8_t*>(bytes_.data())), static_cast<bson_subtype>(16*h + l));
+				break;
+			}
+			case OID:
+				if (a_.size() != 24)
+					return false;
+				for (int j = 0; j < 12; ++j) {
+					int h = json::parse::hex(a_[2*j]), l = json::parse::hex(a_[2*j + 1]);
+					if (h < 0 || l < 0)
+						return false;
+					raw[j] = static_cast<char>(16*h + l);
+				}
+				out_.append_raw(k, BSON_OID, raw, 12);
+				break;
+			case REGEX:
+				if (a_.find('\0') != std::string::npos || b_.find('\0') != std::string::npos)
+					return false;
+				bytes_ = a_;
+				bytes_ += '\0';
+				bytes_ += b_;
+				bytes_ += '\0';
+				out_.append_raw(k, BSON_REGEX, bytes_.data(), bytes_.size());
+				break;
+			case TIMESTAMP: {
+				if (t_ < 0 || t_ > UINT32_MAX || i_ < 0 || i_ > UINT32_MAX)
+					return false;
+				uint32_t u[2] = { static_cast<uint32_t>(i_), static_cast<uint32_t>(t_) };
+				out_.append_raw(k, BSON_TIMESTAMP, reinterpret_cast<const char*>(u), 8);
+				break;
+			}
+			case UNDEFINED:
+				out_.append_raw(k, BSON_UNDEFINED, "", 0);
+				break;
+			case CODE:
+			case SYMBOL: {
+				int32_t n = static_cast<int32_t>(a_.size() + 1);
+				bytes_.assign(reinterpret_cast<const char*>(&n), 4);
+				bytes_ += a_;
+				bytes_ += '\0';
+				out_.append_raw(k, t == CODE ? BSON_CODE : BSON_SYMBOL, bytes_.data(), bytes_.size());
+				break;
+			}
+			default:
+				return false;
+			}
+
+			return true;
+		}
+		// a string or integer inside a wrapper
+		bool wrapped(const json::string* s, const int64_t* i)
+		{
+			if (read_)
+				return false;
+
+			if (depth_ == 0) {
+				if (!s || wrapper_ == DATE || wrapper_ == BINARY || wrapper_ == REGEX || wrapper_ == TIMESTAMP || wrapper_ == UNDEFINED)
+					return false;
+				a_.assign(s->data, s->size);
+				read_ = true;
+			}
+			else if (wrapper_ == DATE && field_ == "$numberLong" && s)
+				a_.assign(s->data, s->size);
+			else if ((wrapper_ == BINARY && field_ == "base64") || (wrapper_ == REGEX && field_ == "pattern")) {
+				if (!s)
+					return false;
+				a_.assign(s->data, s->size);
+			}
+			else if ((wrapper_ == BINARY && field_ == "subType") || (wrapper_ == REGEX && field_ == "options")) {
+				if (!s)
+					return false;
+				b_.assign(s->data, s->size);
+			}
+			else if (wrapper_ == TIMESTAMP && field_ == "t" && i)
+				t_ = *i;
+			else if (wrapper_ == TIMESTAMP && field_ == "i" && i)
+				i_ = *i;
+			else
+				return false;
+
+			return true;
+		}
+	public:
+		explicit json_handler(builder& out)
+			: out_(out), pending_(false), wrapper_(NONE), depth_(0), read_(false), t_(-1), i_(-1)
+		{ }
+
+		// a complete document was appended
+		bool done(void) const
+		{
+			return levels_.empty() && !pending_ && wrapper_ == NONE;
+		}
+
+		bool start_object(void)
+		{
+			if (wrapper_ != NONE) {
+				if (depth_ || read_ || (wrapper_ != DATE && wrapper_ != BINARY && wrapper_ != REGEX && wrapper_ != TIMESTAMP))
+					return false;
+				depth_ = 1;
+
+				return true;
+			}
+			if (levels_.empty()) {
+				out_.begin();
+				push(false);
+
+				return true;
+			}
+			object_ = next_key();
+			pending_ = true;
+
+			return true;
+		}
+		bool key(const json::string& k)
+		{
+			if (memchr(k.data, 0, k.size))
+				return false; // BSON keys are null terminated
+
+			if (wrapper_ != NONE) {
+				if (depth_ == 0)
+					return false; // a second member next to $x
+				field_.assign(k.data, k.size);
+
+				return true;
+			}
+			if (pending_) {
+				wrapper_type t = wrapper(k);
+				if (t != NONE) {
+					pending_ = false;
+					wrapper_ = t;
+					depth_ = 0;
+					read_ = false;
+					a_.clear();
+					b_.clear();
+					t_ = i_ = -1;
+
+					return true;
+				}
+				flush();
+			}
+			key_.assign(k.data, k.size);
+
+			return true;
+		}
+		bool end_object(void)
+		{
+			if (wrapper_ != NONE) {
+				if (depth_ == 1) {
+					depth_ = 0;
+					read_ = wrapper_ == DATE ? !a_.empty()
+						: wrapper_ == TIMESTAMP ? t_ >= 0 && i_ >= 0
+						: true;
+
+					return true;
+				}
+
+				return end_wrapper();
+			}
+			if (pending_) // {}
+				flush();
+			out_.end();
+			levels_.pop_back();
+
+			return true;
+		}
+		bool start_array(void)
+		{
+			if (!scalar())
+				return false;
+			out_.begin_array(next_key());
+			push(true);
+
+			return true;
+		}
+		bool end_array(void)
+		{
+			out_.end();
+			levels_.pop_back();
+
+			return true;
+		}
+		bool string(const json::string& s)
+		{
+			if (wrapper_ != NONE)
+				return wrapped(&s, 0);
+			if (!scalar())
+				return false;
+			out_.append(next_key(), s);
+
+			return true;
+		}
+		bool number(double x)
+		{
+			if (!scalar())
+				return false;
+			out_.append(next_key(), x);
+
+			return true;
+		}
+		bool integer(int64_t i)
+		{
+			if (wrapper_ != NONE)
+				return wrapped(0, &i);
+			if (!scalar())
+				return false;
+			if (i >= INT32_MIN && i <= INT32_MAX)
+				out_.append(next_key(), static_cast<int32_t>(i));
+			else
+				out_.append_int64(next_key(), i);
+
+			return true;
+		}
+		bool boolean(bool b)
+		{
+			if (wrapper_ == UNDEFINED && depth_ == 0 && !read_ && b) {
+				read_ = true;
+
+				return true;
+			}
+			if (!scalar())
+				return false;
+			out_.append(next_key(), b);
+
+			return true;
+		}
+		bool null(void)
+		{
+			if (!scalar())
+				return false;
+			out_.append_null(next_key());
+
+			return true;
+		}
+	};
+
+	// Append the JSON object at b to out and advance b past it. On failure out
+	// is left partly written and must be cleared before it is used again.
+	inline bool from_json(const char*& b, const char* e, builder& out)
+	{
+		json_handler h(out);
+
+		return json::sax::parse(b, e, h) && h.done();
+	}
+
+} // namespace bson
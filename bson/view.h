@@ -0,0 +1,378 @@
+// view.h - read BSON in place
+// A document_view walks the elements of a BSON document without allocating
+// or copying. Keys, strings and raw values refer to the document bytes, and
+// embedded documents and arrays are document_views themselves:
+//	bson::document_view d(buf, n);
+//	for (bson::document_view::iterator i = d.begin(); i != d.end(); ++i)
+//		if (i->key() == "price" && i->type() == BSON_DOUBLE)
+//			total += i->number();
+//	int32_t id = d["user"]["id"].int32();
+// Iteration stops at the first element that does not fit in the document.
+// The bytes must outlive the views.
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <string>
+#include "bson.h"
+
+namespace bson {
+
+	class document_view;
+
+	// one element: type byte, null terminated key, value
+	class element_view {
+		const char* p_;     // type byte, 0 for a missing element
+		const char* value_; // first byte of the value
+		size_t key_size_;
+		size_t size_;       // bytes in the value
+	public:
+		element_view()
+			: p_(0), value_(0), key_size_(0), size_(0)
+		{ }
+		// parse the element at p, which must end before e
+		element_view(const char* p, const char* e)
+			: p_(0), value_(0), key_size_(0), size_(0)
+		{
+			if (p >= e || *p == 0)
+				return;
+
+			const char* k = p + 1;
+			const char* z = static_cast<const char*>(memchr(k, 0, e - k));
+			if (!z)
+				return;
+
+			const char* v = z + 1;
+			bson_type t = static_cast<bson_type>(*p);
+			size_t n = value_size(t, v, e);
+			if (n == SIZE_MAX || n > static_cast<size_t>(e - v))
+				return;
+			if ((t == BSON_STRING || t == BSON_CODE || t == BSON_SYMBOL) && v[n - 1] != 0)
+				return; // strings are null terminated
+			if (t == BSON_DBREF && v[n - 12 - 1] != 0)
+				return;
+
+			p_ = p;
+			value_ = v;
+			key_size_ = z - k;
+			size_ = n;
+		}
+
+		// bytes in the value of type t at v, SIZE_MAX if unknown or past e
+		static size_t value_size(bson_type t, const char* v, const char* e)
+		{
+			size_t avail = e - v;
+			int32_t n;
+
+			switch (t) {
+			case BSON_UNDEFINED: case BSON_NULL:
+				return 0;
+			case BSON_BOOL:
+				return 1;
+			case BSON_INT:
+				return 4;
+			case BSON_DOUBLE: case BSON_DATE: case BSON_TIMESTAMP: case BSON_LONG:
+				return 8;
+			case BSON_OID:
+				return 12;
+			case BSON_STRING: case BSON_CODE: case BSON_SYMBOL:
+			case BSON_OBJECT: case BSON_ARRAY: case BSON_CODEWSCOPE:
+			case BSON_BINDATA: case BSON_DBREF:
+				if (avail < 4)
+					return SIZE_MAX;
+				memcpy(&n, v, 4);
+				if (n < 0)
+					return SIZE_MAX;
+				if (n < 1 && (t == BSON_STRING || t == BSON_CODE || t == BSON_SYMBOL || t == BSON_DBREF))
+					return SIZE_MAX; // the length counts the terminator
+				return t == BSON_BINDATA ? 4 + 1 + static_cast<size_t>(n)
+					: t == BSON_DBREF ? 4 + static_cast<size_t>(n) + 12
+					: t == BSON_OBJECT || t == BSON_ARRAY || t == BSON_CODEWSCOPE ? static_cast<size_t>(n)
+					: 4 + static_cast<size_t>(n);
+			case BSON_REGEX: { // pattern and options, both null terminated
+				const char* a = static_cast<const char*>(memchr(v, 0, avail));
+				const char* b = a ? static_cast<const char*>(memchr(a + 1, 0, e - a - 1)) : 0;
+				return b ? b + 1 - v : SIZE_MAX;
+			}
+			default:
+				return SIZE_MAX;
+			}
+		}
+
+		bool valid(void) const
+		{
+			return p_ != 0;
+		}
+		// BSON_EOO if not valid
+		bson_type type(void) const
+		{
+			return p_ ? static_cast<bson_type>(*p_) : BSON_EOO;
+		}
+		json::string key(void) const
+		{
+			return json::string_(key_size_, p_ ? p_ + 1 : "");
+		}
+		// the value bytes as they are in the document
+		json::string raw(void) const
+		{
+			return json::string_(size_, value_);
+		}
+		// start of the next element
+		const char* next(void) const
+		{
+			return value_ + size_;
+		}
+
+		// typed accessors, 0 or empty for other types
+		double number(void) const
+		{
+			double x = 0;
+			if (type() == BSON_DOUBLE)
+				memcpy(&x, value_, 8);
+
+			return x;
+		}
+		int32_t int32(void) const
+		{
+			int32_t i = 0;
+			if (type() == BSON_INT)
+				memcpy(&i, value_, 4);
+
+			return i;
+		}
+		// BSON_LONG, or BSON_INT widened
+		int64_t int64(void) const
+		{
+			int64_t i = 0;
+			if (type() == BSON_LONG)
+				memcpy(&i, value_, 8);
+			else if (type() == BSON_INT)
+				i = int32();
+
+			return i;
+		}
+		// milliseconds since the epoch for BSON_DATE
+		int64_t date(void) const
+		{
+			int64_t d = 0;
+			if (type() == BSON_DATE)
+				memcpy(&d, value_, 8);
+
+			return d;
+		}
+		bool boolean(void) const
+		{
+			return type() == BSON_BOOL && *value_ != 0;
+		}
+		bool null(void) const
+		{
+			return type() == BSON_NULL;
+		}
+		// without the terminator
+		json::string str(void) const
+		{
+			bson_type t = type();
+			if (t != BSON_STRING && t != BSON_CODE && t != BSON_SYMBOL)
+				return json::string_(0, "");
+
+			return json::string_(size_ - 4 - 1, value_ + 4);
+		}
+		json::byte bytes(void) const
+		{
+			if (type() != BSON_BINDATA)
+				return json::byte_(0, 0);
+
+			return json::byte_(size_ - 4 - 1, reinterpret_cast<const uint8_t*>(value_) + 4 + 1);
+		}
+		// embedded document or array, empty for other types
+		inline document_view document(void) const;
+		// decode a copy, false if not valid
+		inline bool get(json::value& v) const;
+		// shorthands for document()
+		inline element_view operator[](const char* key) const;
+		inline element_view operator[](size_t i) const;
+		element_view operator[](int i) const // [0] is not a null key
+		{
+			return operator[](static_cast<size_t>(i));
+		}
+	};
+
+	class document_view {
+		const char* b_; // length
+		const char* e_; // terminating null
+	public:
+		class iterator {
+			const char* e_;
+			element_view v_;
+		public:
+			typedef std::forward_iterator_tag iterator_category;
+			typedef element_view value_type;
+			typedef ptrdiff_t difference_type;
+			typedef const element_view* pointer;
+			typedef const element_view& reference;
+
+			iterator()
+				: e_(0)
+			{ }
+			iterator(const char* p, const char* e)
+				: e_(e), v_(p, e)
+			{ }
+
+			const element_view& operator*(void) const
+			{
+				return v_;
+			}
+			const element_view* operator->(void) const
+			{
+				return &v_;
+			}
+			iterator& operator++(void)
+			{
+				v_ = element_view(v_.next(), e_);
+
+				return *this;
+			}
+			iterator operator++(int)
+			{
+				iterator i(*this);
+				++*this;
+
+				return i;
+			}
+			// all invalid elements are the end
+			bool operator==(const iterator& i) const
+			{
+				return v_.valid() ? v_.next() == i.v_.next() && i.v_.valid() : !i.v_.valid();
+			}
+			bool operator!=(const iterator& i) const
+			{
+				return !operator==(i);
+			}
+		};
+
+		document_view()
+			: b_(0), e_(0)
+		{ }
+		// document at p, its length is not checked
+		explicit document_view(const char* p)
+			: b_(0), e_(0)
+		{
+			int32_t n;
+			memcpy(&n, p, 4);
+			if (n >= 5) {
+				b_ = p;
+				e_ = p + n - 1;
+			}
+		}
+		// document at p that must fit in n bytes
+		document_view(const char* p, size_t n)
+			: b_(0), e_(0)
+		{
+			int32_t m;
+			if (n < 5)
+				return;
+			memcpy(&m, p, 4);
+			if (m >= 5 && static_cast<size_t>(m) <= n && p[m - 1] == 0) {
+				b_ = p;
+				e_ = p + m - 1;
+			}
+		}
+
+		bool valid(void) const
+		{
+			return b_ != 0;
+		}
+		// bytes including the length and terminator
+		size_t size(void) const
+		{
+			return b_ ? e_ + 1 - b_ : 0;
+		}
+		const char* data(void) const
+		{
+			return b_;
+		}
+
+		iterator begin(void) const
+		{
+			return b_ ? iterator(b_ + 4, e_) : iterator();
+		}
+		iterator end(void) const
+		{
+			return iterator();
+		}
+
+		// first element with the key, invalid if there is none
+		element_view find(const char* key, size_t n) const
+		{
+			for (iterator i = begin(); i != end(); ++i)
+				if (i->key().size == n && 0 == memcmp(i->key().data, key, n))
+					return *i;
+
+			return element_view();
+		}
+		element_view operator[](const char* key) const
+		{
+			return find(key, strlen(key));
+		}
+		// element i in document order, which is the array index for arrays
+		element_view operator[](size_t i) const
+		{
+			for (iterator j = begin(); j != end(); ++j, --i)
+				if (i == 0)
+					return *j;
+
+			return element_view();
+		}
+		element_view operator[](int i) const
+		{
+			return operator[](static_cast<size_t>(i));
+		}
+	};
+
+	inline document_view element_view::document(void) const
+	{
+		if (type() != BSON_OBJECT && type() != BSON_ARRAY)
+			return document_view();
+
+		return document_view(value_, size_);
+	}
+	inline bool element_view::get(json::value& v) const
+	{
+		if (!p_)
+			return false;
+
+		json::value w;
+		const char* p = value_;
+		switch (type()) {
+		case BSON_OBJECT: {
+			document_view d = document();
+			json::object& o = json::parse::make_object(w);
+			for (document_view::iterator i = d.begin(); i != d.end(); ++i)
+				i->get(o[std::string(i->key().data, i->key().size)]);
+			break;
+		}
+		case BSON_ARRAY: { // element by element too, the bson.h readers trust inner lengths
+			document_view d = document();
+			json::value a(0);
+			for (document_view::iterator i = d.begin(); i != d.end(); ++i)
+				i->get(a.emplace_back());
+			w.swap(a);
+			break;
+		}
+		default:
+			read_value(type(), p, w); // copies views
+		}
+		v.swap(w);
+
+		return true;
+	}
+	inline element_view element_view::operator[](const char* key) const
+	{
+		return document()[key];
+	}
+	inline element_view element_view::operator[](size_t i) const
+	{
+		return document()[i];
+	}
+
+} // namespace bson
@@ -0,0 +1,226 @@
+// arena.h - monotonic allocator for json::value trees
+// Memory is carved out of large blocks and only returned when the arena is
+// released, so a parsed document costs a handful of allocations and one release.
+// An arena is not thread safe; use one per document or per thread.
+#pragma once
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+namespace json {
+
+	class arena {
+		struct block {
+			block* next;
+			size_t size; // bytes following the header
+		};
+		struct finalizer {
+			finalizer* next;
+			void (*destroy)(void*);
+			void* p;
+		};
+		template<class T>
+		static void destroy(void* p)
+		{
+			static_cast<T*>(p)->~T();
+		}
+
+		block* head_;
+		char* cur_;
+		char* end_;
+		finalizer* fin_;
+		size_t next_; // size of next block
+		size_t size_; // bytes handed out
+
+		arena(const arena&);
+		arena& operator=(const arena&);
+
+		void grow(size_t n)
+		{
+			size_t size = n > next_ ? n : next_;
+			block* b = static_cast<block*>(malloc(sizeof(block) + size));
+			if (!b)
+				throw std::bad_alloc();
+
+			b->next = head_;
+			b->size = size;
+			head_ = b;
+			cur_ = reinterpret_cast<char*>(b + 1);
+			end_ = cur_ + size;
+
+			if (next_ < 1024*1024)
+				next_ *= 2;
+		}
+	public:
+		enum { alignment = 16 };
+
+		explicit arena(size_t block_size = 4096)
+			: head_(0), cur_(0), end_(0), fin_(0), next_(block_size), size_(0)
+		{ }
+		~arena()
+		{
+			release();
+		}
+
+		// align must be a power of 2
+		void* allocate(size_t n, size_t align = alignment)
+		{
+			char* p = reinterpret_cast<char*>((reinterpret_cast<size_t>(cur_) + align - 1) & ~(align - 1));
+
+			if (!cur_ || p > end_ || n > static_cast<size_t>(end_ - p)) { // aligning can pass end_
+				grow(n + align);
+				p = reinterpret_cast<char*>((reinterpret_cast<size_t>(cur_) + align - 1) & ~(align - 1));
+			}
+			cur_ = p + n;
+			size_ += n;
+
+			return p;
+		}
+		template<class T>
+		T* allocate(size_t n)
+		{
+			return static_cast<T*>(allocate(n*sizeof(T)));
+		}
+
+		// null terminated copy
+		const char* copy(const char* s, size_t n)
+		{
+			char* p = static_cast<char*>(allocate(n + 1, 1));
+			memcpy(p, s, n);
+			p[n] = 0;
+
+			return p;
+		}
+
+		// construct a T whose destructor is called on release
+		template<class T>
+		T* create(void)
+		{
+			void* p = allocate(sizeof(T));
+			finalizer* f = allocate<finalizer>(1);
+
+			T* t = new (p) T();
+			f->next = fin_;
+			f->destroy = destroy<T>;
+			f->p = t;
+			fin_ = f;
+
+			return t;
+		}
+		template<class T, class A, class B>
+		T* create(const A& a, const B& b)
+		{
+			void* p = allocate(sizeof(T));
+			finalizer* f = allocate<finalizer>(1);
+
+			T* t = new (p) T(a, b);
+			f->next = fin_;
+			f->destroy = destroy<T>;
+			f->p = t;
+			fin_ = f;
+
+			return t;
+		}
+
+		// run finalizers in reverse order of creation and free all blocks
+		void release(void)
+		{
+			reset();
+
+			if (head_) {
+				free(head_);
+				head_ = 0;
+			}
+			cur_ = end_ = 0;
+		}
+		// like release, but keep the most recent (largest) block for the next document
+		void reset(void)
+		{
+			for (finalizer* f = fin_; f; f = f->next)
+				f->destroy(f->p);
+			fin_ = 0;
+
+			if (head_) {
+				while (head_->next) {
+					block* b = head_->next;
+					head_->next = b->next;
+					free(b);
+				}
+				cur_ = reinterpret_cast<char*>(head_ + 1);
+				end_ = cur_ + head_->size;
+			}
+			size_ = 0;
+		}
+
+		size_t size(void) const
+		{
+			return size_;
+		}
+	};
+
+	// standard allocator that uses an arena if it has one and the heap otherwise
+	template<class T>
+	class allocator {
+	public:
+		typedef T value_type;
+		typedef T* pointer;
+		typedef const T* const_pointer;
+		typedef T& reference;
+		typedef const T& const_reference;
+		typedef size_t size_type;
+		typedef ptrdiff_t difference_type;
+		template<class U> struct rebind { typedef json::allocator<U> other; };
+
+		json::arena* arena;
+
+		allocator(json::arena* a = 0)
+			: arena(a)
+		{ }
+		template<class U>
+		allocator(const allocator<U>& a)
+			: arena(a.arena)
+		{ }
+
+		T* allocate(size_t n, const void* = 0)
+		{
+			return arena ? arena->allocate<T>(n) : static_cast<T*>(::operator new(n*sizeof(T)));
+		}
+		void deallocate(T* p, size_t)
+		{
+			if (!arena)
+				::operator delete(p);
+		}
+		size_t max_size(void) const
+		{
+			return static_cast<size_t>(-1)/sizeof(T);
+		}
+		template<class U>
+		void construct(U* p, const U& u)
+		{
+			new (p) U(u);
+		}
+		template<class U>
+		void destroy(U* p)
+		{
+			p->~U();
+		}
+
+		// copies of arena objects live on the heap
+		allocator select_on_container_copy_construction(void) const
+		{
+			return allocator();
+		}
+	};
+	template<class T, class U>
+	inline bool operator==(const allocator<T>& a, const allocator<U>& b)
+	{
+		return a.arena == b.arena;
+	}
+	template<class T, class U>
+	inline bool operator!=(const allocator<T>& a, const allocator<U>& b)
+	{
+		return a.arena != b.arena;
+	}
+
+} // namespace json
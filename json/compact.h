@@ -0,0 +1,673 @@
+// compact.h - 8 byte NaN boxed JSON value
+// A double is stored as itself. Everything else lives in the payload of a
+// negative quiet NaN whose top 16 bits are 0xFFF9 through 0xFFFF:
+//	0xFFF9  undefined, null, false or true in the payload
+//	0xFFFA  int32 in the low 32 bits
+//	0xFFFB  pointer to a length and null terminated bytes
+//	0xFFFC  pointer to a size, capacity and compact elements
+//	0xFFFD  pointer to a json::flat_map<std::string, compact>
+//	0xFFFE  pointer to a json::element holding an int64 or date
+//	0xFFFF  pointer to a length and bytes
+// NaN arguments are stored as the canonical positive quiet NaN so they never
+// look like a tag. Pointers must fit in 48 bits, as they do on x64 and arm64
+// unless the system hands out higher addresses; storage at such an address is
+// released again and std::bad_alloc thrown.
+// Arrays of numbers take 8 bytes per element instead of sizeof(json::element).
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string>
+#include "json.h"
+
+namespace json {
+
+	class compact {
+	public:
+		typedef json::flat_map<std::string, compact> object_type;
+	private:
+		enum tag {
+			DOUBLE,
+			SCALAR,
+			INT32,
+			STRING,
+			ARRAY,
+			OBJECT,
+			BOXED,
+			BYTES,
+		};
+		enum scalar { UNDEFINED, NUL, FALSE, TRUE };
+
+		// length followed by the bytes
+		struct chars {
+			size_t size;
+			char data[1];
+		};
+		struct array_rep {
+			size_t size;
+			size_t capacity;
+
+			compact* element(void)
+			{
+				return reinterpret_cast<compact*>(this + 1);
+			}
+		};
+
+		uint64_t bits_;
+
+		static const uint64_t payload_mask = (uint64_t(1) << 48) - 1;
+
+		static uint64_t make(tag t, uint64_t payload)
+		{
+			return (uint64_t(0xFFF8 + t) << 48) | payload;
+		}
+		static bool fits(uintptr_t u)
+		{
+			return (static_cast<uint64_t>(u) & ~payload_mask) == 0;
+		}
+		// p is from allocate or fit
+		static uint64_t make(tag t, const void* p)
+		{
+			uintptr_t u = reinterpret_cast<uintptr_t>(p);
+			ensure (fits(u));
+
+			return make(t, static_cast<uint64_t>(u));
+		}
+		// malloc for storage a payload can point to
+		static void* allocate(size_t n)
+		{
+			void* p = malloc(n);
+			if (p && !fits(reinterpret_cast<uintptr_t>(p))) {
+				free(p);
+				p = 0;
+			}
+			if (!p)
+				throw std::bad_alloc();
+
+			return p;
+		}
+		// the same for storage from new
+		template<class T>
+		static T* fit(T* p)
+		{
+			if (!fits(reinterpret_cast<uintptr_t>(p))) {
+				delete p;
+				throw std::bad_alloc();
+			}
+
+			return p;
+		}
+		tag tag_of(void) const
+		{
+			unsigned high = static_cast<unsigned>(bits_ >> 48);
+
+			return high > 0xFFF8 ? static_cast<tag>(high - 0xFFF8) : DOUBLE;
+		}
+		uint64_t payload(void) const
+		{
+			return bits_ & payload_mask;
+		}
+		template<class T>
+		T* pointer(void) const
+		{
+			return reinterpret_cast<T*>(static_cast<uintptr_t>(payload()));
+		}
+
+		static chars* make_chars(const void* s, size_t n)
+		{
+			chars* c = static_cast<chars*>(allocate(sizeof(chars) + n));
+			c->size = n;
+			if (n)
+				memcpy(c->data, s, n);
+			c->data[n] = 0;
+
+			return c;
+		}
+		static array_rep* make_array(size_t capacity)
+		{
+			array_rep* a = static_cast<array_rep*>(allocate(sizeof(array_rep) + capacity*sizeof(compact)));
+			a->size = 0;
+			a->capacity = capacity;
+
+			return a;
+		}
+
+		void construct(const compact& c)
+		{
+			switch (c.tag_of()) {
+			case STRING:
+				bits_ = make(STRING, make_chars(c.pointer<chars>()->data, c.pointer<chars>()->size));
+				break;
+			case BYTES:
+				bits_ = make(BYTES, make_chars(c.pointer<chars>()->data, c.pointer<chars>()->size));
+				break;
+			case ARRAY: {
+				const array_rep* b = c.pointer<array_rep>();
+				array_rep* a = make_array(b->size);
+				for (size_t i = 0; i < b->size; ++i)
+					new (a->element() + i) compact(const_cast<array_rep*>(b)->element()[i]);
+				a->size = b->size;
+				bits_ = make(ARRAY, a);
+				break;
+			}
+			case OBJECT:
+				bits_ = make(OBJECT, fit(new object_type(*c.pointer<object_type>())));
+				break;
+			case BOXED:
+				bits_ = make(BOXED, fit(new json::element(*c.pointer<json::element>())));
+				break;
+			default: // no storage
+				bits_ = c.bits_;
+			}
+		}
+		void destroy(void)
+		{
+			switch (tag_of()) {
+			case STRING: case BYTES:
+				free(pointer<chars>());
+				break;
+			case ARRAY: {
+				array_rep* a = pointer<array_rep>();
+				for (size_t i = 0; i < a->size; ++i)
+					a->element()[i].~compact();
+				free(a);
+				break;
+			}
+			case OBJECT:
+				delete pointer<object_type>();
+				break;
+			case BOXED:
+				delete pointer<json::element>();
+				break;
+			default:
+				break;
+			}
+			bits_ = make(SCALAR, uint64_t(UNDEFINED));
+		}
+		array_rep* array(void) const
+		{
+			ensure (tag_of() == ARRAY);
+
+			return pointer<array_rep>();
+		}
+	public:
+		compact()
+			: bits_(make(SCALAR, uint64_t(UNDEFINED)))
+		{ }
+		explicit compact(double x)
+		{
+			if (x != x) {
+				bits_ = 0x7FF8000000000000ull; // canonical NaN
+			}
+			else {
+				memcpy(&bits_, &x, sizeof(x));
+			}
+		}
+		explicit compact(bool b)
+			: bits_(make(SCALAR, uint64_t(b ? TRUE : FALSE)))
+		{ }
+		compact(const char* s)
+			: bits_(make(STRING, make_chars(s, strlen(s))))
+		{ }
+		compact(const json::string& s)
+			: bits_(make(STRING, make_chars(s.data, s.size)))
+		{ }
+		// array of n undefined elements, like json::value(int)
+		explicit compact(int n)
+		{
+			array_rep* a = make_array(n);
+			for (int i = 0; i < n; ++i)
+				new (a->element() + i) compact();
+			a->size = n;
+			bits_ = make(ARRAY, a);
+		}
+		// copy of a value tree
+		explicit compact(const json::element& e)
+		{
+			switch (e.type) {
+			case JSON_STRING:
+				bits_ = make(STRING, make_chars(e.str().data, e.str().size));
+				break;
+			case JSON_NUMBER:
+				new (this) compact(e.data.number);
+				break;
+			case JSON_OBJECT: {
+				object_type* o = fit(new object_type);
+				o->reserve(e.data.object->size());
+				for (json::object::const_iterator i = e.data.object->begin(); i != e.data.object->end(); ++i)
+					o->insert(object_type::value_type(i->first, compact(i->second)));
+				bits_ = make(OBJECT, o);
+				break;
+			}
+			case JSON_ARRAY: {
+				array_rep* a = make_array(e.data.array.size);
+				for (size_t i = 0; i < e.data.array.size; ++i)
+					new (a->element() + i) compact(e.at(i));
+				a->size = e.data.array.size;
+				bits_ = make(ARRAY, a);
+				break;
+			}
+			case JSON_TRUE:
+				bits_ = make(SCALAR, uint64_t(TRUE));
+				break;
+			case JSON_FALSE:
+				bits_ = make(SCALAR, uint64_t(FALSE));
+				break;
+			case JSON_NULL:
+				bits_ = make(SCALAR, uint64_t(NUL));
+				break;
+#ifndef JSON_ONLY
+			case JSON_BYTE:
+				bits_ = make(BYTES, make_chars(e.data.byte.data, e.data.byte.size));
+				break;
+			case JSON_INT32:
+				bits_ = make(INT32, uint64_t(static_cast<uint32_t>(e.data.int32)));
+				break;
+			case JSON_INT64:
+			case JSON_DATE: {
+				json::element* b = fit(new json::element);
+				b->type = e.type;
+				b->flags = 0;
+				b->data = e.data;
+				bits_ = make(BOXED, b);
+				break;
+			}
+#endif
+			default:
+				bits_ = make(SCALAR, uint64_t(UNDEFINED));
+			}
+		}
+		compact(const compact& c)
+		{
+			construct(c);
+		}
+		compact& operator=(const compact& c)
+		{
+			if (this != &c) {
+				compact d(c);
+				swap(d);
+			}
+
+			return *this;
+		}
+		compact(compact&& c)
+			: bits_(c.bits_)
+		{
+			c.bits_ = make(SCALAR, uint64_t(UNDEFINED));
+		}
+		compact& operator=(compact&& c)
+		{
+			if (this != &c) {
+				compact d(std::move(c));
+				swap(d);
+			}
+
+			return *this;
+		}
+		~compact()
+		{
+			destroy();
+		}
+		void swap(compact& c)
+		{
+			std::swap(bits_, c.bits_);
+		}
+
+		static compact null(void)
+		{
+			compact c;
+			c.bits_ = make(SCALAR, uint64_t(NUL));
+
+			return c;
+		}
+		// empty object
+		static compact object(void)
+		{
+			compact c;
+			c.bits_ = make(OBJECT, fit(new object_type));
+
+			return c;
+		}
+
+		json_element_type type(void) const
+		{
+			switch (tag_of()) {
+			case DOUBLE: return JSON_NUMBER;
+			case STRING: return JSON_STRING;
+			case ARRAY: return JSON_ARRAY;
+			case OBJECT: return JSON_OBJECT;
+#ifndef JSON_ONLY
+			case INT32: return JSON_INT32;
+			case BYTES: return JSON_BYTE;
+			case BOXED: return pointer<json::element>()->type;
+#endif
+			case SCALAR:
+				switch (payload()) {
+				case NUL: return JSON_NULL;
+				case FALSE: return JSON_FALSE;
+				case TRUE: return JSON_TRUE;
+				}
+				// fall through
+			default:
+				return JSON_UNDEFINED;
+			}
+		}
+
+		// JSON_NUMBER only
+		double number(void) const
+		{
+			double x;
+			memcpy(&x, &bits_, sizeof(x));
+
+			return x;
+		}
+		// JSON_STRING and JSON_BYTE only, null terminated
+		json::string str(void) const
+		{
+			return string_(pointer<chars>()->size, pointer<chars>()->data);
+		}
+#ifndef JSON_ONLY
+		int32_t int32(void) const
+		{
+			return static_cast<int32_t>(payload());
+		}
+		int64_t int64(void) const
+		{
+			return pointer<json::element>()->data.int64;
+		}
+		time_t date(void) const
+		{
+			return pointer<json::element>()->data.date;
+		}
+#endif
+
+		// elements or members, 0 for other types
+		size_t size(void) const
+		{
+			return tag_of() == ARRAY ? array()->size
+				: tag_of() == OBJECT ? pointer<object_type>()->size()
+				: 0;
+		}
+
+		// array
+		compact& operator[](size_t i)
+		{
+			ensure (i < array()->size);
+
+			return array()->element()[i];
+		}
+		const compact& operator[](size_t i) const
+		{
+			ensure (i < array()->size);
+
+			return array()->element()[i];
+		}
+		const compact& operator[](int i) const // [0] is not a null key
+		{
+			return operator[](static_cast<size_t>(i));
+		}
+		compact& operator[](int i)
+		{
+			return operator[](static_cast<size_t>(i));
+		}
+		void reserve(size_t n)
+		{
+			if (tag_of() != ARRAY) {
+				compact a(0);
+				swap(a);
+			}
+			array_rep* a = array();
+			if (n > a->capacity) {
+				size_t c = a->capacity ? a->capacity : 4;
+				while (c < n)
+					c <<= 1;
+				// elements are plain bits and can be moved with memcpy
+				array_rep* b = static_cast<array_rep*>(allocate(sizeof(array_rep) + c*sizeof(compact)));
+				memcpy(b, a, sizeof(array_rep) + a->size*sizeof(compact));
+				free(a);
+				b->capacity = c;
+				bits_ = make(ARRAY, b);
+			}
+		}
+		// undefined values become an empty array first
+		compact& push_back(compact&& c)
+		{
+			reserve(size() + 1);
+			array_rep* a = array();
+			new (a->element() + a->size) compact(std::move(c));
+			++a->size;
+
+			return *this;
+		}
+		compact& push_back(const compact& c)
+		{
+			compact d(c); // c might live in this array
+
+			return push_back(std::move(d));
+		}
+
+		// object members, undefined if there is no such key
+		const compact& operator[](const char* key) const
+		{
+			static const compact undefined;
+
+			if (tag_of() != OBJECT)
+				return undefined;
+
+			const object_type& o = *pointer<object_type>();
+			object_type::const_iterator i = o.find(key);
+
+			return i == o.end() ? undefined : i->second;
+		}
+		// member to modify, 0 if not an object or there is no such key
+		compact* find(const char* key)
+		{
+			if (tag_of() != OBJECT)
+				return 0;
+
+			object_type& o = *pointer<object_type>();
+			object_type::iterator i = o.find(key);
+
+			return i == o.end() ? 0 : &i->second;
+		}
+		// insert or replace a member, undefined values become an empty object first
+		compact& set(const std::string& key, compact&& c)
+		{
+			if (tag_of() != OBJECT) {
+				compact o = object();
+				swap(o);
+			}
+			object_type& o = *pointer<object_type>();
+			std::pair<object_type::iterator,bool> i = o.insert(object_type::value_type(key, compact()));
+			i.first->second = std::move(c);
+
+			return *this;
+		}
+		const object_type& members(void) const
+		{
+			ensure (tag_of() == OBJECT);
+
+			return *pointer<object_type>();
+		}
+
+		// copy into a value tree
+		void get(json::value& v) const
+		{
+			json::value w;
+
+			switch (type()) {
+			case JSON_STRING:
+				w = str();
+				break;
+			case JSON_NUMBER:
+				w = number();
+				break;
+			case JSON_OBJECT: {
+				json::object& o = parse::make_object(w);
+				const object_type& m = members();
+				for (object_type::const_iterator i = m.begin(); i != m.end(); ++i)
+					i->second.get(o[i->first]);
+				break;
+			}
+			case JSON_ARRAY: {
+				const array_rep* a = array();
+				json::value x(static_cast<int>(a->size));
+				for (size_t i = 0; i < a->size; ++i)
+					const_cast<array_rep*>(a)->element()[i].get(x[i]);
+				w.swap(x);
+				break;
+			}
+			case JSON_TRUE:
+				w = true;
+				break;
+			case JSON_FALSE:
+				w = false;
+				break;
+			case JSON_NULL:
+				w.type = JSON_NULL;
+				break;
+#ifndef JSON_ONLY
+			case JSON_BYTE:
+				w = byte_(str().size, reinterpret_cast<const uint8_t*>(str().data));
+				break;
+			case JSON_INT32:
+				w = json::int32_(int32());
+				break;
+			case JSON_INT64:
+			case JSON_DATE:
+				w = *pointer<json::element>();
+				break;
+#endif
+			default:
+				break;
+			}
+
+			v.swap(w);
+		}
+
+		// same rules as json::element
+		bool operator==(const compact& c) const
+		{
+			json_element_type t = type();
+
+			if (t != c.type())
+				return false;
+
+			switch (t) {
+			case JSON_NUMBER:
+				return number() == c.number();
+			case JSON_STRING:
+#ifndef JSON_ONLY
+			case JSON_BYTE:
+#endif
+				return str() == c.str();
+			case JSON_ARRAY: {
+				if (size() != c.size())
+					return false;
+				for (size_t i = 0; i < size(); ++i)
+					if (!(operator[](i) == c[i]))
+						return false;
+
+				return true;
+			}
+			case JSON_OBJECT:
+				return members() == c.members();
+			case JSON_TRUE: case JSON_FALSE:
+				return true;
+#ifndef JSON_ONLY
+			case JSON_INT32:
+				return int32() == c.int32();
+			case JSON_INT64:
+				return int64() == c.int64();
+			case JSON_DATE:
+				return date() == c.date();
+#endif
+			default: // null and undefined, just like javascript
+				return false;
+			}
+		}
+		bool operator<(const compact& c) const
+		{
+			json_element_type t = type();
+
+			if (t != c.type())
+				return t < c.type();
+
+			switch (t) {
+			case JSON_NUMBER:
+				return number() < c.number();
+			case JSON_STRING:
+#ifndef JSON_ONLY
+			case JSON_BYTE:
+#endif
+				return str() < c.str();
+			case JSON_ARRAY:
+				return std::lexicographical_compare(array()->element(), array()->element() + size(),
+					c.array()->element(), c.array()->element() + c.size());
+			case JSON_OBJECT:
+				return members() < c.members();
+			case JSON_FALSE:
+				return c.type() == JSON_TRUE;
+#ifndef JSON_ONLY
+			case JSON_INT32:
+				return int32() < c.int32();
+			case JSON_INT64:
+				return int64() < c.int64();
+			case JSON_DATE:
+				return date() < c.date();
+#endif
+			default:
+				return false;
+			}
+		}
+		bool operator==(double x) const
+		{
+			return type() == JSON_NUMBER && number() == x;
+		}
+		bool operator==(const char* s) const
+		{
+			return type() == JSON_STRING && str() == s;
+		}
+		bool operator==(bool b) const
+		{
+			return type() == (b ? JSON_TRUE : JSON_FALSE);
+		}
+	};
+
+	inline void serialize(buffer& buf, const json::compact& c, int indent = 0, int depth = 0)
+	{
+		char* p;
+
+		switch (c.type()) {
+		case JSON_STRING:
+			serialize_string(buf, c.str().data, c.str().size);
+			break;
+		case JSON_NUMBER:
+			p = buf.reserve(32);
+			buf.advance(format_double(c.number(), p));
+			break;
+		case JSON_OBJECT:
+			serialize_object(buf, c.members(), indent, depth);
+			break;
+		case JSON_ARRAY:
+			buf.put('[');
+			for (size_t i = 0; i < c.size(); ++i) {
+				if (i)
+					buf.put(',');
+				serialize_indent(buf, indent, depth + 1);
+				serialize(buf, c[i], indent, depth + 1);
+			}
+			if (c.size())
+				serialize_indent(buf, indent, depth);
+			buf.put(']');
+			break;
+		default: {
+			// scalars print the same as json::value
+			json::value v;
+			c.get(v);
+			serialize(buf, static_cast<const json::element&>(v), indent, depth);
+		}
+		}
+	}
+
+} // namespace json
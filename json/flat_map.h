@@ -0,0 +1,337 @@
+// flat_map.h - associative container that keeps members contiguous in insertion order
+// Lookups compare 32-bit key hashes in a linear scan for small maps and use an
+// open addressing table of member indices once there are more than flat_map::small.
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace json {
+
+	// FNV-1a
+	inline uint32_t key_hash(const char* s, size_t n)
+	{
+		uint32_t h = 2166136261u;
+
+		for (size_t i = 0; i < n; ++i) {
+			h ^= static_cast<unsigned char>(s[i]);
+			h *= 16777619u;
+		}
+
+		return h;
+	}
+	inline uint32_t key_hash(const std::string& s)
+	{
+		return key_hash(s.data(), s.size());
+	}
+	// Key types other than std::string overload key_lookup(s, n, k) to set k to
+	// the key named by the n bytes at s, false if no member can have that name,
+	// so that looking a name up does not store it. See json::key.
+
+	template<class K, class V>
+	class flat_map {
+	public:
+		typedef K key_type;
+		typedef V mapped_type;
+		typedef std::pair<K,V> value_type;
+		typedef typename std::vector<value_type>::iterator iterator;
+		typedef typename std::vector<value_type>::const_iterator const_iterator;
+		typedef size_t size_type;
+
+		enum { small = 16 }; // largest map without a hash table
+	private:
+		std::vector<value_type> member_;
+		std::vector<uint32_t> hash_;  // hash_[i] is the hash of member_[i].first
+		std::vector<uint32_t> table_; // 1 + index into member_, 0 if empty
+
+		// index of the member with hash h whose key is equal, member_.size() if none
+		template<class E>
+		size_t probe(uint32_t h, E equal) const
+		{
+			if (table_.empty()) {
+				for (size_t i = 0; i < hash_.size(); ++i)
+					if (hash_[i] == h && equal(member_[i].first))
+						return i;
+			}
+			else {
+				size_t mask = table_.size() - 1;
+				for (size_t j = h & mask; table_[j]; j = (j + 1) & mask) {
+					size_t i = table_[j] - 1;
+					if (hash_[i] == h && equal(member_[i].first))
+						return i;
+				}
+			}
+
+			return member_.size();
+		}
+		size_t position(uint32_t h, const K& k) const
+		{
+			return probe(h, [&k](const K& m) { return m == k; });
+		}
+		// by the n bytes at s, std::string keys are compared in place
+		size_t named(const char* s, size_t n, std::true_type) const
+		{
+			return probe(key_hash(s, n), [s, n](const std::string& m) { return m.size() == n && memcmp(m.data(), s, n) == 0; });
+		}
+		size_t named(const char* s, size_t n, std::false_type) const
+		{
+			K k;
+			return key_lookup(s, n, k) ? position(key_hash(k), k) : member_.size();
+		}
+		template<class P>
+		size_t named_in(const char* s, size_t n, const P& from) const
+		{
+			K k;
+			return key_lookup(s, n, k, from) ? position(key_hash(k), k) : member_.size();
+		}
+		static const char* name_data(const char* s)
+		{
+			return s;
+		}
+		static size_t name_size(const char* s)
+		{
+			return strlen(s);
+		}
+		static const char* name_data(const std::string& s)
+		{
+			return s.data();
+		}
+		static size_t name_size(const std::string& s)
+		{
+			return s.size();
+		}
+		void index(size_t i)
+		{
+			size_t mask = table_.size() - 1;
+			size_t j = hash_[i] & mask;
+
+			while (table_[j])
+				j = (j + 1) & mask;
+			table_[j] = static_cast<uint32_t>(i + 1);
+		}
+		void rehash(void)
+		{
+			table_.clear();
+			if (member_.size() <= small)
+				return;
+
+			size_t n = 2*small;
+			while (n < 2*member_.size())
+				n <<= 1;
+			table_.resize(n);
+			for (size_t i = 0; i < member_.size(); ++i)
+				index(i);
+		}
+		template<class P>
+		std::pair<iterator,bool> insert_(P&& kv)
+		{
+			uint32_t h = key_hash(kv.first);
+			size_t i = position(h, kv.first);
+
+			if (i != member_.size())
+				return std::make_pair(member_.begin() + i, false);
+
+			member_.push_back(std::forward<P>(kv));
+			hash_.push_back(h);
+			if (member_.size() > small) {
+				if (2*member_.size() > table_.size())
+					rehash();
+				else
+					index(i);
+			}
+
+			return std::make_pair(member_.begin() + i, true);
+		}
+	public:
+		flat_map()
+		{ }
+
+		iterator begin(void)
+		{
+			return member_.begin();
+		}
+		const_iterator begin(void) const
+		{
+			return member_.begin();
+		}
+		iterator end(void)
+		{
+			return member_.end();
+		}
+		const_iterator end(void) const
+		{
+			return member_.end();
+		}
+		size_t size(void) const
+		{
+			return member_.size();
+		}
+		bool empty(void) const
+		{
+			return member_.empty();
+		}
+		void clear(void)
+		{
+			member_.clear();
+			hash_.clear();
+			table_.clear();
+		}
+		void reserve(size_t n)
+		{
+			member_.reserve(n);
+			hash_.reserve(n);
+		}
+
+		iterator find(const K& k)
+		{
+			return member_.begin() + position(key_hash(k), k);
+		}
+		const_iterator find(const K& k) const
+		{
+			return member_.begin() + position(key_hash(k), k);
+		}
+		size_t count(const K& k) const
+		{
+			return find(k) != end();
+		}
+		// by name, such as "id", without making a key that is not there
+		template<class S>
+		iterator find(const S& s)
+		{
+			return member_.begin() + named(name_data(s), name_size(s), std::is_same<K,std::string>());
+		}
+		template<class S>
+		const_iterator find(const S& s) const
+		{
+			return member_.begin() + named(name_data(s), name_size(s), std::is_same<K,std::string>());
+		}
+		template<class S>
+		size_t count(const S& s) const
+		{
+			return find(s) != end();
+		}
+		// by name, with keys made by key_lookup(s, n, k, from), such as
+		// json::key from a json::key_pool other than the global one
+		template<class S, class P>
+		iterator find(const S& s, const P& from)
+		{
+			return member_.begin() + named_in(name_data(s), name_size(s), from);
+		}
+		template<class S, class P>
+		const_iterator find(const S& s, const P& from) const
+		{
+			return member_.begin() + named_in(name_data(s), name_size(s), from);
+		}
+		template<class S, class P>
+		size_t count(const S& s, const P& from) const
+		{
+			return find(s, from) != end();
+		}
+
+		// does not replace existing members, just like std::map
+		std::pair<iterator,bool> insert(const value_type& kv)
+		{
+			return insert_(kv);
+		}
+		std::pair<iterator,bool> insert(value_type&& kv)
+		{
+			return insert_(std::move(kv));
+		}
+		V& operator[](const K& k)
+		{
+			return insert_(value_type(k, V())).first->second;
+		}
+		template<class S>
+		V& operator[](const S& s)
+		{
+			return operator[](K(s));
+		}
+		// throws if there is no such member
+		const V& operator[](const K& k) const
+		{
+			const_iterator i = find(k);
+			if (i == end())
+				throw std::out_of_range("json::flat_map: no such member");
+
+			return i->second;
+		}
+		template<class S>
+		const V& operator[](const S& s) const
+		{
+			const_iterator i = find(s);
+			if (i == end())
+				throw std::out_of_range("json::flat_map: no such member");
+
+			return i->second;
+		}
+
+		// preserves the order of the remaining members
+		size_t erase(const K& k)
+		{
+			size_t i = position(key_hash(k), k);
+
+			if (i == member_.size())
+				return 0;
+
+			member_.erase(member_.begin() + i);
+			hash_.erase(hash_.begin() + i);
+			rehash();
+
+			return 1;
+		}
+
+		// same members, in any order
+		bool operator==(const flat_map& m) const
+		{
+			if (size() != m.size())
+				return false;
+
+			for (size_t i = 0; i < member_.size(); ++i) {
+				size_t j = m.position(hash_[i], member_[i].first);
+				if (j == m.size() || !(member_[i].second == m.member_[j].second))
+					return false;
+			}
+
+			return true;
+		}
+		// Members in key order, as std::map compares them, so that maps
+		// that are == are never < one another whatever their insertion order.
+		bool operator<(const flat_map& m) const
+		{
+			std::vector<size_t> a = sorted(), b = m.sorted();
+
+			for (size_t i = 0; i < a.size() && i < b.size(); ++i) {
+				const value_type& x = member_[a[i]];
+				const value_type& y = m.member_[b[i]];
+				if (x.first < y.first)
+					return true;
+				if (y.first < x.first)
+					return false;
+				if (x.second < y.second)
+					return true;
+				if (y.second < x.second)
+					return false;
+			}
+
+			return a.size() < b.size();
+		}
+	private:
+		// indices of the members in key order
+		std::vector<size_t> sorted(void) const
+		{
+			std::vector<size_t> i(member_.size());
+
+			for (size_t j = 0; j < i.size(); ++j)
+				i[j] = j;
+			std::sort(i.begin(), i.end(), [this](size_t a, size_t b) { return member_[a].first < member_[b].first; });
+
+			return i;
+		}
+	};
+
+} // namespace json
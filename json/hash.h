@@ -0,0 +1,263 @@
+// hash.h - deep hashes of JSON values
+// Values that compare equal have the same hash, so they can be keys of
+// unordered containers. operator== has null != null, so containers use
+// json::equal_to, which finds every value equal to itself:
+//	std::unordered_set<json::value, std::hash<json::value>, json::equal_to> seen;
+//	if (!seen.insert(v).second)
+//		... // duplicate
+// The hash of a shared value (value::share()) is cached in its storage the
+// first time it is computed. Shared values are immutable, so the cache stays
+// valid. operator== returns false at once when two shared values have cached
+// hashes that differ.
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include "json.h"
+
+namespace json {
+
+	// murmur3 finalizer
+	inline uint64_t hash_mix(uint64_t h)
+	{
+		h ^= h >> 33;
+		h *= UINT64_C(0xff51afd7ed558ccd);
+		h ^= h >> 33;
+		h *= UINT64_C(0xc4ceb9fe1a85ec53);
+		h ^= h >> 33;
+
+		return h;
+	}
+	inline uint64_t hash_combine(uint64_t h, uint64_t v)
+	{
+		return hash_mix(h ^ (v + UINT64_C(0x9e3779b97f4a7c15) + (h << 6) + (h >> 2)));
+	}
+
+	// 8 bytes per step
+	inline uint64_t hash_bytes(const void* p, size_t n, uint64_t seed = 0)
+	{
+		const uint64_t k1 = UINT64_C(0x87c37b91114253d5);
+		const uint64_t k2 = UINT64_C(0x4cf5ad432745937f);
+		const unsigned char* b = static_cast<const unsigned char*>(p);
+		uint64_t h = seed ^ (n*k1);
+		uint64_t w;
+
+		for (; n >= 8; n -= 8, b += 8) {
+			memcpy(&w, b, 8);
+			w *= k1;
+			w = (w << 31) | (w >> 33);
+			h ^= w*k2;
+			h = ((h << 27) | (h >> 37))*5 + 0x52dce729;
+		}
+		if (n) {
+			w = 0;
+			memcpy(&w, b, n);
+			h ^= ((w*k2) << 33 | (w*k2) >> 31)*k1;
+		}
+
+		return hash_mix(h);
+	}
+
+	inline size_t hash(const json::string& s)
+	{
+		return static_cast<size_t>(hash_bytes(s.data, s.size, JSON_STRING));
+	}
+#ifndef JSON_ONLY
+	inline size_t hash(const json::byte& b)
+	{
+		return static_cast<size_t>(hash_bytes(b.data, b.size, JSON_BYTE));
+	}
+#endif
+	inline size_t hash(const json::element& e);
+	inline size_t hash(const json::array& a)
+	{
+		uint64_t h = hash_mix(JSON_ARRAY ^ a.size);
+
+		for (size_t i = 0; i < a.size; ++i)
+			h = hash_combine(h, hash(a.element[i]));
+
+		return static_cast<size_t>(h);
+	}
+	// members in key order
+	inline size_t hash(const json::object& o)
+	{
+		uint64_t h = hash_mix(JSON_OBJECT ^ o.size());
+
+		for (json::object::const_iterator i = o.begin(); i != o.end(); ++i)
+			h = hash_combine(hash_combine(h, hash_bytes(i->first.data(), i->first.size())), hash(i->second));
+
+		return static_cast<size_t>(h);
+	}
+	// flat_object equality ignores member order, so does its hash
+	inline size_t hash(const json::flat_object& o)
+	{
+		uint64_t h = 0;
+
+		for (json::flat_object::const_iterator i = o.begin(); i != o.end(); ++i)
+			h += hash_combine(hash_bytes(i->first.data(), i->first.size()), hash(i->second));
+
+		return static_cast<size_t>(hash_mix(h ^ JSON_OBJECT ^ o.size()));
+	}
+
+	// hash of the storage of e, which is not cached
+	inline size_t hash_storage(const json::element& e)
+	{
+		uint64_t h;
+
+		switch (e.type) {
+		case JSON_STRING:
+			return hash(e.str());
+		case JSON_OBJECT:
+			return hash(*e.data.object);
+		case JSON_ARRAY:
+			if (!(e.flags & JSON_FLAG_TYPED))
+				return hash(e.data.array);
+			// same as the elements would hash to
+			h = hash_mix(JSON_ARRAY ^ e.data.array.size);
+			for (size_t i = 0; i < e.data.array.size; ++i)
+				h = hash_combine(h, hash(e.at(i)));
+
+			return static_cast<size_t>(h);
+#ifndef JSON_ONLY
+		case JSON_BYTE:
+			return hash(e.data.byte);
+#endif
+		default:
+			return 0;
+		}
+	}
+
+	inline size_t hash(const json::element& e)
+	{
+		uint64_t u;
+
+		switch (e.type) {
+		case JSON_NUMBER: {
+			double x = e.data.number == 0 ? 0.0 // -0 == 0
+				: e.data.number != e.data.number ? std::numeric_limits<double>::quiet_NaN() // one NaN for equal()
+				: e.data.number;
+			memcpy(&u, &x, sizeof(x));
+			break;
+		}
+#ifndef JSON_ONLY
+		case JSON_INT32:
+			u = static_cast<uint64_t>(e.data.int32);
+			break;
+		case JSON_INT64:
+			u = static_cast<uint64_t>(e.data.int64);
+			break;
+		case JSON_DATE:
+			u = static_cast<uint64_t>(e.data.date);
+			break;
+#endif
+		case JSON_STRING:
+		case JSON_OBJECT:
+		case JSON_ARRAY:
+#ifndef JSON_ONLY
+		case JSON_BYTE:
+#endif
+			if (const void* p = shared_storage(e)) {
+				std::atomic<size_t>& cached = shared::header(p)->hash;
+				size_t h = cached.load(std::memory_order_relaxed);
+				if (!h) {
+					h = hash_storage(e);
+					h = h ? h : 1; // 0 means not computed
+					cached.store(h, std::memory_order_relaxed);
+				}
+
+				return h;
+			}
+			else {
+				size_t h = hash_storage(e);
+
+				return h ? h : 1; // same as when cached
+			}
+		default: // true, false, null and undefined
+			u = 0;
+		}
+
+		return static_cast<size_t>(hash_combine(e.type, u));
+	}
+
+	// operator== except that null, undefined and NaN are equal to themselves
+	inline bool equal(const json::element& a, const json::element& b)
+	{
+		if (a.type != b.type)
+			return false;
+
+		switch (a.type) {
+		case JSON_NULL:
+		case JSON_UNDEFINED:
+			return true;
+		case JSON_NUMBER:
+			return a.data.number == b.data.number || (a.data.number != a.data.number && b.data.number != b.data.number);
+		case JSON_ARRAY:
+			if (a.data.array.size != b.data.array.size || hash_differs(a, b))
+				return false;
+			for (size_t i = 0; i < a.data.array.size; ++i)
+				if (!equal(a.at(i), b.at(i)))
+					return false;
+
+			return true;
+		case JSON_OBJECT: {
+			const json::object& o = *a.data.object;
+			const json::object& p = *b.data.object;
+			if (o.size() != p.size() || hash_differs(a, b))
+				return false;
+			for (json::object::const_iterator i = o.begin(), j = p.begin(); i != o.end(); ++i, ++j)
+				if (i->first != j->first || !equal(i->second, j->second))
+					return false;
+
+			return true;
+		}
+		default:
+			return a == b;
+		}
+	}
+	// for unordered containers
+	struct equal_to {
+		bool operator()(const json::element& a, const json::element& b) const
+		{
+			return equal(a, b);
+		}
+	};
+
+} // namespace json
+
+namespace std {
+
+	template<> struct hash<json::value> {
+		size_t operator()(const json::value& v) const
+		{
+			return json::hash(static_cast<const json::element&>(v));
+		}
+	};
+	template<> struct hash<json::string> {
+		size_t operator()(const json::string& s) const
+		{
+			return json::hash(s);
+		}
+	};
+	template<> struct hash<json::array> {
+		size_t operator()(const json::array& a) const
+		{
+			return json::hash(a);
+		}
+	};
+#ifndef JSON_ONLY
+	template<> struct hash<json::byte> {
+		size_t operator()(const json::byte& b) const
+		{
+			return json::hash(b);
+		}
+	};
+#endif
+	template<> struct hash<json::object> {
+		size_t operator()(const json::object& o) const
+		{
+			return json::hash(o);
+		}
+	};
+
+} // namespace std
@@ -0,0 +1,256 @@
+// intern.h - shared pool of object member names
+// A json::key is a pointer to the one copy of its bytes in a key_pool, so keys
+// from the same pool are equal exactly when the pointers are, and the hash is
+// computed once when the name is first seen. Only adding a name takes a lock;
+// finding one that is already there, copying, comparing and hashing keys do not.
+//	json::interned_object o;
+//	json::parse::read_object(b, e, o); // member names go to key_pool::global()
+//	o.find("id"); // names that were never interned are not added
+//	p.find("id", pool); // keys from another pool
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "json.h"
+
+namespace json {
+
+	class key_pool {
+	public:
+		// length, hash and a null terminated copy of the bytes
+		struct rep {
+			uint32_t hash;
+			uint32_t size;
+			char data[1];
+		};
+	private:
+		// open addressing, power of 2 size
+		// Slots go from 0 to a name and never change again, so readers probe
+		// without the lock. A table that is replaced is kept for readers that
+		// are still in it, which at most doubles the memory of the newest one.
+		struct table {
+			explicit table(size_t n)
+				: mask(n - 1), slot(new std::atomic<const rep*>[n])
+			{
+				for (size_t i = 0; i < n; ++i)
+					slot[i].store(0, std::memory_order_relaxed);
+			}
+
+			size_t mask;
+			std::unique_ptr<std::atomic<const rep*>[]> slot;
+		};
+
+		std::mutex m_; // held while adding names
+		json::arena arena_;
+		std::vector<std::unique_ptr<table>> tables_; // every table so far, the last is current
+		std::atomic<const table*> table_;
+		size_t size_;
+
+		key_pool(const key_pool&);
+		key_pool& operator=(const key_pool&);
+
+		// the copy of the n bytes at s with hash h, 0 if there is none
+		const rep* find(const table* t, uint32_t h, const char* s, size_t n) const
+		{
+			for (size_t j = h & t->mask;; j = (j + 1) & t->mask) {
+				const rep* r = t->slot[j].load(std::memory_order_acquire);
+				if (!r || (r->hash == h && r->size == n && memcmp(r->data, s, n) == 0))
+					return r;
+			}
+		}
+		void grow(void)
+		{
+			const table* t = table_.load(std::memory_order_relaxed);
+			std::unique_ptr<table> g(new table(t ? 2*(t->mask + 1) : 256));
+
+			for (size_t i = 0; t && i <= t->mask; ++i) {
+				const rep* r = t->slot[i].load(std::memory_order_relaxed);
+				if (r) {
+					size_t j = r->hash & g->mask;
+					while (g->slot[j].load(std::memory_order_relaxed))
+						j = (j + 1) & g->mask;
+					g->slot[j].store(r, std::memory_order_relaxed);
+				}
+			}
+			table_.store(g.get(), std::memory_order_release);
+			tables_.push_back(std::move(g));
+		}
+	public:
+		key_pool()
+			: table_(0), size_(0)
+		{ }
+
+		// the pool used when none is given
+		static key_pool& global(void)
+		{
+			static key_pool pool;
+
+			return pool;
+		}
+		// the one empty key, shared by every pool
+		static const rep* empty(void)
+		{
+			static const rep e = { key_hash("", 0), 0, { 0 } };
+
+			return &e;
+		}
+
+		const rep* intern(const char* s, size_t n)
+		{
+			if (n == 0)
+				return empty();
+
+			ensure (n <= UINT32_MAX);
+			uint32_t h = key_hash(s, n);
+			const table* t = table_.load(std::memory_order_acquire);
+			const rep* r = t ? find(t, h, s, n) : 0;
+			if (r)
+				return r;
+
+			std::lock_guard<std::mutex> lock(m_);
+
+			t = table_.load(std::memory_order_relaxed);
+			if (!t || 2*(size_ + 1) > t->mask + 1) {
+				grow();
+				t = table_.load(std::memory_order_relaxed);
+			}
+			size_t j = h & t->mask;
+			for (; (r = t->slot[j].load(std::memory_order_relaxed)); j = (j + 1) & t->mask) {
+				if (r->hash == h && r->size == n && memcmp(r->data, s, n) == 0)
+					return r; // added since the search above
+			}
+
+			rep* a = static_cast<rep*>(arena_.allocate(offsetof(rep, data) + n + 1, sizeof(uint32_t)));
+			a->hash = h;
+			a->size = static_cast<uint32_t>(n);
+			memcpy(a->data, s, n);
+			a->data[n] = 0;
+			t->slot[j].store(a, std::memory_order_release);
+			++size_;
+
+			return a;
+		}
+
+		// the stored copy of s, 0 if it has not been interned, without the lock
+		const rep* lookup(const char* s, size_t n) const
+		{
+			if (n == 0)
+				return empty();
+
+			const table* t = table_.load(std::memory_order_acquire);
+
+			return t ? find(t, key_hash(s, n), s, n) : 0;
+		}
+
+		// distinct keys
+		size_t size(void)
+		{
+			std::lock_guard<std::mutex> lock(m_);
+
+			return size_;
+		}
+	};
+
+	// pointer sized handle to an interned member name
+	// Only compare keys from the same pool.
+	class key {
+		const key_pool::rep* rep_;
+
+		friend bool key_lookup(const char* s, size_t n, key& k, const key_pool& pool);
+	public:
+		key()
+			: rep_(key_pool::empty())
+		{ }
+		key(const char* s)
+			: rep_(key_pool::global().intern(s, strlen(s)))
+		{ }
+		key(const std::string& s)
+			: rep_(key_pool::global().intern(s.data(), s.size()))
+		{ }
+		key(const char* s, size_t n, key_pool& pool = key_pool::global())
+			: rep_(pool.intern(s, n))
+		{ }
+
+		const char* data(void) const
+		{
+			return rep_->data;
+		}
+		const char* c_str(void) const
+		{
+			return rep_->data;
+		}
+		size_t size(void) const
+		{
+			return rep_->size;
+		}
+		bool empty(void) const
+		{
+			return rep_->size == 0;
+		}
+		uint32_t hash(void) const
+		{
+			return rep_->hash;
+		}
+		std::string str(void) const
+		{
+			return std::string(rep_->data, rep_->size);
+		}
+
+		bool operator==(const key& k) const
+		{
+			return rep_ == k.rep_;
+		}
+		bool operator!=(const key& k) const
+		{
+			return rep_ != k.rep_;
+		}
+		// by content so ordered containers do not depend on addresses
+		bool operator<(const key& k) const
+		{
+			return rep_ != k.rep_ && string_(size(), data()) < string_(k.size(), k.data());
+		}
+	};
+
+	// found by flat_map through argument dependent lookup
+	inline uint32_t key_hash(const json::key& k)
+	{
+		return k.hash();
+	}
+	// the key for a name that has been interned, names never seen are not added
+	// interned_object::find(name, pool) looks in a pool other than the global one
+	inline bool key_lookup(const char* s, size_t n, key& k, const key_pool& pool)
+	{
+		const key_pool::rep* r = pool.lookup(s, n);
+		if (r)
+			k.rep_ = r;
+
+		return r != 0;
+	}
+	inline bool key_lookup(const char* s, size_t n, json::key& k)
+	{
+		return key_lookup(s, n, k, key_pool::global());
+	}
+
+	// flat_object with interned member names
+	typedef json::flat_map<json::key, value> interned_object;
+
+	inline void serialize(buffer& buf, const json::interned_object& o, int indent = 0)
+	{
+		serialize_object(buf, o, indent);
+	}
+
+} // namespace json
+
+inline std::ostream& operator<<(std::ostream& os, const json::interned_object& o)
+{
+	json::buffer buf;
+
+	json::serialize(buf, o);
+
+	return os.write(buf.data(), buf.size());
+}
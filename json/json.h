@@ -1,13 +1,29 @@
 // json.h - Lightweight C++ wrappers for mongo C library.
+#pragma once
 #include <cstring>
 #include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <clocale>
 #include <algorithm>
+#include <atomic>
 #include <functional>
 #include <iostream>
 #include <map>
+#include <stdexcept>
 #include <string>
 #include <vector>
 #include <utility>
+#include "arena.h"
+#include "flat_map.h"
+#include "simd.h"
+#ifdef _WIN32
+#include <locale.h>
+#elif defined(__APPLE__)
+#include <xlocale.h>
+#else
+#include <locale.h>
+#endif
 #ifndef ensure
 #include <cassert>
 #define ensure assert
@@ -33,12 +49,22 @@ typedef enum {
 	JSON_UNDEFINED // "empty" type
 } json_element_type;
 
+typedef enum {
+	JSON_FLAG_VIEW = 1,   // storage is owned by someone else, e.g. a parse buffer or arena
+	JSON_FLAG_INLINE = 2, // string bytes are in the element, size in the bits above JSON_INLINE_SHIFT
+	JSON_FLAG_SHARED = 4, // storage follows a json::shared header and is immutable
+	JSON_FLAG_TYPED = 8   // array of native numbers, their type in the bits above JSON_INLINE_SHIFT
+} json_element_flag;
+#define JSON_INLINE_SHIFT 8
+
 namespace json {
 
 	class value;
 	struct element;
 	typedef std::pair<std::string,json::value> pair;
-	typedef std::map<std::string, value> object;
+	typedef std::map<std::string, value, std::less<std::string>, json::allocator<std::pair<const std::string, value> > > object;
+	// contiguous members in insertion order, nested objects are still json::object
+	typedef json::flat_map<std::string, value> flat_object;
 
 	// POD types for holding the bits
 	struct string {
@@ -57,7 +83,14 @@ namespace json {
 
 	struct array {
 		size_t size;
-		json::element* element;
+		union {
+			json::element* element;
+			double* number; // JSON_FLAG_TYPED arrays, see element::span()
+#ifndef JSON_ONLY
+			int32_t* int32;
+			int64_t* int64;
+#endif
+		};
 	};
 	inline array array_(size_t size, json::element* element)
 	{
@@ -83,6 +116,57 @@ namespace json {
 		return b;
 	}
 #endif
+
+	// contiguous run of T, e.g. the numbers of a typed array
+	template<class T>
+	struct span {
+		size_t size;
+		T* data;
+
+		T* begin(void) const
+		{
+			return data;
+		}
+		T* end(void) const
+		{
+			return data + size;
+		}
+		T& operator[](size_t i) const
+		{
+			return data[i];
+		}
+	};
+	template<class T>
+	inline span<T> span_(size_t size, T* data)
+	{
+		span<T> s;
+
+		s.size = size;
+		s.data = data;
+
+		return s;
+	}
+
+	// element type of typed arrays of T
+	template<typename T> struct typed_enum { };
+	template<> struct typed_enum<double> { static const json_element_type type = JSON_NUMBER; };
+#ifndef JSON_ONLY
+	template<> struct typed_enum<int32_t> { static const json_element_type type = JSON_INT32; };
+	template<> struct typed_enum<int64_t> { static const json_element_type type = JSON_INT64; };
+#endif
+	// bytes per number in a typed array, 0 if the type cannot be stored in one
+	inline size_t typed_width(json_element_type t)
+	{
+		switch (t) {
+		case JSON_NUMBER: return sizeof(double);
+#ifndef JSON_ONLY
+		case JSON_INT32: return sizeof(int32_t);
+		case JSON_INT64: return sizeof(int64_t);
+#endif
+		default: return 0;
+		}
+	}
+
 	struct element {
 		union {
 			json::string string;
@@ -97,11 +181,68 @@ namespace json {
 #endif
 		} data;
 		json_element_type type;
+		unsigned int flags; // json_element_flag bits
+
+		// Short strings are stored inline and data.string is not valid for them.
+		// Use this to read JSON_STRING elements.
+		json::string str(void) const
+		{
+			return flags & JSON_FLAG_INLINE
+				? string_(flags >> JSON_INLINE_SHIFT, reinterpret_cast<const char*>(&data))
+				: data.string;
+		}
+
+		// Arrays of one kind of number can be stored as native arrays, see value::pack().
+		// The type of their numbers, JSON_UNDEFINED for other values.
+		json_element_type typed(void) const
+		{
+			return flags & JSON_FLAG_TYPED
+				? static_cast<json_element_type>(flags >> JSON_INLINE_SHIFT)
+				: JSON_UNDEFINED;
+		}
+		// numbers of a typed array of T, empty for anything else
+		template<class T>
+		json::span<const T> span(void) const
+		{
+			return typed() == typed_enum<T>::type
+				? span_(data.array.size, reinterpret_cast<const T*>(data.array.element))
+				: span_<const T>(0, 0);
+		}
+		// array element i, typed or not
+		element at(size_t i) const
+		{
+			if (!(flags & JSON_FLAG_TYPED))
+				return data.array.element[i];
+
+			element e;
+			e.type = typed();
+			e.flags = 0;
+			switch (e.type) {
+			case JSON_NUMBER:
+				e.data.number = data.array.number[i];
+				break;
+#ifndef JSON_ONLY
+			case JSON_INT32:
+				e.data.int32 = data.array.int32[i];
+				break;
+			case JSON_INT64:
+				e.data.int64 = data.array.int64[i];
+				break;
+#endif
+			default:
+				break;
+			}
+
+			return e;
+		}
 	};
+	// longest inline string, the byte after it holds a null
+	enum { inline_capacity = sizeof(((element*)0)->data) - 1 };
 
+	// strings need not be null terminated
 	inline bool operator==(const string& s, const string& t)
 	{
-		return s.size == t.size && 0 == strcmp(s.data, t.data);
+		return s.size == t.size && 0 == memcmp(s.data, t.data, s.size);
 	}
 	inline bool operator==(const string& s, const char* t)
 	{
@@ -109,7 +250,9 @@ namespace json {
 	}
 	inline bool operator<(const string& s, const string& t)
 	{
-		return strcmp(s.data, t.data) < 0;
+		int cmp = memcmp(s.data, t.data, s.size < t.size ? s.size : t.size);
+
+		return cmp < 0 || (cmp == 0 && s.size < t.size);
 	}
 	inline bool operator<(const string& s, const char* t)
 	{
@@ -124,6 +267,42 @@ namespace json {
 	{
 		return std::lexicographical_compare(a.element, a.element + a.size, b.element, b.element + b.size);
 	}
+	// JSON_ARRAY elements, typed or not
+	inline bool operator==(const element& a, const element& b);
+	inline bool operator<(const element& a, const element& b);
+	inline bool equal_array(const element& a, const element& b)
+	{
+		if (!((a.flags | b.flags) & JSON_FLAG_TYPED))
+			return a.data.array == b.data.array;
+		if (a.data.array.size != b.data.array.size)
+			return false;
+		if (a.typed() == b.typed())
+			return a.typed() == JSON_NUMBER
+				? std::equal(a.data.array.number, a.data.array.number + a.data.array.size, b.data.array.number)
+				: 0 == memcmp(a.data.array.element, b.data.array.element, a.data.array.size*typed_width(a.typed()));
+
+		for (size_t i = 0; i < a.data.array.size; ++i)
+			if (!(a.at(i) == b.at(i)))
+				return false;
+
+		return true;
+	}
+	inline bool less_array(const element& a, const element& b)
+	{
+		if (!((a.flags | b.flags) & JSON_FLAG_TYPED))
+			return a.data.array < b.data.array;
+
+		size_t n = a.data.array.size < b.data.array.size ? a.data.array.size : b.data.array.size;
+		for (size_t i = 0; i < n; ++i) {
+			element x = a.at(i), y = b.at(i);
+			if (x < y)
+				return true;
+			if (y < x)
+				return false;
+		}
+
+		return a.data.array.size < b.data.array.size;
+	}
 
 	inline bool operator==(const byte& a, const byte& b)
 	{
@@ -136,19 +315,19 @@ namespace json {
 
 	inline bool operator==(const element& e, const string& s)
 	{
-		return e.type == JSON_STRING && e.data.string == s;
+		return e.type == JSON_STRING && e.str() == s;
 	}
 	inline bool operator<(const element& e, const string& s)
 	{
-		return e.type == JSON_STRING && e.data.string < s;
+		return e.type == JSON_STRING && e.str() < s;
 	}
 	inline bool operator==(const element& e, const char* s)
 	{
-		return e.type == JSON_STRING && e.data.string == s;
+		return e.type == JSON_STRING && e.str() == s;
 	}
 	inline bool operator<(const element& e, const char* s)
 	{
-		return e.type == JSON_STRING && e.data.string < s;
+		return e.type == JSON_STRING && e.str() < s;
 	}
 
 	inline bool operator==(const element& e, double number)
@@ -196,13 +375,43 @@ namespace json {
 		return e.type == JSON_DATE && e.data.date < date;
 	}
 #endif
+#ifndef JSON_ONLY
+	// value(int) is an array and int64_t is time_t on most platforms
+	inline element int32_(int32_t i)
+	{
+		element e;
+
+		e.type = JSON_INT32;
+		e.flags = 0;
+		e.data.int32 = i;
+
+		return e;
+	}
+	inline element int64_(int64_t i)
+	{
+		element e;
+
+		e.type = JSON_INT64;
+		e.flags = 0;
+		e.data.int64 = i;
+
+		return e;
+	}
+#endif
+	// defined after json::value is complete
+	inline bool equal_object(const object* a, const object* b);
+	inline bool less_object(const object* a, const object* b);
+	// defined after json::shared
+	inline bool hash_differs(const element& a, const element& b);
+
 	inline bool operator==(const element& a, const element& b)
 	{
 		return a.type != b.type ? false
-			: a.type == JSON_STRING ? a == b.data.string
+			: json::hash_differs(a, b) ? false
+			: a.type == JSON_STRING ? a == b.str()
 			: a.type == JSON_NUMBER ? a == b.data.number
-			: a.type == JSON_OBJECT ? a.data.object == b.data.object
-			: a.type == JSON_ARRAY ? a == b.data.array
+			: a.type == JSON_OBJECT ? json::equal_object(a.data.object, b.data.object)
+			: a.type == JSON_ARRAY ? json::equal_array(a, b)
 			: a.type == JSON_TRUE ? b.type == JSON_TRUE
 			: a.type == JSON_FALSE ? b.type == JSON_FALSE
 			: a.type == JSON_NULL ? false // just like javascript
@@ -219,10 +428,10 @@ namespace json {
 	{
 		return a.type < b.type ? true
 			: a.type >  b.type ? false
-			: a.type == JSON_STRING ? a < b.data.string
+			: a.type == JSON_STRING ? a < b.str()
 			: a.type == JSON_NUMBER ? a < b.data.number
-			: a.type == JSON_OBJECT ? a.data.object < b.data.object
-			: a.type == JSON_ARRAY ? a < b.data.array
+			: a.type == JSON_OBJECT ? json::less_object(a.data.object, b.data.object)
+			: a.type == JSON_ARRAY ? json::less_array(a, b)
 			: a.type == JSON_TRUE ? false
 			: a.type == JSON_FALSE ? b.type == JSON_TRUE
 			: a.type == JSON_NULL ? false // just like javascript
@@ -236,6 +445,75 @@ namespace json {
 			;
 	}
 
+	// Reference counted storage starts right after this header.
+	// Copies of a shared value bump the count, the last one out frees it.
+	struct shared {
+		std::atomic<size_t> refs;
+		std::atomic<size_t> hash; // deep hash of the storage once computed, 0 before, see hash.h
+
+		// storage for n bytes with a count of 1
+		static void* allocate(size_t n)
+		{
+			shared* h = static_cast<shared*>(malloc(sizeof(shared) + n));
+			ensure (h);
+			h->refs.store(1, std::memory_order_relaxed);
+			h->hash.store(0, std::memory_order_relaxed);
+
+			return h + 1;
+		}
+		static shared* header(const void* p)
+		{
+			return static_cast<shared*>(const_cast<void*>(p)) - 1;
+		}
+		static void acquire(const void* p)
+		{
+			header(p)->refs.fetch_add(1, std::memory_order_relaxed);
+		}
+		// true if this was the last reference and the storage should be destroyed
+		static bool release(const void* p)
+		{
+			return header(p)->refs.fetch_sub(1, std::memory_order_acq_rel) == 1;
+		}
+		static void free(const void* p)
+		{
+			::free(header(p));
+		}
+		static size_t count(const void* p)
+		{
+			return header(p)->refs.load(std::memory_order_acquire);
+		}
+	};
+
+	// storage of a shared string, array, object or bytes, 0 for anything else
+	inline const void* shared_storage(const element& e)
+	{
+		if (!(e.flags & JSON_FLAG_SHARED))
+			return 0;
+
+		switch (e.type) {
+		case JSON_STRING: return e.data.string.data;
+		case JSON_OBJECT: return e.data.object;
+		case JSON_ARRAY: return e.data.array.element;
+#ifndef JSON_ONLY
+		case JSON_BYTE: return e.data.byte.data;
+#endif
+		default: return 0;
+		}
+	}
+	// both hashes were computed and cached and they are not the same
+	inline bool hash_differs(const element& a, const element& b)
+	{
+		const void* p = shared_storage(a);
+		const void* q = shared_storage(b);
+		if (!p || !q)
+			return false;
+
+		size_t h = shared::header(p)->hash.load(std::memory_order_relaxed);
+		size_t k = shared::header(q)->hash.load(std::memory_order_relaxed);
+
+		return h && k && h != k;
+	}
+
 	// real class for managing memory
 	class value : public element {
 	public:
@@ -255,55 +533,41 @@ namespace json {
 		value()
 		{
 			type = JSON_UNDEFINED;
+			flags = 0;
 		}
 		value(const value& v)
 		{
-			operator=(v);
+			construct_value(v);
 		}
 		value& operator=(const value& v)
+		{
+			return operator=(static_cast<const json::element&>(v));
+		}
+		// steal the bits, views stay views
+		value(value&& v)
+		{
+			static_cast<json::element&>(*this) = v;
+			v.type = JSON_UNDEFINED;
+			v.flags = 0;
+		}
+		value& operator=(value&& v)
 		{
 			if (this != &v) {
-				switch (v.type) {
-				case JSON_STRING:
-					operator=(v.data.string);
-					break;
-				case JSON_ARRAY:
-					operator=(v.data.array);
-					break;
-#ifndef JSON_ONLY
-				case JSON_BYTE:
-					operator=(v.data.byte);
-					break;
-#endif
-				default: // non pointer types
-					type = v.type;
-					data = v.data;
-				}
+				value v_(std::move(v));
+				swap(v_);
 			}
 
 			return *this;
 		}
 		value(const json::element& e)
 		{
-			operator=(e);
+			construct_value(e);
 		}
 		value& operator=(const json::element& e)
 		{
-			switch (e.type) {
-			case JSON_STRING:
-				operator=(e.data.string);
-				break;
-			case JSON_ARRAY:
-				operator=(e.data.array);
-				break;
-#ifndef JSON_ONLY
-			case JSON_BYTE:
-				operator=(e.data.byte);
-				break;
-#endif
-			default: // non pointer types
-				type = e.type;
-				data = e.data;
+			if (this != &e) {
+				value v(e); // e might live inside of *this
+				swap(v);
 			}
 
 			return *this;
@@ -313,15 +577,32 @@ namespace json {
 			delete_value();
 		}
 
+		void swap(value& v)
+		{
+			std::swap(static_cast<json::element&>(*this), static_cast<json::element&>(v));
+		}
+
 		bool operator==(const value& v) const
 		{
 			return this->operator const json::element &() == v.operator const json::element &();
 		}
+		bool operator<(const value& v) const
+		{
+			return this->operator const json::element &() < v.operator const json::element &();
+		}
+		bool operator==(const json::element& e) const
+		{
+			return this->operator const json::element &() == e;
+		}
+		bool operator<(const json::element& e) const
+		{
+			return this->operator const json::element &() < e;
+		}
 
 		// string
 		value(const char* s)
 		{
-			construct_string(s);
+			construct_string(s, strlen(s));
 		}
 		value(const json::string& s)
 		{
@@ -329,15 +610,44 @@ namespace json {
 		}
 		value& operator=(const char* s)
 		{
-			delete_value();
-			construct_string(s);
+			value v(s);
+			swap(v);
 
 			return *this;
 		}
 		value& operator=(const json::string& s)
+		{
+			value v(s);
+			swap(v);
+
+			return *this;
+		}
+		// string referring to storage owned by the caller, e.g. a parse buffer
+		value& view(const json::string& s)
 		{
 			delete_value();
-			construct_string(s.data, s.size);
+			type = JSON_STRING;
+			flags = JSON_FLAG_VIEW;
+			data.string = s;
+
+			return *this;
+		}
+		// array or object owned by the caller, e.g. an arena
+		value& view(const json::array& a)
+		{
+			delete_value();
+			type = JSON_ARRAY;
+			flags = JSON_FLAG_VIEW;
+			data.array = a;
+
+			return *this;
+		}
+		value& view(json::object* o)
+		{
+			delete_value();
+			type = JSON_OBJECT;
+			flags = JSON_FLAG_VIEW;
+			data.object = o;
 
 			return *this;
 		}
@@ -355,6 +665,7 @@ namespace json {
 		explicit value(double number)
 		{
 			type = JSON_NUMBER;
+			flags = 0;
 			data.number = number;
 		}
 		value& operator=(double number)
@@ -374,6 +685,55 @@ namespace json {
 			return operator const json::element&() < number;
 		}
 
+		// object
+		value(const json::object& o)
+		{
+			construct_object(o);
+		}
+		value& operator=(const json::object& o)
+		{
+			value v(o);
+			swap(v);
+
+			return *this;
+		}
+		// members that can be modified, shared storage is copied first
+		json::object& object(void)
+		{
+			// ensure type == JSON_OBJECT;
+			unshare();
+			return *data.object;
+		}
+		const json::object& object(void) const
+		{
+			return *data.object;
+		}
+		// member k, added if there is none
+		json::value& operator[](const std::string& k)
+		{
+			return object()[k];
+		}
+		// member k, throws if there is none
+		const json::value& operator[](const std::string& k) const
+		{
+			json::object::const_iterator i = data.object->find(k);
+			if (i == data.object->end())
+				throw std::out_of_range("json::value: no member " + k);
+
+			return i->second;
+		}
+		// literals, which would otherwise tie with indexing the literal by a value
+		template<size_t N>
+		json::value& operator[](const char (&k)[N])
+		{
+			return operator[](std::string(k));
+		}
+		template<size_t N>
+		const json::value& operator[](const char (&k)[N]) const
+		{
+			return operator[](std::string(k));
+		}
+
 		// array
 		explicit value(int n)
 		{
@@ -381,21 +741,29 @@ namespace json {
 		}
 		value& operator=(const array& a)
 		{
-			delete_value();
-			construct_array(a.size);
+			value v;
+			v.construct_array(a.size);
 			for (size_t i = 0; i < a.size; ++i)
-				operator[](i) = a.element[i];
+				v[i] = a.element[i];
+			swap(v);
 
 			return *this;
 		}
 		json::value& operator[](size_t i)
 		{
 			// ensure type == JSON_ARRAY;
+			if (flags & (JSON_FLAG_SHARED | JSON_FLAG_TYPED)) {
+				unpack(); // there are no elements to refer to
+				unshare(); // the element might be modified
+			}
 			return static_cast<json::value&>(data.array.element[i]);
 		}
+		// typed arrays have no elements to refer to, use at() or span()
 		const json::value& operator[](size_t i) const
 		{
 			// ensure type == JSON_ARRAY;
+			if (flags & JSON_FLAG_TYPED)
+				throw std::logic_error("json::value: const operator[] on a typed array");
 			return static_cast<const json::value&>(data.array.element[i]);
 		}
 		json::value& push_back(const json::element& element)
@@ -404,153 +772,580 @@ namespace json {
 			
 			return *this;
 		}
+		json::value& push_back(json::value&& v)
+		{
+			emplace_back(std::move(v));
+
+			return *this;
+		}
 		json::value& push_back(const json::array& array)
 		{
 			push_back_array(array);
 			
 			return *this;
 		}
-#ifndef JSON_ONLY
-		// byte
-		value(size_t size, uint8_t* data)
-		{
-			construct_byte(size, data);
-		}
-		value& operator=(const byte& b)
+		// append a value constructed from t and return it
+		// t may refer to an element of this array, it is used before the array grows
+		template<class T>
+		json::value& emplace_back(T&& t)
 		{
-			delete_value();
-			construct_byte(b.size, b.data);
+			json::value v(std::forward<T>(t));
+			json::element& e = back_array();
+			new (&e) json::value(std::move(v));
+			++data.array.size;
 
-			return *this;
-		}
-#endif
-		explicit value(bool b)
-		{
-			type = b ? JSON_TRUE : JSON_FALSE;
+			return static_cast<json::value&>(e);
 		}
-		value& operator=(bool b)
+		json::value& emplace_back(void)
 		{
-			delete_value();
-			type = b ? JSON_TRUE : JSON_FALSE;
+			json::element& e = back_array();
+			new (&e) json::value();
+			++data.array.size;
 
-			return *this;
+			return static_cast<json::value&>(e);
 		}
-		bool operator==(bool b) const
+		// room for at least n elements without moving them
+		void reserve(size_t n)
 		{
-			return operator const json::element&() == b;
+			own_array();
+			if (n > capacity())
+				data.array.element = reallocate_array(data.array.element, n);
 		}
-		bool operator<(bool b) const
+		// elements the array has room for
+		size_t capacity(void) const
 		{
-			return operator const json::element&() < b;
-		}
-#ifndef JSON_ONLY
-		// int32
-		// int64
+			if (type != JSON_ARRAY)
+				return 0;
+			if (flags & (JSON_FLAG_VIEW | JSON_FLAG_SHARED | JSON_FLAG_TYPED))
+				return data.array.size;
 
-		// time_t
-		explicit value(time_t t)
-		{
-			type = JSON_DATE;
-			data.date = t;
+			return array_header(data.array.element)->capacity;
 		}
-		value& operator=(time_t t)
-		{
-			delete_value();
-			type = JSON_DATE;
-			data.date = t;
 
-			return *this;
+		// typed array holding a copy of p[0, n)
+		value(const double* p, size_t n)
+		{
+			construct_typed(JSON_NUMBER, n, p);
 		}
-		bool operator==(time_t date) const
+#ifndef JSON_ONLY
+		value(const int32_t* p, size_t n)
 		{
-			return operator const json::element&() == date;
+			construct_typed(JSON_INT32, n, p);
 		}
-		bool operator<(time_t date) const
+		value(const int64_t* p, size_t n)
 		{
-			return operator const json::element&() < date;
+			construct_typed(JSON_INT64, n, p);
 		}
 #endif
-	protected:
-		void construct_string(const char* s, size_t size = 0)
+		// Store arrays whose elements are all JSON_NUMBER, all JSON_INT32 or all
+		// JSON_INT64 as native arrays read through span(). Arrays and objects under
+		// this value are packed too, views are left alone. True if this value is
+		// now a typed array. Modifying elements with operator[] unpacks again.
+		bool pack(void)
 		{
-			type = JSON_STRING;
-			data.string.size = size ? size : strlen(s);
-			data.string.data = new char[data.string.size + 1];
-			strcpy(const_cast<char*>(data.string.data), s);
+			if (flags & (JSON_FLAG_VIEW | JSON_FLAG_TYPED))
+				return (flags & JSON_FLAG_TYPED) != 0;
+
+			if (type == JSON_OBJECT) {
+				unshare();
+				for (json::object::iterator i = data.object->begin(); i != data.object->end(); ++i)
+					i->second.pack();
+
+				return false;
+			}
+			if (type != JSON_ARRAY || data.array.size == 0)
+				return false;
+
+			size_t n = data.array.size;
+			json_element_type t = data.array.element[0].type;
+			bool same = typed_width(t) != 0;
+			for (size_t i = 1; same && i < n; ++i)
+				same = data.array.element[i].type == t;
+
+			if (!same) {
+				for (size_t i = 0; i < n; ++i)
+					operator[](i).pack();
+
+				return false;
+			}
+
+			value v;
+			v.construct_typed(t, n, 0);
+			for (size_t i = 0; i < n; ++i) {
+				const json::element& e = data.array.element[i];
+				switch (t) {
+				case JSON_NUMBER:
+					v.data.array.number[i] = e.data.number;
+					break;
+#ifndef JSON_ONLY
+				case JSON_INT32:
+					v.data.array.int32[i] = e.data.int32;
+					break;
+				case JSON_INT64:
+					v.data.array.int64[i] = e.data.int64;
+					break;
+#endif
+				default:
+					break;
+				}
+			}
+			swap(v);
+
+			return true;
 		}
-		void delete_string(void)
+		// store a typed array as elements again
+		void unpack(void)
 		{
-			delete [] data.string.data;
-			type = JSON_UNDEFINED;
-		}
+			if (!(flags & JSON_FLAG_TYPED))
+				return;
 
-		void construct_array(size_t n)
-		{
-			type = JSON_ARRAY;
-			data.array.size = n;
-			data.array.element = static_cast<json::element*>(malloc(n*sizeof(json::element)));
-			for (size_t i = 0; i < n; ++i)
-				data.array.element[i].type = JSON_UNDEFINED;
+			value v;
+			v.construct_array(data.array.size);
+			for (size_t i = 0; i < data.array.size; ++i)
+				v.data.array.element[i] = at(i);
+			swap(v);
 		}
-		void delete_array(void)
+		// numbers of a typed array of T that can be modified in place, empty for anything else
+		template<class T>
+		json::span<T> span(void)
 		{
-			for (size_t i = 0; i < data.array.size; ++i)
-				operator[](i).delete_value();
-			
-			free(data.array.element);
+			if (typed() != typed_enum<T>::type)
+				return span_<T>(0, 0);
+			unshare();
 
-			type = JSON_UNDEFINED;
+			return span_(data.array.size, reinterpret_cast<T*>(data.array.element));
 		}
-		void push_back_array(const json::element& element)
+		using element::span;
+
+		// Move this value and everything under it into reference counted storage.
+		// Copies then share the storage in O(1) and are safe to read from any thread.
+		// Members that modify a shared value, object() and operator[] among them,
+		// make a private copy of its top level first. data is for reading.
+		void share(void)
 		{
-			if (type == JSON_UNDEFINED) {
-				construct_array(1);
-				operator[](0) = element;
+			if (flags & (JSON_FLAG_VIEW | JSON_FLAG_INLINE | JSON_FLAG_SHARED))
+				return;
+
+			switch (type) {
+			case JSON_STRING: {
+				char* d = static_cast<char*>(shared::allocate(data.string.size + 1));
+				memcpy(d, data.string.data, data.string.size + 1);
+				delete [] data.string.data;
+				data.string.data = d;
+				break;
 			}
-			else {
-				if (type != JSON_ARRAY) {
-					value this_(*this);
-					delete_value();
-					construct_array(2);
-					operator[](0) = this_;
-					operator[](1) = element;
+			case JSON_OBJECT: {
+				for (json::object::iterator i = data.object->begin(); i != data.object->end(); ++i)
+					i->second.share();
+				json::object* o = new (shared::allocate(sizeof(json::object))) json::object(std::move(*data.object));
+				delete data.object;
+				data.object = o;
+				break;
+			}
+			case JSON_ARRAY: {
+				size_t n = data.array.size;
+				size_t w = flags & JSON_FLAG_TYPED ? typed_width(typed()) : sizeof(json::element);
+				for (size_t i = 0; i < n && !(flags & JSON_FLAG_TYPED); ++i)
+					static_cast<json::value&>(data.array.element[i]).share();
+				json::element* e = static_cast<json::element*>(shared::allocate(n*w));
+				if (n)
+					memcpy(e, data.array.element, n*w);
+				if (flags & JSON_FLAG_TYPED)
+					free(data.array.element);
+				else
+					free_array(data.array.element);
+				data.array.element = e;
+				break;
+			}
+#ifndef JSON_ONLY
+			case JSON_BYTE: {
+				uint8_t* d = static_cast<uint8_t*>(shared::allocate(data.byte.size));
+				memcpy(d, data.byte.data, data.byte.size);
+				delete [] data.byte.data;
+				data.byte.data = d;
+				break;
+			}
+#endif
+			default: // nothing to share
+				return;
+			}
+
+			flags |= JSON_FLAG_SHARED;
+		}
+		// Give this value its own copy of the top level so it can be modified.
+		// Shared members stay shared until they are modified themselves.
+		void unshare(void)
+		{
+			if (!(flags & JSON_FLAG_SHARED))
+				return;
+
+			value v;
+			bool last = shared::count(storage()) == 1; // nobody else can be reading
+
+			switch (type) {
+			case JSON_STRING:
+				v.construct_string(data.string.data, data.string.size);
+				break;
+			case JSON_OBJECT:
+				if (last) {
+					v.type = JSON_OBJECT;
+					v.flags = 0;
+					v.data.object = new json::object(std::move(*data.object));
+					data.object->~object();
+					shared::free(data.object);
+					type = JSON_UNDEFINED;
 				}
 				else {
-					data.array.element = static_cast<json::element*>(realloc(data.array.element, (data.array.size + 1)*sizeof(json::element)));
-					operator[](data.array.size) = element;
-					++data.array.size;
+					v.construct_object(*data.object);
 				}
+				break;
+			case JSON_ARRAY:
+				if (flags & JSON_FLAG_TYPED) {
+					v.construct_typed(typed(), data.array.size, data.array.element);
+					break;
+				}
+				v.construct_array(data.array.size);
+				if (last) {
+					if (data.array.size)
+						memcpy(v.data.array.element, data.array.element, data.array.size*sizeof(json::element));
+					shared::free(data.array.element);
+					type = JSON_UNDEFINED;
+				}
+				else {
+					for (size_t i = 0; i < data.array.size; ++i)
+						new (&v.data.array.element[i]) value(static_cast<const json::element&>(data.array.element[i]));
+				}
+				break;
+#ifndef JSON_ONLY
+			case JSON_BYTE:
+				v.construct_byte(data.byte.size, data.byte.data);
+				break;
+#endif
+			default:
+				break;
 			}
+
+			swap(v); // v releases the shared storage
 		}
-		void push_back_array(const array& array)
+		// number of values sharing the storage, 0 if not shared
+		size_t use_count(void) const
 		{
-			if (type == JSON_UNDEFINED) {
-				operator=(array);
+			return flags & JSON_FLAG_SHARED ? shared::count(storage()) : 0;
+		}
+#ifndef JSON_ONLY
+		// byte
+		value(size_t size, uint8_t* data)
+		{
+			construct_byte(size, data);
+		}
+		value& operator=(const byte& b)
+		{
+			value v;
+			v.construct_byte(b.size, b.data);
+			swap(v);
+
+			return *this;
+		}
+#endif
+		explicit value(bool b)
+		{
+			type = b ? JSON_TRUE : JSON_FALSE;
+			flags = 0;
+		}
+		value& operator=(bool b)
+		{
+			delete_value();
+			type = b ? JSON_TRUE : JSON_FALSE;
+
+			return *this;
+		}
+		bool operator==(bool b) const
+		{
+			return operator const json::element&() == b;
+		}
+		bool operator<(bool b) const
+		{
+			return operator const json::element&() < b;
+		}
+#ifndef JSON_ONLY
+		// int32
+		// int64
+
+		// time_t
+		explicit value(time_t t)
+		{
+			type = JSON_DATE;
+			flags = 0;
+			data.date = t;
+		}
+		value& operator=(time_t t)
+		{
+			delete_value();
+			type = JSON_DATE;
+			data.date = t;
+
+			return *this;
+		}
+		bool operator==(time_t date) const
+		{
+			return operator const json::element&() == date;
+		}
+		bool operator<(time_t date) const
+		{
+			return operator const json::element&() < date;
+		}
+#endif
+	protected:
+		// start of the storage of a pointer type
+		const void* storage(void) const
+		{
+			switch (type) {
+			case JSON_STRING: return data.string.data;
+			case JSON_OBJECT: return data.object;
+			case JSON_ARRAY: return data.array.element;
+#ifndef JSON_ONLY
+			case JSON_BYTE: return data.byte.data;
+#endif
+			default: return 0;
 			}
-			else {
-				if (type != JSON_ARRAY) {
-					value this_(*this);
-					delete_value();
-					construct_array(1);
-					operator[](0) = this_;
+		}
+
+		// *this is uninitialized
+		void construct_value(const json::element& e)
+		{
+			if (e.flags & JSON_FLAG_SHARED) {
+				static_cast<json::element&>(*this) = e;
+				shared::acquire(storage());
+
+				return;
+			}
+
+			switch (e.type) {
+			case JSON_STRING: {
+				json::string s = e.str();
+				construct_string(s.data, s.size);
+				break;
+			}
+			case JSON_OBJECT:
+				construct_object(*e.data.object);
+				break;
+			case JSON_ARRAY:
+				if (e.flags & JSON_FLAG_TYPED) {
+					construct_typed(e.typed(), e.data.array.size, e.data.array.element);
+					break;
+				}
+				construct_array(e.data.array.size);
+				for (size_t i = 0; i < e.data.array.size; ++i)
+					operator[](i) = e.data.array.element[i];
+				break;
+#ifndef JSON_ONLY
+			case JSON_BYTE:
+				construct_byte(e.data.byte.size, e.data.byte.data);
+				break;
+#endif
+			default: // non pointer types
+				type = e.type;
+				flags = 0;
+				data = e.data;
+			}
+		}
+
+		void construct_string(const char* s, size_t size)
+		{
+			if (size <= inline_capacity) {
+				char* d = reinterpret_cast<char*>(&data);
+				if (size)
+					memcpy(d, s, size);
+				d[size] = 0;
+
+				type = JSON_STRING;
+				flags = JSON_FLAG_INLINE | static_cast<unsigned int>(size << JSON_INLINE_SHIFT);
+
+				return;
+			}
+
+			char* d = new char[size + 1];
+			memcpy(d, s, size);
+			d[size] = 0;
+
+			type = JSON_STRING;
+			flags = 0;
+			data.string = string_(size, d);
+		}
+		void delete_string(void)
+		{
+			if (flags & JSON_FLAG_SHARED) {
+				if (shared::release(data.string.data))
+					shared::free(data.string.data);
+			}
+			else if (!(flags & (JSON_FLAG_VIEW | JSON_FLAG_INLINE))) {
+				delete [] data.string.data;
+			}
+			type = JSON_UNDEFINED;
+		}
+
+		void construct_object(const json::object& o)
+		{
+			type = JSON_OBJECT;
+			flags = 0;
+			data.object = new json::object(o);
+		}
+		void delete_object(void)
+		{
+			if (flags & JSON_FLAG_SHARED) {
+				if (shared::release(data.object)) {
+					data.object->~object();
+					shared::free(data.object);
+				}
+			}
+			else if (!(flags & JSON_FLAG_VIEW)) {
+				delete data.object;
+			}
+			type = JSON_UNDEFINED;
+		}
+
+		// Element arrays on the heap keep their capacity in a header in front of
+		// the elements. Typed, shared and view arrays have no header.
+		struct array_header_ {
+			size_t capacity;
+		};
+		static array_header_* array_header(json::element* e)
+		{
+			return reinterpret_cast<array_header_*>(e) - 1;
+		}
+		static json::element* reallocate_array(json::element* e, size_t capacity)
+		{
+			static_assert(sizeof(array_header_) % alignof(json::element) == 0, "elements follow the header");
+			array_header_* h = static_cast<array_header_*>(realloc(e ? array_header(e) : 0, sizeof(array_header_) + capacity*sizeof(json::element)));
+			ensure (h);
+			h->capacity = capacity;
+
+			return reinterpret_cast<json::element*>(h + 1);
+		}
+		static void free_array(json::element* e)
+		{
+			free(array_header(e));
+		}
+		// a heap element array this value can grow
+		void own_array(void)
+		{
+			to_array();
+			unpack();
+			unshare();
+			if (flags & JSON_FLAG_VIEW) { // take ownership
+				value v(*this);
+				swap(v);
+			}
+		}
+		// room for k more elements, doubling so appending is amortized O(1)
+		void grow(size_t k)
+		{
+			own_array();
+			size_t n = data.array.size + k;
+			size_t c = capacity();
+			if (n > c)
+				reserve(n > 2*c ? n : 2*c);
+		}
+
+		void construct_array(size_t n)
+		{
+			type = JSON_ARRAY;
+			flags = 0;
+			data.array.size = n;
+			data.array.element = reallocate_array(0, n);
+			for (size_t i = 0; i < n; ++i) {
+				data.array.element[i].type = JSON_UNDEFINED;
+				data.array.element[i].flags = 0;
+			}
+		}
+		void delete_array(void)
+		{
+			size_t n = flags & JSON_FLAG_TYPED ? 0 : data.array.size; // numbers need no cleanup
+
+			if (flags & JSON_FLAG_SHARED) {
+				if (shared::release(data.array.element)) {
+					for (size_t i = 0; i < n; ++i)
+						static_cast<json::value&>(data.array.element[i]).delete_value();
+					shared::free(data.array.element);
 				}
-				data.array.element = static_cast<json::element*>(realloc(data.array.element, (data.array.size + array.size)*sizeof(json::element)));
-				for (size_t i = 0; i < array.size; ++i)
-					operator[](data.array.size + i) = array.element[i];
-				data.array.size += array.size;
+			}
+			else if (!(flags & JSON_FLAG_VIEW)) {
+				for (size_t i = 0; i < n; ++i)
+					static_cast<json::value&>(data.array.element[i]).delete_value();
+			
+				if (flags & JSON_FLAG_TYPED)
+					free(data.array.element);
+				else
+					free_array(data.array.element);
+			}
+
+			type = JSON_UNDEFINED;
+		}
+		// n numbers of type t copied from p if it is not 0
+		void construct_typed(json_element_type t, size_t n, const void* p)
+		{
+			size_t w = typed_width(t);
+			ensure (w);
+
+			type = JSON_ARRAY;
+			flags = JSON_FLAG_TYPED | static_cast<unsigned int>(t << JSON_INLINE_SHIFT);
+			data.array.size = n;
+			data.array.element = static_cast<json::element*>(malloc(n ? n*w : 1));
+			ensure (data.array.element);
+			if (p && n)
+				memcpy(data.array.element, p, n*w);
+		}
+		// scalars become the first element of an array
+		void to_array(void)
+		{
+			if (type == JSON_UNDEFINED) {
+				construct_array(0);
+			}
+			else if (type != JSON_ARRAY) {
+				value this_(std::move(*this));
+				construct_array(1);
+				new (&data.array.element[0]) json::value(std::move(this_));
 			}
 		}
+		// uninitialized storage for the next element
+		json::element& back_array(void)
+		{
+			grow(1);
+
+			return data.array.element[data.array.size];
+		}
+		void push_back_array(const json::element& element)
+		{
+			emplace_back(element);
+		}
+		void push_back_array(const array& array)
+		{
+			value v;
+			v = array; // array might live in this array
+
+			grow(array.size);
+			memcpy(data.array.element + data.array.size, v.data.array.element, array.size*sizeof(json::element));
+			data.array.size += array.size;
+			v.data.array.size = 0; // elements were moved
+		}
 #ifndef JSON_ONLY
 		void construct_byte(size_t n, const uint8_t* b)
 		{
 			type = JSON_BYTE;
+			flags = 0;
 			data.byte.size = n;
 			data.byte.data = new uint8_t[n];
 			memcpy(const_cast<uint8_t*>(data.byte.data), b, n);
 		}
 		void delete_byte(void)
 		{
-			delete [] data.byte.data;
+			if (flags & JSON_FLAG_SHARED) {
+				if (shared::release(data.byte.data))
+					shared::free(data.byte.data);
+			}
+			else if (!(flags & JSON_FLAG_VIEW)) {
+				delete [] data.byte.data;
+			}
 			type = JSON_UNDEFINED;
 		}
 #endif
@@ -560,6 +1355,9 @@ namespace json {
 			case JSON_STRING:
 				delete_string();
 				break;
+			case JSON_OBJECT:
+				delete_object();
+				break;
 			case JSON_ARRAY:
 				delete_array();
 				break;
@@ -571,10 +1369,168 @@ namespace json {
 			default:
 				type = JSON_UNDEFINED;
 			}
+			flags = 0;
 		}
 	};
 
+	inline bool equal_object(const object* a, const object* b)
+	{
+		return a == b || *a == *b;
+	}
+	inline bool less_object(const object* a, const object* b)
+	{
+		return a != b && *a < *b;
+	}
+
+	// strtod in the "C" locale, so the decimal point is '.' whatever
+	// setlocale has set for the program.
+#ifdef _WIN32
+	inline _locale_t c_locale(void)
+	{
+		static _locale_t c = _create_locale(LC_NUMERIC, "C");
+
+		return c;
+	}
+	inline double strtod_c(const char* s, char** end)
+	{
+		return _strtod_l(s, end, c_locale());
+	}
+#else
+	inline locale_t c_locale(void)
+	{
+		static locale_t c = newlocale(LC_NUMERIC_MASK, "C", static_cast<locale_t>(0));
+
+		return c;
+	}
+	inline double strtod_c(const char* s, char** end)
+	{
+		return strtod_l(s, end, c_locale());
+	}
+#endif
+
 	namespace parse {
+		// exact powers of 10 as doubles
+		inline double pow10(int i)
+		{
+			static const double p[] = {
+				1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+				1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+			};
+
+			return p[i];
+		}
+
+		// -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?
+		// Integers that fit are JSON_INT32 or JSON_INT64, everything else is JSON_NUMBER.
+		// Decimals with at most 15 significant digits and a small exponent are
+		// converted exactly in double arithmetic, others fall back to strtod.
+		inline bool scan_number(const char*& b, const char* e, json::element& n)
+		{
+			const char* b_ = b;
+			bool neg = false;
+			uint64_t m = 0;   // first 19 significant digits
+			int digits = 0;   // significant digits in m
+			int exp10 = 0;    // power of 10 to multiply m by
+			bool exact = true; // m holds every significant digit
+			bool integer = true;
+
+			if (b != e && *b == '-') {
+				neg = true;
+				++b;
+			}
+
+			if (b == e || *b < '0' || *b > '9')
+				return false;
+			if (*b == '0') {
+				++b;
+			}
+			else {
+				for (; b != e && *b >= '0' && *b <= '9'; ++b) {
+					if (digits < 19) {
+						m = 10*m + (*b - '0');
+						++digits;
+					}
+					else {
+						++exp10;
+						exact = exact && *b == '0';
+					}
+				}
+			}
+
+			if (b != e && *b == '.') {
+				integer = false;
+				if (++b == e || *b < '0' || *b > '9')
+					return false;
+				for (; b != e && *b >= '0' && *b <= '9'; ++b) {
+					if (m == 0 && *b == '0') {
+						--exp10; // leading zeros are not significant
+					}
+					else if (digits < 19) {
+						m = 10*m + (*b - '0');
+						++digits;
+						--exp10;
+					}
+					else {
+						exact = exact && *b == '0';
+					}
+				}
+			}
+
+			if (b != e && (*b == 'e' || *b == 'E')) {
+				integer = false;
+				bool eneg = false;
+				int x = 0;
+
+				if (++b != e && (*b == '+' || *b == '-'))
+					eneg = *b++ == '-';
+				if (b == e || *b < '0' || *b > '9')
+					return false;
+				for (; b != e && *b >= '0' && *b <= '9'; ++b)
+					if (x < 100000)
+						x = 10*x + (*b - '0');
+				exp10 += eneg ? -x : x;
+			}
+
+#ifndef JSON_ONLY
+			if (integer && exact && exp10 == 0 && !(neg && m == 0)) {
+				if (neg ? m <= uint64_t(1) << 63 : m < uint64_t(1) << 63) {
+					int64_t i = neg ? static_cast<int64_t>(0 - m) : static_cast<int64_t>(m);
+
+					if (i >= INT32_MIN && i <= INT32_MAX) {
+						n.type = JSON_INT32;
+						n.data.int32 = static_cast<int32_t>(i);
+					}
+					else {
+						n.type = JSON_INT64;
+						n.data.int64 = i;
+					}
+					n.flags = 0;
+
+					return true;
+				}
+			}
+#endif
+
+			n.type = JSON_NUMBER;
+			n.flags = 0;
+
+			if (m == 0) {
+				n.data.number = neg ? -0.0 : 0.0;
+			}
+			else if (exact && m <= uint64_t(1) << 53 && exp10 >= -22 && exp10 <= 22) {
+				// both m and 10^|exp10| are exact so there is one rounding
+				double x = static_cast<double>(m);
+				x = exp10 < 0 ? x/pow10(-exp10) : x*pow10(exp10);
+				n.data.number = neg ? -x : x;
+			}
+			else {
+				std::string s(b_, b); // strtod needs a terminator
+				n.data.number = strtod_c(s.c_str(), 0);
+			}
+
+			return true;
+		}
+
 		inline bool eat(char c, std::istream& is)
 		{
 			char c_;
@@ -599,7 +1555,7 @@ namespace json {
 			json::value v;
 
 			while (json::value a = read_value(is)) {
-				v.push_back(a);
+				v.push_back(std::move(a));
 			}
 
 			return v;
@@ -635,29 +1591,29 @@ namespace json {
 			else if (c == '\"' || c == '\'')
 				v = read_string(is).c_str();
 			else if (c == 'f') {
-				ensure (eat('a', is));
-				ensure (eat('l', is));
-				ensure (eat('s', is));
-				ensure (eat('e', is));
+				// ensure may not evaluate its argument
+				bool ok = eat('a', is) && eat('l', is) && eat('s', is) && eat('e', is);
+				ensure (ok); (void)ok;
 				v = false;
 			}
 			else if (c == 't') {
-				ensure (eat('r', is));
-				ensure (eat('u', is));
-				ensure (eat('e', is));
+				bool ok = eat('r', is) && eat('u', is) && eat('e', is);
+				ensure (ok); (void)ok;
 				v = true;
 			}
 			else if (c == 'n') {
-				ensure (eat('u', is));
-				ensure (eat('l', is));
-				ensure (eat('l', is));
+				bool ok = eat('u', is) && eat('l', is) && eat('l', is);
+				ensure (ok); (void)ok;
 				v.type = JSON_NULL;
 			}
 			else {
-				is.putback(c);
-				is >> v.data.number;
-				ensure (!is.fail());
-				v.type = JSON_NUMBER;
+				std::string s(1, c);
+				for (int d = is.peek(); (d >= '0' && d <= '9') || d == '-' || d == '+' || d == '.' || d == 'e' || d == 'E'; d = is.peek())
+					s += static_cast<char>(is.get());
+
+				const char* b = s.data();
+				bool ok = scan_number(b, s.data() + s.size(), v) && b == s.data() + s.size();
+				ensure (ok); (void)ok;
 			}
 
 			return v;
@@ -666,7 +1622,8 @@ namespace json {
 		{
 			std::string key = read_string(is);
 
-			ensure (parse::eat(':', is));
+			bool ok = parse::eat(':', is);
+			ensure (ok); (void)ok;
 
 			return key;
 		}
@@ -679,7 +1636,11 @@ namespace json {
 				return false;
 			}
 
-			ensure (c == '\"' || c == '\'');
+			if (c == ',') {
+				is >> std::skipws >> c;
+			}
+
+			ensure (c == '\"' || c == '\'');
 			kv.first = read_key(is);
 			kv.second = read_value(is);
 
@@ -699,66 +1660,1132 @@ namespace json {
 
 		inline object read_object(std::istream& is)
 		{
-			ensure (parse::eat('{', is));
+			bool ok = parse::eat('{', is);
+			ensure (ok); (void)ok;
 			object o = parse::read_members(is);
 
 			return o;
 		}
 
+		//
+		// parse a buffer [b, e) in place, advancing b past what was read
+		// Strings without escapes refer to the buffer, so it must outlive the result.
+		// If an arena is given all other storage comes from it and the result
+		// should be treated as read only.
+		//
+
+		inline const char* skip(const char* b, const char* e)
+		{
+			while (b != e && (*b == ' ' || *b == '\t' || *b == '\n' || *b == '\r'))
+				++b;
+
+			return b;
+		}
+
+		inline int hex(char c)
+		{
+			return c >= '0' && c <= '9' ? c - '0'
+				: c >= 'a' && c <= 'f' ? c - 'a' + 10
+				: c >= 'A' && c <= 'F' ? c - 'A' + 10
+				: -1;
+		}
+		// read 4 hex digits following "\u"
+		inline bool read_hex(const char*& b, const char* e, unsigned& u)
+		{
+			if (e - b < 4)
+				return false;
+
+			u = 0;
+			for (int i = 0; i < 4; ++i) {
+				int h = hex(*b++);
+				if (h < 0)
+					return false;
+				u = (u << 4) | h;
+			}
+
+			return true;
+		}
+		// decode base64 with padding, the reverse of serialize_base64
+		inline bool read_base64(const char* s, size_t n, std::string& out)
+		{
+			out.clear();
+			if (n%4)
+				return false;
+
+			for (size_t i = 0; i < n; i += 4) {
+				uint32_t u = 0;
+				int pad = 0;
+				for (int j = 0; j < 4; ++j) {
+					char c = s[i + j];
+					int d = c >= 'A' && c <= 'Z' ? c - 'A'
+						: c >= 'a' && c <= 'z' ? c - 'a' + 26
+						: c >= '0' && c <= '9' ? c - '0' + 52
+						: c == '+' ? 62
+						: c == '/' ? 63
+						: -1;
+					if (c == '=' && i + 4 == n && j >= 2 && (j == 3 || s[i + 3] == '='))
+						d = 0, ++pad;
+					else if (d < 0 || pad)
+						return false;
+					u = (u << 6) | d;
+				}
+				out += static_cast<char>(u >> 16);
+				if (pad < 2)
+					out += static_cast<char>((u >> 8) & 0xFF);
+				if (pad < 1)
+					out += static_cast<char>(u & 0xFF);
+			}
+
+			return true;
+		}
+		inline void append_utf8(unsigned u, std::string& s)
+		{
+			if (u < 0x80) {
+				s += static_cast<char>(u);
+			}
+			else if (u < 0x800) {
+				s += static_cast<char>(0xC0 | (u >> 6));
+				s += static_cast<char>(0x80 | (u & 0x3F));
+			}
+			else if (u < 0x10000) {
+				s += static_cast<char>(0xE0 | (u >> 12));
+				s += static_cast<char>(0x80 | ((u >> 6) & 0x3F));
+				s += static_cast<char>(0x80 | (u & 0x3F));
+			}
+			else {
+				s += static_cast<char>(0xF0 | (u >> 18));
+				s += static_cast<char>(0x80 | ((u >> 12) & 0x3F));
+				s += static_cast<char>(0x80 | ((u >> 6) & 0x3F));
+				s += static_cast<char>(0x80 | (u & 0x3F));
+			}
+		}
+		// b is at a backslash, append the unescaped character to s
+		inline bool read_escape(const char*& b, const char* e, std::string& s)
+		{
+			if (++b == e)
+				return false;
+
+			switch (*b++) {
+			case '"':  s += '"'; break;
+			case '\\': s += '\\'; break;
+			case '/':  s += '/'; break;
+			case 'b':  s += '\b'; break;
+			case 'f':  s += '\f'; break;
+			case 'n':  s += '\n'; break;
+			case 'r':  s += '\r'; break;
+			case 't':  s += '\t'; break;
+			case 'u': {
+				unsigned u, l;
+				if (!read_hex(b, e, u))
+					return false;
+				if (u >= 0xD800 && u < 0xDC00) { // surrogate pair
+					if (e - b < 2 || b[0] != '\\' || b[1] != 'u')
+						return false;
+					b += 2;
+					if (!read_hex(b, e, l) || l < 0xDC00 || l >= 0xE000)
+						return false;
+					u = 0x10000 + ((u - 0xD800) << 10) + (l - 0xDC00);
+				}
+				append_utf8(u, s);
+				break;
+			}
+			default:
+				return false;
+			}
+
+			return true;
+		}
+		// b is just past the opening quote
+		// s refers to the buffer, or to buf if the string has escapes
+		inline bool read_chars(const char*& b, const char* e, json::string& s, std::string& buf)
+		{
+			const char* b_ = b;
+
+			while (b != e && *b != '"' && *b != '\\')
+				++b;
+			if (b == e)
+				return false;
+
+			if (*b == '"') {
+				s = string_(b - b_, b_);
+				++b;
+
+				return true;
+			}
+
+			buf.assign(b_, b);
+			while (b != e && *b != '"') {
+				if (*b == '\\') {
+					if (!read_escape(b, e, buf))
+						return false;
+				}
+				else {
+					buf += *b++;
+				}
+			}
+			if (b == e)
+				return false;
+			++b;
+			s = string_(buf.size(), buf.data());
+
+			return true;
+		}
+		inline bool read_string(const char*& b, const char* e, json::value& v, json::arena* a = 0)
+		{
+			std::string buf;
+			json::string s;
+
+			if (!read_chars(b, e, s, buf))
+				return false;
+
+			if (buf.empty())
+				v.view(s);
+			else if (s.size <= inline_capacity)
+				v = s;
+			else if (a)
+				v.view(string_(s.size, a->copy(s.data, s.size)));
+			else
+				v = s;
+
+			return true;
+		}
+		inline bool read_double(const char*& b, const char* e, double& x)
+		{
+			json::element n;
+
+			if (!scan_number(b, e, n))
+				return false;
+
+			x = n.type == JSON_NUMBER ? n.data.number
+#ifndef JSON_ONLY
+				: n.type == JSON_INT32 ? n.data.int32
+				: static_cast<double>(n.data.int64);
+#else
+				: 0;
+#endif
+
+			return true;
+		}
+		inline bool read_number(const char*& b, const char* e, json::value& v)
+		{
+			json::element n;
+
+			if (!scan_number(b, e, n))
+				return false;
+			v = n;
+
+			return true;
+		}
+		inline bool read_literal(const char*& b, const char* e, const char* lit, size_t n)
+		{
+			if (static_cast<size_t>(e - b) < n || 0 != memcmp(b, lit, n))
+				return false;
+			b += n;
+
+			return true;
+		}
+
+		inline bool read_value(const char*& b, const char* e, json::value& v, json::arena* a = 0);
+
+		// append an element to an array in an arena, doubling its capacity when full
+		inline json::value& push_back(json::arena& a, json::array& x, size_t& capacity)
+		{
+			if (x.size == capacity) {
+				capacity = capacity ? 2*capacity : 4;
+				json::element* p = a.allocate<json::element>(capacity);
+				if (x.size)
+					memcpy(p, x.element, x.size*sizeof(json::element));
+				x.element = p;
+			}
+
+			json::element& e = x.element[x.size++];
+			e.type = JSON_UNDEFINED;
+			e.flags = 0;
+
+			return static_cast<json::value&>(e);
+		}
+
+		// b is just past the opening bracket
+		inline bool read_array(const char*& b, const char* e, json::value& v, json::arena* a = 0)
+		{
+			json::array x = array_(0, 0); // arena storage
+			size_t capacity = 0;
+
+			if (a) {
+				v.view(x);
+			}
+			else {
+				json::value h(0);
+				v.swap(h);
+			}
+
+			b = skip(b, e);
+			if (b != e && *b == ']') {
+				++b;
+
+				return true;
+			}
+
+			for (;;) {
+				// parse in place so views are not copied
+				json::value* w;
+				if (a) {
+					w = &push_back(*a, x, capacity);
+				}
+				else {
+					w = &v.emplace_back();
+				}
+				if (!read_value(b, e, *w, a))
+					return false;
+
+				b = skip(b, e);
+				if (b == e)
+					return false;
+				if (*b == ']') {
+					++b;
+					if (a)
+						v.view(x);
+
+					return true;
+				}
+				if (*b++ != ',')
+					return false;
+			}
+		}
+		// b is just past the opening brace
+		// O is json::object, json::flat_object or json::interned_object. Only the
+		// top level is O, objects in members are json::object as that is the one
+		// object type a json::value holds.
+		template<class O>
+		inline bool read_members(const char*& b, const char* e, O& o, json::arena* a = 0)
+		{
+			std::string buf;
+			json::string key;
+
+			b = skip(b, e);
+			if (b != e && *b == '}') {
+				++b;
+
+				return true;
+			}
+
+			for (;;) {
+				b = skip(b, e);
+				if (b == e || *b++ != '"' || !read_chars(b, e, key, buf))
+					return false;
+				b = skip(b, e);
+				if (b == e || *b++ != ':')
+					return false;
+
+				// first key wins, just like object::insert
+				std::pair<typename O::iterator,bool> i = o.insert(typename O::value_type(typename O::key_type(key.data, key.size), json::value()));
+				json::value dup;
+				if (!read_value(b, e, i.second ? i.first->second : dup, a))
+					return false;
+
+				b = skip(b, e);
+				if (b == e)
+					return false;
+				if (*b == '}') {
+					++b;
+
+					return true;
+				}
+				if (*b++ != ',')
+					return false;
+			}
+		}
+		template<class O>
+		inline bool read_object(const char*& b, const char* e, O& o, json::arena* a = 0)
+		{
+			b = skip(b, e);
+			if (b == e || *b++ != '{')
+				return false;
+
+			return read_members(b, e, o, a);
+		}
+		// empty object, in the arena if there is one
+		inline json::object& make_object(json::value& v, json::arena* a = 0)
+		{
+			if (a) {
+				v.view(a->create<json::object>(std::less<std::string>(), json::object::allocator_type(a)));
+			}
+			else {
+				json::value o((json::object()));
+				v.swap(o);
+			}
+
+			return *v.data.object;
+		}
+		inline bool read_value(const char*& b, const char* e, json::value& v, json::arena* a)
+		{
+			b = skip(b, e);
+			if (b == e)
+				return false;
+
+			switch (*b) {
+			case '"':
+				return read_string(++b, e, v, a);
+			case '[':
+				return read_array(++b, e, v, a);
+			case '{':
+				return read_members(++b, e, make_object(v, a), a);
+			case 't':
+				if (!read_literal(b, e, "true", 4))
+					return false;
+				v = true;
+				break;
+			case 'f':
+				if (!read_literal(b, e, "false", 5))
+					return false;
+				v = false;
+				break;
+			case 'n':
+				if (!read_literal(b, e, "null", 4))
+					return false;
+				{
+					json::value n;
+					v.swap(n);
+					v.type = JSON_NULL;
+				}
+				break;
+			default:
+				return read_number(b, e, v);
+			}
+
+			return true;
+		}
+
 	} // namespace parse
 
-} // namespace bson
+	// value parsed from a buffer with all its storage in an arena
+	// Strings without escapes still refer to the buffer.
+	class document {
+		json::arena arena_;
+		json::value root_;
+
+		document(const document&);
+		document& operator=(const document&);
+	public:
+		explicit document(size_t block_size = 4096)
+			: arena_(block_size)
+		{ }
+
+		// reuses the arena memory of the previous document
+		bool parse(const char* b, size_t n)
+		{
+			json::value v;
+			root_.swap(v);
+			arena_.reset();
+
+			const char* e = b + n;
+
+			return parse::read_value(b, e, root_, &arena_) && parse::skip(b, e) == e;
+		}
+
+		const json::value& root(void) const
+		{
+			return root_;
+		}
+		json::arena& arena(void)
+		{
+			return arena_;
+		}
+	};
+
+
+	//
+	// serialization
+	//
+
+	// growable output buffer that can start out in caller supplied storage
+	class buffer {
+		char* data_;
+		size_t size_;
+		size_t capacity_;
+		bool own_; // data_ is on the heap
+
+		buffer(const buffer&);
+		buffer& operator=(const buffer&);
+	public:
+		explicit buffer(size_t capacity = 256)
+			: data_(static_cast<char*>(capacity ? malloc(capacity) : 0)), size_(0), capacity_(capacity), own_(true)
+		{
+			ensure (data_ || !capacity);
+		}
+		// moves to the heap if p[0, n) fills up
+		buffer(char* p, size_t n)
+			: data_(p), size_(0), capacity_(n), own_(false)
+		{ }
+		~buffer()
+		{
+			if (own_)
+				free(data_);
+		}
+
+		const char* data(void) const
+		{
+			return data_;
+		}
+		// for patching bytes already written
+		char* data(void)
+		{
+			return data_;
+		}
+		size_t size(void) const
+		{
+			return size_;
+		}
+		void clear(void)
+		{
+			size_ = 0;
+		}
+		std::string str(void) const
+		{
+			return std::string(data_, size_);
+		}
+
+		// room for n more bytes
+		char* reserve(size_t n)
+		{
+			if (size_ + n > capacity_) {
+				size_t capacity = 2*capacity_ > size_ + n ? 2*capacity_ : size_ + n;
+				char* p = static_cast<char*>(own_ ? realloc(data_, capacity) : malloc(capacity));
+				ensure (p);
+				if (!own_)
+					memcpy(p, data_, size_);
+				data_ = p;
+				capacity_ = capacity;
+				own_ = true;
+			}
+
+			return data_ + size_;
+		}
+		// commit n bytes written after reserve
+		void advance(size_t n)
+		{
+			size_ += n;
+		}
+		void append(const char* s, size_t n)
+		{
+			memcpy(reserve(n), s, n);
+			size_ += n;
+		}
+		void put(char c)
+		{
+			*reserve(1) = c;
+			++size_;
+		}
+	};
+
+	// s must have room for 20 characters
+	inline size_t format_unsigned(uint64_t u, char* s)
+	{
+		char t[20];
+		size_t n = 0, len = 0;
+
+		do {
+			t[n++] = static_cast<char>('0' + u%10);
+			u /= 10;
+		} while (u);
+
+		while (n)
+			s[len++] = t[--n];
+
+		return len;
+	}
+	// s must have room for 21 characters
+	inline size_t format_integer(int64_t i, char* s)
+	{
+		if (i < 0) {
+			*s = '-';
+			return 1 + format_unsigned(0 - static_cast<uint64_t>(i), s + 1);
+		}
+
+		return format_unsigned(static_cast<uint64_t>(i), s);
+	}
+
+	// Grisu (Loitsch, "Printing floating-point numbers quickly and accurately
+	// with integers") finds the digits of a double with 64-bit integer arithmetic.
+	// The digits always read back as the same double. For a tiny fraction of
+	// inputs the arithmetic cannot tell whether fewer digits would do, those
+	// are settled with snprintf and strtod.
+	namespace grisu {
+
+		// f*2^e
+		struct diyfp {
+			uint64_t f;
+			int e;
+		};
+
+		inline diyfp make(uint64_t f, int e)
+		{
+			diyfp x = { f, e };
+
+			return x;
+		}
+		// upper 64 bits of the product, rounded
+		inline diyfp mul(diyfp x, diyfp y)
+		{
+			uint64_t a = x.f >> 32, b = x.f & 0xFFFFFFFFu;
+			uint64_t c = y.f >> 32, d = y.f & 0xFFFFFFFFu;
+			uint64_t ac = a*c, bc = b*c, ad = a*d, bd = b*d;
+			uint64_t t = (bd >> 32) + (ad & 0xFFFFFFFFu) + (bc & 0xFFFFFFFFu) + (uint64_t(1) << 31);
+
+			return make(ac + (ad >> 32) + (bc >> 32) + (t >> 32), x.e + y.e + 64);
+		}
+		inline diyfp normalize(diyfp x)
+		{
+			while (!(x.f >> 63)) {
+				x.f <<= 1;
+				--x.e;
+			}
+
+			return x;
+		}
+
+		// 10^k as a normalized diyfp, for every 8th k from -300 to 324
+		struct cached_power {
+			uint64_t f;
+			int e;
+			int k;
+		};
+		// a power whose product with a normalized f*2^e has an exponent in [-60, -32]
+		inline const cached_power& power_for(int e)
+		{
+			static const cached_power p[] = {
+				{ UINT64_C(0xAB70FE17C79AC6CA), -1060, -300 },
+				{ UINT64_C(0xFF77B1FCBEBCDC4F), -1034, -292 },
+				{ UINT64_C(0xBE5691EF416BD60C), -1007, -284 },
+				{ UINT64_C(0x8DD01FAD907FFC3C), -980, -276 },
+				{ UINT64_C(0xD3515C2831559A83), -954, -268 },
+				{ UINT64_C(0x9D71AC8FADA6C9B5), -927, -260 },
+				{ UINT64_C(0xEA9C227723EE8BCB), -901, -252 },
+				{ UINT64_C(0xAECC49914078536D), -874, -244 },
+				{ UINT64_C(0x823C12795DB6CE57), -847, -236 },
+				{ UINT64_C(0xC21094364DFB5637), -821, -228 },
+				{ UINT64_C(0x9096EA6F3848984F), -794, -220 },
+				{ UINT64_C(0xD77485CB25823AC7), -768, -212 },
+				{ UINT64_C(0xA086CFCD97BF97F4), -741, -204 },
+				{ UINT64_C(0xEF340A98172AACE5), -715, -196 },
+				{ UINT64_C(0xB23867FB2A35B28E), -688, -188 },
+				{ UINT64_C(0x84C8D4DFD2C63F3B), -661, -180 },
+				{ UINT64_C(0xC5DD44271AD3CDBA), -635, -172 },
+				{ UINT64_C(0x936B9FCEBB25C996), -608, -164 },
+				{ UINT64_C(0xDBAC6C247D62A584), -582, -156 },
+				{ UINT64_C(0xA3AB66580D5FDAF6), -555, -148 },
+				{ UINT64_C(0xF3E2F893DEC3F126), -529, -140 },
+				{ UINT64_C(0xB5B5ADA8AAFF80B8), -502, -132 },
+				{ UINT64_C(0x87625F056C7C4A8B), -475, -124 },
+				{ UINT64_C(0xC9BCFF6034C13053), -449, -116 },
+				{ UINT64_C(0x964E858C91BA2655), -422, -108 },
+				{ UINT64_C(0xDFF9772470297EBD), -396, -100 },
+				{ UINT64_C(0xA6DFBD9FB8E5B88F), -369, -92 },
+				{ UINT64_C(0xF8A95FCF88747D94), -343, -84 },
+				{ UINT64_C(0xB94470938FA89BCF), -316, -76 },
+				{ UINT64_C(0x8A08F0F8BF0F156B), -289, -68 },
+				{ UINT64_C(0xCDB02555653131B6), -263, -60 },
+				{ UINT64_C(0x993FE2C6D07B7FAC), -236, -52 },
+				{ UINT64_C(0xE45C10C42A2B3B06), -210, -44 },
+				{ UINT64_C(0xAA242499697392D3), -183, -36 },
+				{ UINT64_C(0xFD87B5F28300CA0E), -157, -28 },
+				{ UINT64_C(0xBCE5086492111AEB), -130, -20 },
+				{ UINT64_C(0x8CBCCC096F5088CC), -103, -12 },
+				{ UINT64_C(0xD1B71758E219652C), -77, -4 },
+				{ UINT64_C(0x9C40000000000000), -50, 4 },
+				{ UINT64_C(0xE8D4A51000000000), -24, 12 },
+				{ UINT64_C(0xAD78EBC5AC620000), 3, 20 },
+				{ UINT64_C(0x813F3978F8940984), 30, 28 },
+				{ UINT64_C(0xC097CE7BC90715B3), 56, 36 },
+				{ UINT64_C(0x8F7E32CE7BEA5C70), 83, 44 },
+				{ UINT64_C(0xD5D238A4ABE98068), 109, 52 },
+				{ UINT64_C(0x9F4F2726179A2245), 136, 60 },
+				{ UINT64_C(0xED63A231D4C4FB27), 162, 68 },
+				{ UINT64_C(0xB0DE65388CC8ADA8), 189, 76 },
+				{ UINT64_C(0x83C7088E1AAB65DB), 216, 84 },
+				{ UINT64_C(0xC45D1DF942711D9A), 242, 92 },
+				{ UINT64_C(0x924D692CA61BE758), 269, 100 },
+				{ UINT64_C(0xDA01EE641A708DEA), 295, 108 },
+				{ UINT64_C(0xA26DA3999AEF774A), 322, 116 },
+				{ UINT64_C(0xF209787BB47D6B85), 348, 124 },
+				{ UINT64_C(0xB454E4A179DD1877), 375, 132 },
+				{ UINT64_C(0x865B86925B9BC5C2), 402, 140 },
+				{ UINT64_C(0xC83553C5C8965D3D), 428, 148 },
+				{ UINT64_C(0x952AB45CFA97A0B3), 455, 156 },
+				{ UINT64_C(0xDE469FBD99A05FE3), 481, 164 },
+				{ UINT64_C(0xA59BC234DB398C25), 508, 172 },
+				{ UINT64_C(0xF6C69A72A3989F5C), 534, 180 },
+				{ UINT64_C(0xB7DCBF5354E9BECE), 561, 188 },
+				{ UINT64_C(0x88FCF317F22241E2), 588, 196 },
+				{ UINT64_C(0xCC20CE9BD35C78A5), 614, 204 },
+				{ UINT64_C(0x98165AF37B2153DF), 641, 212 },
+				{ UINT64_C(0xE2A0B5DC971F303A), 667, 220 },
+				{ UINT64_C(0xA8D9D1535CE3B396), 694, 228 },
+				{ UINT64_C(0xFB9B7CD9A4A7443C), 720, 236 },
+				{ UINT64_C(0xBB764C4CA7A44410), 747, 244 },
+				{ UINT64_C(0x8BAB8EEFB6409C1A), 774, 252 },
+				{ UINT64_C(0xD01FEF10A657842C), 800, 260 },
+				{ UINT64_C(0x9B10A4E5E9913129), 827, 268 },
+				{ UINT64_C(0xE7109BFBA19C0C9D), 853, 276 },
+				{ UINT64_C(0xAC2820D9623BF429), 880, 284 },
+				{ UINT64_C(0x80444B5E7AA7CF85), 907, 292 },
+				{ UINT64_C(0xBF21E44003ACDD2D), 933, 300 },
+				{ UINT64_C(0x8E679C2F5E44FF8F), 960, 308 },
+				{ UINT64_C(0xD433179D9C8CB841), 986, 316 },
+				{ UINT64_C(0x9E19DB92B4E31BA9), 1013, 324 }
+			};
+			int f = -60 - e - 1;
+			int k = f*78913/(1 << 18) + (f > 0); // ceil(f*log10(2))
+
+			return p[(300 + k + 7)/8];
+		}
+
+		// largest power of 10 not above n, and its number of digits
+		inline int largest_pow10(uint32_t n, uint32_t& pow10)
+		{
+			static const uint32_t p[] = {
+				1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+			};
+			int i = 9;
+
+			while (i > 0 && n < p[i])
+				--i;
+			pow10 = p[i];
+
+			return i + 1;
+		}
+		// move the last digit towards w while that stays in the interval
+		inline void round(char* d, int n, uint64_t dist, uint64_t delta, uint64_t rest, uint64_t ten_k)
+		{
+			while (rest < dist && delta - rest >= ten_k && (rest + ten_k < dist || dist - rest > rest + ten_k - dist)) {
+				--d[n - 1];
+				rest += ten_k;
+			}
+		}
+		// digits of a number in (lo, hi), as close to w as they can be
+		inline int generate(char* d, int& k, diyfp lo, diyfp w, diyfp hi)
+		{
+			uint64_t delta = hi.f - lo.f;
+			uint64_t dist = hi.f - w.f;
+			int shift = -hi.e;
+			uint64_t mask = (uint64_t(1) << shift) - 1;
+			uint32_t p1 = static_cast<uint32_t>(hi.f >> shift); // integral part
+			uint64_t p2 = hi.f & mask;                          // fraction
+			uint32_t pow10;
+			int n = 0;
+
+			for (int m = largest_pow10(p1, pow10); m > 0; --m) {
+				d[n++] = static_cast<char>('0' + p1/pow10);
+				p1 %= pow10;
+				uint64_t rest = (uint64_t(p1) << shift) + p2;
+				if (rest <= delta) {
+					k += m - 1;
+					round(d, n, dist, delta, rest, uint64_t(pow10) << shift);
+
+					return n;
+				}
+				pow10 /= 10;
+			}
+			for (;;) {
+				p2 *= 10;
+				d[n++] = static_cast<char>('0' + (p2 >> shift));
+				p2 &= mask;
+				delta *= 10;
+				dist *= 10;
+				--k;
+				if (p2 <= delta)
+					break;
+			}
+			round(d, n, dist, delta, p2, mask + 1);
+
+			return n;
+		}
+		// digits d of a finite x > 0, x is about d*10^k
+		// fewer is the least number of digits there may be
+		inline int digits(double x, char* d, int& k, int& fewer)
+		{
+			uint64_t bits;
+			memcpy(&bits, &x, 8);
+			uint64_t f = bits & ((uint64_t(1) << 52) - 1);
+			int e = static_cast<int>(bits >> 52 & 0x7FF);
+
+			diyfp v = e ? make(f + (uint64_t(1) << 52), e - 1075) : make(f, 1 - 1075);
+			// halfway to the neighbours, closer below at powers of 2
+			diyfp hi = normalize(make(2*v.f + 1, v.e - 1));
+			diyfp lo = f == 0 && e > 1 ? make(4*v.f - 1, v.e - 2) : make(2*v.f - 1, v.e - 1);
+			lo = make(lo.f << (lo.e - hi.e), hi.e);
+			v = normalize(v);
+
+			const cached_power& c = power_for(hi.e);
+			diyfp p = make(c.f, c.e);
+			diyfp w = mul(v, p);
+			lo = mul(lo, p);
+			hi = mul(hi, p);
+			// both ends are off by at most one, digits inside the narrower
+			// interval are safe and the wider one bounds how short they can be
+			char t[20];
+			int j = -c.k;
+			fewer = generate(t, j, make(lo.f - 1, lo.e), w, make(hi.f + 1, hi.e));
+			k = -c.k;
+
+			return generate(d, k, make(lo.f + 1, lo.e), w, make(hi.f - 1, hi.e));
+		}
+		// shortest digits from fewer to n - 1 that read back as x, else d stays
+		inline int exact(double x, char* d, int& k, int fewer, int n)
+		{
+			for (int m = fewer; m < n; ++m) {
+				char s[40], t[40], u[20];
+				int j = 0;
+				snprintf(s, sizeof(s), "%.*e", m - 1, x);
+				// the decimal point depends on the locale, digits and exponent do not
+				const char* p = s;
+				for (; *p && *p != 'e'; ++p)
+					if (*p >= '0' && *p <= '9')
+						u[j++] = *p;
+				if (*p != 'e' || j != m)
+					continue;
+				int e = atoi(p + 1);
+				t[0] = u[0];
+				t[1] = '.';
+				memcpy(t + 2, u + 1, m - 1);
+				snprintf(t + m + 1, sizeof(t) - m - 1, "e%d", e);
+				if (strtod_c(t, 0) == x) {
+					memcpy(d, u, m);
+					k = e - (m - 1);
+
+					return m;
+				}
+			}
+
+			return n;
+		}
+
+	} // namespace grisu
+
+	// Shortest decimal that reads back as x, s must have room for 32 characters.
+	// Doubles that are whole numbers get a trailing ".0" so they read back as JSON_NUMBER.
+	// Exponents are used below 1e-6 and from 1e21, like JavaScript does.
+	// JSON has no infinity or NaN so they are written as null.
+	inline size_t format_double(double x, char* s)
+	{
+		if (x != x || x - x != 0) {
+			memcpy(s, "null", 4);
+
+			return 4;
+		}
+
+		if (x < 1e16 && x > -1e16 && x == static_cast<double>(static_cast<int64_t>(x))) { // cast only in range
+			size_t n = format_integer(static_cast<int64_t>(x), s);
+			if (n == 1 && s[0] == '0' && 1/x < 0) { // -0
+				memcpy(s, "-0.0", 4);
+
+				return 4;
+			}
+			s[n++] = '.';
+			s[n++] = '0';
+
+			return n;
+		}
+
+		size_t n = 0;
+		if (x < 0) {
+			s[n++] = '-';
+			x = -x;
+		}
+		char d[20];
+		int k;
+		int fewer;
+		int m = grisu::digits(x, d, k, fewer);
+		if (fewer < m)
+			m = grisu::exact(x, d, k, fewer, m);
+		int point = m + k; // digits before the decimal point
+
+		if (point > 21 || point < -5) {
+			s[n++] = d[0];
+			if (m > 1) {
+				s[n++] = '.';
+				memcpy(s + n, d + 1, m - 1);
+				n += m - 1;
+			}
+			int e = point - 1;
+			s[n++] = 'e';
+			s[n++] = e < 0 ? '-' : '+';
+			n += format_integer(e < 0 ? -e : e, s + n);
+		}
+		else if (point >= m) { // whole number with trailing zeros
+			memcpy(s + n, d, m);
+			memset(s + n + m, '0', point - m);
+			n += point;
+			s[n++] = '.';
+			s[n++] = '0';
+		}
+		else if (point > 0) {
+			memcpy(s + n, d, point);
+			s[n + point] = '.';
+			memcpy(s + n + point + 1, d + point, m - point);
+			n += m + 1;
+		}
+		else {
+			s[n++] = '0';
+			s[n++] = '.';
+			memset(s + n, '0', -point);
+			memcpy(s + n - point, d, m);
+			n += m - point;
+		}
+
+		return n;
+	}
 
-std::ostream& operator<<(std::ostream& os, const json::value& v)
+	// number of leading bytes that need no escaping
+	inline size_t unescaped(const char* s, size_t n)
+	{
+		size_t i = 0;
+#ifdef JSON_SSE2
+		const __m128i quote = _mm_set1_epi8('"');
+		const __m128i backslash = _mm_set1_epi8('\\');
+		const __m128i control = _mm_set1_epi8(0x1F);
+
+		for (; i + 16 <= n; i += 16) {
+			__m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+			__m128i m = _mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(c, quote), _mm_cmpeq_epi8(c, backslash)),
+				_mm_cmpeq_epi8(_mm_min_epu8(c, control), c)); // c <= 0x1F
+			unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(m));
+
+			if (mask)
+				return i + trailing_zeros(mask);
+		}
+#endif
+		while (i < n && static_cast<unsigned char>(s[i]) >= 0x20 && s[i] != '"' && s[i] != '\\')
+			++i;
+
+		return i;
+	}
+	// quoted and escaped
+	inline void serialize_string(buffer& buf, const char* s, size_t n)
+	{
+		static const char hex[] = "0123456789abcdef";
+
+		buf.put('"');
+		while (n) {
+			size_t i = unescaped(s, n);
+			buf.append(s, i);
+			if (i == n)
+				break;
+
+			char c = s[i];
+			char* p = buf.reserve(6);
+			p[0] = '\\';
+			switch (c) {
+			case '"':  p[1] = '"'; buf.advance(2); break;
+			case '\\': p[1] = '\\'; buf.advance(2); break;
+			case '\b': p[1] = 'b'; buf.advance(2); break;
+			case '\f': p[1] = 'f'; buf.advance(2); break;
+			case '\n': p[1] = 'n'; buf.advance(2); break;
+			case '\r': p[1] = 'r'; buf.advance(2); break;
+			case '\t': p[1] = 't'; buf.advance(2); break;
+			default:
+				p[1] = 'u';
+				p[2] = '0';
+				p[3] = '0';
+				p[4] = hex[(c >> 4) & 0xF];
+				p[5] = hex[c & 0xF];
+				buf.advance(6);
+			}
+			s += i + 1;
+			n -= i + 1;
+		}
+		buf.put('"');
+	}
+#ifndef JSON_ONLY
+	// bytes are written as a base64 string
+	inline void serialize_base64(buffer& buf, const uint8_t* b, size_t n)
+	{
+		static const char b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+		buf.put('"');
+		char* p = buf.reserve(4*((n + 2)/3));
+		for (size_t i = 0; i < n; i += 3) {
+			uint32_t u = b[i] << 16;
+			if (i + 1 < n) u |= b[i + 1] << 8;
+			if (i + 2 < n) u |= b[i + 2];
+
+			*p++ = b64[(u >> 18) & 0x3F];
+			*p++ = b64[(u >> 12) & 0x3F];
+			*p++ = i + 1 < n ? b64[(u >> 6) & 0x3F] : '=';
+			*p++ = i + 2 < n ? b64[u & 0x3F] : '=';
+		}
+		buf.advance(4*((n + 2)/3));
+		buf.put('"');
+	}
+#endif
+
+	inline void serialize_indent(buffer& buf, int indent, int depth)
+	{
+		if (indent > 0) {
+			char* p = buf.reserve(1 + indent*depth);
+			*p++ = '\n';
+			memset(p, ' ', indent*depth);
+			buf.advance(1 + indent*depth);
+		}
+	}
+
+	inline void serialize(buffer& buf, const json::element& e, int indent = 0, int depth = 0);
+
+	// number i of a typed array
+	inline void serialize_typed(buffer& buf, const json::element& e, size_t i)
+	{
+		char* p = buf.reserve(32);
+
+		switch (e.typed()) {
+		case JSON_NUMBER:
+			buf.advance(format_double(e.data.array.number[i], p));
+			break;
+#ifndef JSON_ONLY
+		case JSON_INT32:
+			buf.advance(format_integer(e.data.array.int32[i], p));
+			break;
+		case JSON_INT64:
+			buf.advance(format_integer(e.data.array.int64[i], p));
+			break;
+#endif
+		default:
+			break;
+		}
+	}
+
+	// O is json::object, json::flat_object or json::interned_object
+	template<class O>
+	inline void serialize_object(buffer& buf, const O& o, int indent = 0, int depth = 0)
+	{
+		buf.put('{');
+		for (typename O::const_iterator i = o.begin(); i != o.end(); ++i) {
+			if (i != o.begin())
+				buf.put(',');
+			serialize_indent(buf, indent, depth + 1);
+			serialize_string(buf, i->first.data(), i->first.size());
+			buf.put(':');
+			if (indent > 0)
+				buf.put(' ');
+			serialize(buf, i->second, indent, depth + 1);
+		}
+		if (!o.empty())
+			serialize_indent(buf, indent, depth);
+		buf.put('}');
+	}
+
+	// compact if indent is 0, otherwise indent spaces per level
+	inline void serialize(buffer& buf, const json::element& e, int indent, int depth)
+	{
+		char* p;
+
+		switch (e.type) {
+		case JSON_STRING:
+			serialize_string(buf, e.str().data, e.str().size);
+			break;
+		case JSON_NUMBER:
+			p = buf.reserve(32);
+			buf.advance(format_double(e.data.number, p));
+			break;
+		case JSON_OBJECT:
+			serialize_object(buf, *e.data.object, indent, depth);
+			break;
+		case JSON_ARRAY:
+			buf.put('[');
+			for (size_t i = 0; i < e.data.array.size; ++i) {
+				if (i)
+					buf.put(',');
+				serialize_indent(buf, indent, depth + 1);
+				if (e.flags & JSON_FLAG_TYPED)
+					serialize_typed(buf, e, i);
+				else
+					serialize(buf, e.data.array.element[i], indent, depth + 1);
+			}
+			if (e.data.array.size)
+				serialize_indent(buf, indent, depth);
+			buf.put(']');
+			break;
+		case JSON_TRUE:
+			buf.append("true", 4);
+			break;
+		case JSON_FALSE:
+			buf.append("false", 5);
+			break;
+#ifndef JSON_ONLY
+		case JSON_BYTE:
+			serialize_base64(buf, e.data.byte.data, e.data.byte.size);
+			break;
+		case JSON_INT32:
+			p = buf.reserve(21);
+			buf.advance(format_integer(e.data.int32, p));
+			break;
+		case JSON_INT64:
+			p = buf.reserve(21);
+			buf.advance(format_integer(e.data.int64, p));
+			break;
+		case JSON_DATE: // seconds since the epoch
+			p = buf.reserve(21);
+			buf.advance(format_integer(e.data.date, p));
+			break;
+#endif
+		default: // JSON_NULL and JSON_UNDEFINED
+			buf.append("null", 4);
+		}
+	}
+	inline void serialize(buffer& buf, const json::object& o, int indent = 0)
+	{
+		serialize_object(buf, o, indent);
+	}
+	inline void serialize(buffer& buf, const json::flat_object& o, int indent = 0)
+	{
+		serialize_object(buf, o, indent);
+	}
+
+	// JSON text for a value or object
+	template<class T>
+	inline std::string to_string(const T& t, int indent = 0)
+	{
+		buffer buf;
+
+		serialize(buf, t, indent);
+
+		return buf.str();
+	}
+
+} // namespace json
+
+inline std::ostream& operator<<(std::ostream& os, const json::value& v)
 {
-	switch (v.type) {
-	case JSON_STRING: os << '"' << v.data.string.data << '"'; break;
-	case JSON_NUMBER: os << v.data.number; break;
-	case JSON_OBJECT: os << '(' << v.data.object << ')'; break;
-	case JSON_ARRAY: { 
-		os << '[';
-		for (size_t i = 0; i < v.data.array.size; ++i) {
-			if (i) os << ',';
-			os << v[i];
-		}
-		os << ']';
-		break;
-	}
-	case JSON_TRUE:  os << "true"; break;
-	case JSON_FALSE: os << "false"; break;
-	case JSON_NULL:  os << "null"; break;
-	case JSON_BYTE: { for (size_t i = 0; i < v.data.byte.size; ++i) os << v.data.byte.data[i]; } break;
-	case JSON_INT32: os << v.data.int32; break;
-	case JSON_INT64: os << v.data.int64; break;
-	case JSON_DATE: os << v.data.date; break; // pretty print???
-
-	default:
-		os << "*undefined*";
-	}
-
-	return os;
+	json::buffer buf;
+
+	json::serialize(buf, v);
+
+	return os.write(buf.data(), buf.size());
 }
-std::ostream& operator<<(std::ostream& os, const json::object& o)
+inline std::ostream& operator<<(std::ostream& os, const json::object& o)
 {
-	std::map<std::string,json::value>::const_iterator i;
+	json::buffer buf;
 
-	os << '{';
-	for (i = o.begin(); i != o.end(); ++i) {
-		if (i != o.begin()) os << ',';
-		os << '"' << i->first << "\":" << i->second; 
-	}
-	os << '}';
+	json::serialize(buf, o);
+
+	return os.write(buf.data(), buf.size());
+}
+inline std::ostream& operator<<(std::ostream& os, const json::flat_object& o)
+{
+	json::buffer buf;
+
+	json::serialize(buf, o);
 
-	return os;
+	return os.write(buf.data(), buf.size());
 }
 
-std::istream& operator>>(std::istream& is, json::value& v)
+inline std::istream& operator>>(std::istream& is, json::value& v)
 {
 	v = json::parse::read_value(is);
 
 	return is;
 }
-std::istream& operator>>(std::istream& is, json::object& o)
+inline std::istream& operator>>(std::istream& is, json::object& o)
 {
 	o = json::parse::read_object(is);
 
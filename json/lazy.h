@@ -0,0 +1,333 @@
+// lazy.h - validate a document once and decode fields only when they are used
+// parse() builds the structural index (structural.h), checks the grammar and
+// scalars, and records where every object and array ends so lookups skip over
+// subtrees without reading them. Nothing is decoded until get(), str() or number().
+//	json::lazy_document d;
+//	if (d.parse(b, n)) {
+//		double x = d.root()["point"]["x"].number();
+//		std::string s = d.root()["tags"][2].str();
+//	}
+// The buffer must outlive the document and any values decoded from it.
+#pragma once
+#include <string>
+#include <vector>
+#include "json.h"
+#include "structural.h"
+
+namespace json {
+
+	class lazy_document;
+
+	// handle to a value in a lazy_document, invalid if a lookup failed
+	class lazy_value {
+		friend class lazy_document;
+
+		const lazy_document* d_;
+		size_t i_; // index of the first structural of the value
+
+		lazy_value(const lazy_document* d, size_t i)
+			: d_(d), i_(i)
+		{ }
+	public:
+		lazy_value()
+			: d_(0), i_(0)
+		{ }
+
+		bool valid(void) const
+		{
+			return d_ != 0;
+		}
+		// JSON_UNDEFINED if not valid
+		inline json_element_type type(void) const;
+
+		// object member, invalid if not an object or there is no such key
+		inline lazy_value operator[](const char* key) const;
+		lazy_value operator[](const std::string& key) const
+		{
+			return find(key.data(), key.size());
+		}
+		inline lazy_value find(const char* key, size_t n) const;
+		// array element, invalid if not an array or out of range
+		inline lazy_value operator[](size_t i) const;
+		lazy_value operator[](int i) const // [0] is not a null key
+		{
+			return operator[](static_cast<size_t>(i));
+		}
+		// number of array elements or object members
+		inline size_t size(void) const;
+
+		// decode this value and everything under it
+		// strings without escapes refer to the parse buffer
+		inline bool get(json::value& v, json::arena* a = 0) const;
+		// decoded string, empty if not a string
+		inline std::string str(void) const;
+		// any number as a double, 0 if not a number
+		inline double number(void) const;
+	};
+
+	class lazy_document {
+		friend class lazy_value;
+
+		const char* b_;
+		const char* e_;
+		std::vector<uint32_t> idx_; // offsets of structurals
+		std::vector<uint32_t> end_; // end_[i] is the index of the bracket closing idx_[i]
+
+		const char* at(size_t i) const
+		{
+			return b_ + idx_[i];
+		}
+		char peek(size_t i) const
+		{
+			return i < idx_.size() ? *at(i) : 0;
+		}
+		const char* next(size_t i) const
+		{
+			return i + 1 < idx_.size() ? at(i + 1) : e_;
+		}
+		// index just past the value starting at i
+		size_t skip(size_t i) const
+		{
+			char c = peek(i);
+
+			return (c == '{' || c == '[' ? end_[i] : i) + 1;
+		}
+
+		// a scalar at index i that ends where the next structural starts
+		bool scalar(size_t i, std::string& buf) const
+		{
+			const char* p = at(i);
+			bool ok;
+
+			switch (*p) {
+			case '"': {
+				json::string s;
+				ok = parse::read_chars(++p, e_, s, buf);
+				break;
+			}
+			case 't':
+				ok = parse::read_literal(p, e_, "true", 4);
+				break;
+			case 'f':
+				ok = parse::read_literal(p, e_, "false", 5);
+				break;
+			case 'n':
+				ok = parse::read_literal(p, e_, "null", 4);
+				break;
+			default: {
+				json::element n;
+				ok = parse::scan_number(p, e_, n);
+			}
+			}
+
+			return ok && parse::skip(p, e_) == next(i);
+		}
+
+		// check the grammar and fill in end_
+		bool validate(void)
+		{
+			enum { VALUE, FIRST_KEY, KEY, COLON, ELEMENT, NEXT } s = VALUE;
+			std::vector<uint32_t> open;
+			std::string buf;
+
+			end_.resize(idx_.size());
+			for (size_t i = 0; i < idx_.size(); ++i) {
+				char c = *at(i);
+				char top = open.empty() ? 0 : *at(open.back());
+
+				end_[i] = static_cast<uint32_t>(i);
+				switch (s) {
+				case FIRST_KEY:
+					if (c == '}')
+						goto close;
+					// fall through
+				case KEY:
+					if (c != '"' || !scalar(i, buf))
+						return false;
+					s = COLON;
+					continue;
+				case COLON:
+					if (c != ':')
+						return false;
+					s = VALUE;
+					continue;
+				case ELEMENT:
+					if (c == ']')
+						goto close;
+					// fall through
+				case VALUE:
+					if (c == '{' || c == '[') {
+						open.push_back(static_cast<uint32_t>(i));
+						s = c == '{' ? FIRST_KEY : ELEMENT;
+						continue;
+					}
+					if (c == '}' || c == ']' || c == ',' || c == ':' || !scalar(i, buf))
+						return false;
+					s = NEXT;
+					continue;
+				case NEXT:
+					if (open.empty())
+						return false; // more than one value
+					if (c == ',') {
+						s = top == '{' ? KEY : VALUE;
+						continue;
+					}
+					if (c != (top == '{' ? '}' : ']'))
+						return false;
+				}
+			close:
+				end_[open.back()] = static_cast<uint32_t>(i);
+				open.pop_back();
+				s = NEXT;
+			}
+
+			return s == NEXT && open.empty();
+		}
+	public:
+		lazy_document()
+			: b_(0), e_(0)
+		{ }
+
+		// index and validate [b, b + n) without decoding anything
+		bool parse(const char* b, size_t n)
+		{
+			b_ = b;
+			e_ = b + n;
+
+			if (!structural::index(b, n, idx_) || !validate()) {
+				idx_.clear();
+
+				return false;
+			}
+
+			return true;
+		}
+
+		// invalid if parse failed
+		lazy_value root(void) const
+		{
+			return idx_.empty() ? lazy_value() : lazy_value(this, 0);
+		}
+		lazy_value operator[](const char* key) const
+		{
+			return root()[key];
+		}
+		lazy_value operator[](size_t i) const
+		{
+			return root()[i];
+		}
+		lazy_value operator[](int i) const
+		{
+			return root()[i];
+		}
+	};
+
+	inline json_element_type lazy_value::type(void) const
+	{
+		if (!d_)
+			return JSON_UNDEFINED;
+
+		switch (d_->peek(i_)) {
+		case '"': return JSON_STRING;
+		case '{': return JSON_OBJECT;
+		case '[': return JSON_ARRAY;
+		case 't': return JSON_TRUE;
+		case 'f': return JSON_FALSE;
+		case 'n': return JSON_NULL;
+		}
+
+		const char* p = d_->at(i_);
+		json::element n;
+		parse::scan_number(p, d_->e_, n);
+
+		return n.type;
+	}
+
+	inline lazy_value lazy_value::find(const char* key, size_t n) const
+	{
+		if (!d_ || d_->peek(i_) != '{')
+			return lazy_value();
+
+		std::string buf;
+		for (size_t j = i_ + 1; d_->peek(j) == '"'; ) {
+			const char* p = d_->at(j) + 1;
+			json::string k;
+			parse::read_chars(p, d_->e_, k, buf);
+			if (k.size == n && (n == 0 || memcmp(k.data, key, n) == 0))
+				return lazy_value(d_, j + 2);
+
+			j = d_->skip(j + 2); // , or }
+			if (d_->peek(j) == ',')
+				++j;
+		}
+
+		return lazy_value();
+	}
+	inline lazy_value lazy_value::operator[](const char* key) const
+	{
+		return find(key, strlen(key));
+	}
+	inline lazy_value lazy_value::operator[](size_t i) const
+	{
+		if (!d_ || d_->peek(i_) != '[')
+			return lazy_value();
+
+		for (size_t j = i_ + 1; d_->peek(j) != ']'; --i) {
+			if (i == 0)
+				return lazy_value(d_, j);
+			j = d_->skip(j); // , or ]
+			if (d_->peek(j) == ',')
+				++j;
+		}
+
+		return lazy_value();
+	}
+	inline size_t lazy_value::size(void) const
+	{
+		char c = d_ ? d_->peek(i_) : 0;
+		if (c != '{' && c != '[')
+			return 0;
+
+		size_t n = 0;
+		for (size_t j = i_ + 1; j < d_->end_[i_]; ++n) {
+			j = d_->skip(c == '{' ? j + 2 : j);
+			if (d_->peek(j) == ',')
+				++j;
+		}
+
+		return n;
+	}
+
+	inline bool lazy_value::get(json::value& v, json::arena* a) const
+	{
+		if (!d_)
+			return false;
+
+		const char* p = d_->at(i_);
+
+		return parse::read_value(p, d_->e_, v, a);
+	}
+	inline std::string lazy_value::str(void) const
+	{
+		if (!d_ || d_->peek(i_) != '"')
+			return std::string();
+
+		const char* p = d_->at(i_) + 1;
+		std::string buf;
+		json::string s;
+		parse::read_chars(p, d_->e_, s, buf);
+
+		return std::string(s.data, s.size);
+	}
+	inline double lazy_value::number(void) const
+	{
+		if (!d_)
+			return 0;
+
+		const char* p = d_->at(i_);
+		double x;
+
+		return parse::read_double(p, d_->e_, x) ? x : 0;
+	}
+
+} // namespace json
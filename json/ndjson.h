@@ -0,0 +1,158 @@
+// ndjson.h - parallel parsing of newline delimited JSON (JSON Lines)
+// The input is cut into chunks of about chunk bytes that end on a newline and
+// the chunks are parsed on a json::pool. Every record is one value on one line;
+// blank lines are skipped. Strings without escapes refer to the input buffer.
+#pragma once
+#include <deque>
+#include <istream>
+#include <utility>
+#include <vector>
+#include "json.h"
+#include "pool.h"
+
+namespace json {
+
+	namespace ndjson {
+
+		// [begin, end) offsets of chunks of about size bytes that end just past a newline
+		inline void split(const char* b, size_t n, size_t size, std::vector<std::pair<size_t,size_t>>& chunk)
+		{
+			chunk.clear();
+
+			for (size_t i = 0; i < n; ) {
+				size_t j = n - i > size ? i + size : n;
+				if (j < n) {
+					const char* nl = static_cast<const char*>(memchr(b + j, '\n', n - j));
+					j = nl ? nl - b + 1 : n;
+				}
+				chunk.push_back(std::make_pair(i, j));
+				i = j;
+			}
+		}
+
+		// call f(offset, value) for each record in [b, e), offset is from base
+		// Returns false at the first record that is not a single JSON value.
+		template<class F>
+		inline bool parse_chunk(const char* base, const char* b, const char* e, F& f)
+		{
+			for (;;) {
+				b = parse::skip(b, e);
+				if (b == e)
+					return true;
+
+				size_t offset = b - base;
+				json::value v;
+				if (!parse::read_value(b, e, v))
+					return false;
+				while (b != e && (*b == ' ' || *b == '\t' || *b == '\r'))
+					++b;
+				if (b != e && *b != '\n')
+					return false;
+
+				f(offset, v);
+			}
+		}
+
+		// Calls f(offset, value) for every record in [b, b + n) on the pool threads,
+		// in no particular order, so f must be thread safe.
+		// Returns false if any record fails to parse; records in other chunks are still visited.
+		template<class F>
+		inline bool for_each(const char* b, size_t n, F f, json::pool& p, size_t chunk = 1 << 20)
+		{
+			std::vector<std::pair<size_t,size_t>> c;
+			split(b, n, chunk, c);
+
+			std::vector<char> ok(c.size());
+			for (size_t i = 0; i < c.size(); ++i) {
+				p.submit([b, &c, &ok, &f, i]() {
+					ok[i] = parse_chunk(b, b + c[i].first, b + c[i].second, f);
+				});
+			}
+			p.wait();
+
+			for (size_t i = 0; i < ok.size(); ++i)
+				if (!ok[i])
+					return false;
+
+			return true;
+		}
+
+		// append the records in [b, b + n) to v in input order
+		inline bool parse(const char* b, size_t n, std::vector<json::value>& v, json::pool& p, size_t chunk = 1 << 20)
+		{
+			std::vector<std::pair<size_t,size_t>> c;
+			split(b, n, chunk, c);
+
+			std::vector<std::deque<json::value>> r(c.size()); // no copies when growing
+			std::vector<char> ok(c.size());
+			for (size_t i = 0; i < c.size(); ++i) {
+				p.submit([b, &c, &r, &ok, i]() {
+					std::deque<json::value>& ri = r[i];
+					auto f = [&ri](size_t, json::value& w) {
+						ri.push_back(json::value());
+						ri.back().swap(w);
+					};
+					ok[i] = parse_chunk(b, b + c[i].first, b + c[i].second, f);
+				});
+			}
+			p.wait();
+
+			size_t size = v.size();
+			for (size_t i = 0; i < r.size(); ++i) {
+				if (!ok[i])
+					return false;
+				size += r[i].size();
+			}
+
+			v.reserve(size);
+			for (size_t i = 0; i < r.size(); ++i) {
+				for (size_t j = 0; j < r[i].size(); ++j) {
+					v.push_back(json::value());
+					v.back().swap(r[i][j]);
+				}
+			}
+
+			return true;
+		}
+
+		// read block bytes at a time and call f(offset, value) for every record,
+		// offset is from the start of the stream. Values are only valid during the call.
+		template<class F>
+		inline bool for_each(std::istream& is, F f, json::pool& p, size_t block = 64 << 20, size_t chunk = 1 << 20)
+		{
+			std::vector<char> buf(block);
+			size_t start = 0; // stream offset of buf[0]
+			size_t keep = 0;  // partial record carried over from the last block
+			bool ok = true;
+
+			while (is) {
+				if (keep == buf.size())
+					buf.resize(2*buf.size()); // record longer than a block
+				is.read(&buf[keep], buf.size() - keep);
+				size_t n = keep + static_cast<size_t>(is.gcount());
+
+				// whole records
+				size_t m = n;
+				if (is)
+					while (m && buf[m - 1] != '\n')
+						--m;
+				if (m == 0 && is) {
+					keep = n;
+					continue;
+				}
+
+				auto g = [&f, start](size_t offset, json::value& v) { f(start + offset, v); };
+				ok = for_each(&buf[0], m, g, p, chunk) && ok;
+
+				keep = n - m;
+				if (keep)
+					memmove(&buf[0], &buf[m], keep);
+				start += m;
+			}
+
+			return ok;
+		}
+
+	} // namespace ndjson
+
+} // namespace json
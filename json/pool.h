@@ -0,0 +1,158 @@
+// pool.h - work stealing thread pool for batch parsing
+// Every worker has its own queue. Tasks are dealt out round robin, workers take
+// from the back of their own queue and steal from the front of the others when
+// it runs dry, so a few slow tasks do not leave the other cores idle.
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace json {
+
+	class pool {
+		typedef std::function<void()> task;
+
+		struct queue {
+			std::mutex m;
+			std::deque<task> q;
+		};
+
+		std::vector<std::unique_ptr<queue>> queue_;
+		std::vector<std::thread> thread_;
+		std::mutex m_;
+		std::condition_variable work_; // tasks were queued or stop_ was set
+		std::condition_variable idle_; // pending_ reached 0
+		size_t queued_;  // tasks in queues
+		size_t pending_; // tasks submitted and not finished
+		size_t next_;    // queue for the next task
+		bool stop_;
+		std::exception_ptr error_; // first exception thrown by a task
+
+		pool(const pool&);
+		pool& operator=(const pool&);
+
+		bool pop(size_t i, task& t)
+		{
+			for (size_t j = 0; j < queue_.size(); ++j) {
+				queue& w = *queue_[(i + j) % queue_.size()];
+				std::lock_guard<std::mutex> lock(w.m);
+
+				if (!w.q.empty()) {
+					if (j == 0) {
+						t = std::move(w.q.back());
+						w.q.pop_back();
+					}
+					else {
+						t = std::move(w.q.front());
+						w.q.pop_front();
+					}
+
+					return true;
+				}
+			}
+
+			return false;
+		}
+		void run(size_t i)
+		{
+			for (;;) {
+				task t;
+
+				if (pop(i, t)) {
+					{
+						std::lock_guard<std::mutex> lock(m_);
+						--queued_;
+					}
+					try {
+						t();
+					}
+					catch (...) {
+						std::lock_guard<std::mutex> lock(m_);
+						if (!error_)
+							error_ = std::current_exception();
+					}
+
+					std::lock_guard<std::mutex> lock(m_);
+					if (--pending_ == 0)
+						idle_.notify_all();
+				}
+				else {
+					std::unique_lock<std::mutex> lock(m_);
+					while (!stop_ && queued_ == 0)
+						work_.wait(lock);
+					if (stop_ && queued_ == 0)
+						return;
+				}
+			}
+		}
+	public:
+		// n = 0 uses one thread per hardware thread
+		explicit pool(size_t n = 0)
+			: queued_(0), pending_(0), next_(0), stop_(false)
+		{
+			if (n == 0)
+				n = std::thread::hardware_concurrency();
+			if (n == 0)
+				n = 1;
+
+			for (size_t i = 0; i < n; ++i)
+				queue_.push_back(std::unique_ptr<queue>(new queue));
+			for (size_t i = 0; i < n; ++i)
+				thread_.push_back(std::thread(&pool::run, this, i));
+		}
+		// finishes queued tasks
+		~pool()
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_);
+				stop_ = true;
+			}
+			work_.notify_all();
+			for (size_t i = 0; i < thread_.size(); ++i)
+				thread_[i].join();
+		}
+
+		size_t size(void) const
+		{
+			return thread_.size();
+		}
+
+		void submit(task t)
+		{
+			size_t i;
+			{
+				// counted before the push so a worker can never finish it first
+				std::lock_guard<std::mutex> lock(m_);
+				i = next_++ % queue_.size();
+				++queued_;
+				++pending_;
+			}
+			{
+				std::lock_guard<std::mutex> lock(queue_[i]->m);
+				queue_[i]->q.push_back(std::move(t));
+			}
+			work_.notify_one();
+		}
+
+		// block until every submitted task has finished
+		// rethrows the first exception a task threw
+		void wait(void)
+		{
+			std::unique_lock<std::mutex> lock(m_);
+			while (pending_)
+				idle_.wait(lock);
+
+			if (error_) {
+				std::exception_ptr e = error_;
+				error_ = std::exception_ptr();
+				std::rethrow_exception(e);
+			}
+		}
+	};
+
+} // namespace json
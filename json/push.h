@@ -0,0 +1,333 @@
+// push.h - incremental parser for JSON that arrives in pieces
+// Input is handed over with feed() in chunks of any size, split anywhere,
+// including inside strings and numbers. The parser keeps its state between
+// calls and hands over every document as soon as its last byte arrives.
+// Documents can follow each other on the same stream, separated by whitespace.
+//	json::push_parser p;
+//	while ((n = recv(s, buf, sizeof(buf), 0)) > 0) {
+//		if (!p.feed(buf, n))
+//			break; // not JSON
+//		json::value v;
+//		while (p.next(v))
+//			...
+//	}
+//	p.finish(); // a top level number or literal has no terminator
+// Chunks are not referenced after feed returns.
+#pragma once
+#include <deque>
+#include <functional>
+#include <string>
+#include "json.h"
+
+namespace json {
+
+	class push_parser {
+	public:
+		typedef std::function<void(json::value&)> callback;
+	private:
+		enum expect {
+			VALUE,         // any value
+			FIRST_KEY,     // key or } after {
+			KEY,           // key after ,
+			COLON,
+			FIRST_ELEMENT, // value or ] after [
+			NEXT,          // , or closing bracket after a member or element
+		};
+		enum token {
+			NONE,
+			STRING,
+			NUMBER,
+			LITERAL,
+		};
+		struct frame {
+			json::value v;   // object or array under construction
+			std::string key; // key of the member being read
+		};
+
+		callback f_;
+		std::deque<json::value> done_; // complete documents if there is no callback
+		std::deque<frame> stack_;      // open containers
+		expect expect_;
+		token token_;
+		std::string text_; // token read so far
+		bool escape_;      // last string character was an unescaped backslash
+		bool error_;
+
+		push_parser(const push_parser&);
+		push_parser& operator=(const push_parser&);
+
+		static bool number_char(char c)
+		{
+			return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
+		}
+
+		// put a complete value where it belongs
+		bool add(json::value& v)
+		{
+			if (stack_.empty()) {
+				if (f_) {
+					f_(v);
+				}
+				else {
+					done_.push_back(json::value());
+					done_.back().swap(v);
+				}
+				expect_ = VALUE;
+			}
+			else {
+				frame& top = stack_.back();
+				if (top.v.type == JSON_ARRAY) {
+					top.v.emplace_back().swap(v);
+				}
+				else {
+					// first key wins, like read_object
+					std::pair<json::object::iterator,bool> i = top.v.object().insert(json::pair(top.key, json::value()));
+					if (i.second)
+						i.first->second.swap(v);
+				}
+				expect_ = NEXT;
+			}
+
+			return true;
+		}
+
+		// token_ is complete
+		bool end_token(void)
+		{
+			token t = token_;
+			token_ = NONE;
+			const char* b = text_.data();
+			const char* e = b + text_.size();
+
+			if (t == STRING) {
+				std::string buf;
+				json::string s;
+				if (!parse::read_chars(b, e, s, buf) || b != e)
+					return false;
+				if (expect_ == FIRST_KEY || expect_ == KEY) {
+					stack_.back().key.assign(s.data, s.size);
+					expect_ = COLON;
+
+					return true;
+				}
+				json::value v;
+				v = s; // copy, the chunk goes away
+
+				return add(v);
+			}
+
+			json::value v;
+			if (t == NUMBER) {
+				json::element n;
+				if (!parse::scan_number(b, e, n) || b != e)
+					return false;
+				json::value w(n);
+				v.swap(w);
+			}
+			else if (text_ == "true") {
+				v = true;
+			}
+			else if (text_ == "false") {
+				v = false;
+			}
+			else if (text_ == "null") {
+				v.type = JSON_NULL;
+			}
+			else {
+				return false;
+			}
+
+			return add(v);
+		}
+
+		// consume bytes of the current token, returns the number used
+		size_t lex(const char* b, const char* e)
+		{
+			const char* p = b;
+
+			if (token_ == STRING) {
+				bool closed = false;
+				while (p != e) {
+					if (escape_) {
+						escape_ = false;
+						++p;
+						continue;
+					}
+					p += unescaped(p, e - p);
+					if (p == e)
+						break;
+					char c = *p++;
+					if (c == '\\') {
+						escape_ = true;
+					}
+					else if (c == '"') {
+						closed = true;
+						break;
+					}
+				}
+				text_.append(b, p);
+				if (closed)
+					error_ = !end_token();
+			}
+			else {
+				while (p != e && (token_ == NUMBER ? number_char(*p) : (*p >= 'a' && *p <= 'z')))
+					++p;
+				text_.append(b, p);
+				if (p != e)
+					error_ = !end_token();
+			}
+
+			return p - b;
+		}
+
+		// one structural character or the start of a token
+		bool step(char c)
+		{
+			switch (expect_) {
+			case FIRST_KEY:
+				if (c == '}')
+					return close(JSON_OBJECT);
+				// fall through
+			case KEY:
+				if (c != '"')
+					return false;
+				break;
+			case COLON:
+				if (c != ':')
+					return false;
+				expect_ = VALUE;
+
+				return true;
+			case FIRST_ELEMENT:
+				if (c == ']')
+					return close(JSON_ARRAY);
+				// fall through
+			case VALUE:
+				if (c == '{') {
+					stack_.push_back(frame());
+					parse::make_object(stack_.back().v);
+					expect_ = FIRST_KEY;
+
+					return true;
+				}
+				if (c == '[') {
+					stack_.push_back(frame());
+					json::value a(0);
+					stack_.back().v.swap(a);
+					expect_ = FIRST_ELEMENT;
+
+					return true;
+				}
+				break;
+			case NEXT:
+				if (c == ',') {
+					expect_ = stack_.back().v.type == JSON_OBJECT ? KEY : VALUE;
+
+					return true;
+				}
+
+				return close(c == '}' ? JSON_OBJECT : c == ']' ? JSON_ARRAY : JSON_UNDEFINED);
+			}
+
+			text_.clear();
+			if (c == '"') {
+				token_ = STRING;
+				escape_ = false;
+			}
+			else if (c == '-' || (c >= '0' && c <= '9')) {
+				token_ = NUMBER;
+			}
+			else if (c == 't' || c == 'f' || c == 'n') {
+				token_ = LITERAL;
+			}
+			else {
+				return false;
+			}
+
+			return true;
+		}
+		bool close(json_element_type type)
+		{
+			if (stack_.empty() || stack_.back().v.type != type)
+				return false;
+
+			json::value v;
+			v.swap(stack_.back().v);
+			stack_.pop_back();
+
+			return add(v);
+		}
+	public:
+		// documents are kept for next() if there is no callback
+		explicit push_parser(callback f = callback())
+			: f_(f), expect_(VALUE), token_(NONE), escape_(false), error_(false)
+		{ }
+
+		// parse the next n bytes, false if the input is not JSON
+		bool feed(const char* b, size_t n)
+		{
+			const char* e = b + n;
+
+			while (b != e && !error_) {
+				if (token_ != NONE) {
+					b += lex(b, e);
+					continue;
+				}
+
+				b = parse::skip(b, e);
+				if (b == e)
+					break;
+
+				if (!step(*b)) {
+					error_ = true;
+					break;
+				}
+				if (token_ != NUMBER && token_ != LITERAL)
+					++b; // the opening quote is not part of the text
+			}
+
+			return !error_;
+		}
+		// end of input, false if a document is incomplete
+		bool finish(void)
+		{
+			if (!error_ && (token_ == NUMBER || token_ == LITERAL) && stack_.empty())
+				error_ = !end_token();
+
+			return !error_ && token_ == NONE && stack_.empty() && expect_ == VALUE;
+		}
+
+		// oldest complete document not yet taken
+		bool next(json::value& v)
+		{
+			if (done_.empty())
+				return false;
+
+			v.swap(done_.front());
+			done_.pop_front();
+
+			return true;
+		}
+
+		bool error(void) const
+		{
+			return error_;
+		}
+		// nesting depth of the document being read
+		size_t depth(void) const
+		{
+			return stack_.size();
+		}
+		// start over, keeping documents that were not taken
+		void reset(void)
+		{
+			stack_.clear();
+			expect_ = VALUE;
+			token_ = NONE;
+			text_.clear();
+			escape_ = false;
+			error_ = false;
+		}
+	};
+
+} // namespace json
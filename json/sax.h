@@ -0,0 +1,192 @@
+// sax.h - event driven JSON parsing that does not build json::value trees
+// The handler is called as tokens are read from a buffer [b, e):
+//	start_object, key, end_object, start_array, end_array,
+//	string, number, boolean, null
+// Integers that fit in 64 bits go to integer(int64_t) if the handler has one,
+// otherwise to number() like every other number. Every event returns false to
+// stop parsing. Strings refer to the buffer, or to a scratch buffer if they
+// have escapes, and are only valid during the call.
+#pragma once
+#include <string>
+#include "json.h"
+
+namespace json {
+
+	namespace sax {
+
+		// handlers can derive from this to ignore the events they do not need
+		struct handler {
+			bool start_object(void)
+			{
+				return true;
+			}
+			bool key(const json::string&)
+			{
+				return true;
+			}
+			bool end_object(void)
+			{
+				return true;
+			}
+			bool start_array(void)
+			{
+				return true;
+			}
+			bool end_array(void)
+			{
+				return true;
+			}
+			bool string(const json::string&)
+			{
+				return true;
+			}
+			bool number(double)
+			{
+				return true;
+			}
+			bool boolean(bool)
+			{
+				return true;
+			}
+			bool null(void)
+			{
+				return true;
+			}
+		};
+
+		// h.integer(i) if H has it, h.number(i) if not
+		template<class H>
+		inline auto integer(H& h, int64_t i, int) -> decltype(h.integer(i))
+		{
+			return h.integer(i);
+		}
+		template<class H>
+		inline bool integer(H& h, int64_t i, long)
+		{
+			return h.number(static_cast<double>(i));
+		}
+
+		template<class H>
+		inline bool parse_value(const char*& b, const char* e, H& h, std::string& buf);
+
+		// b is just past the opening bracket
+		template<class H>
+		inline bool parse_array(const char*& b, const char* e, H& h, std::string& buf)
+		{
+			if (!h.start_array())
+				return false;
+
+			b = parse::skip(b, e);
+			if (b != e && *b == ']') {
+				++b;
+
+				return h.end_array();
+			}
+
+			for (;;) {
+				if (!parse_value(b, e, h, buf))
+					return false;
+
+				b = parse::skip(b, e);
+				if (b == e)
+					return false;
+				if (*b == ']') {
+					++b;
+
+					return h.end_array();
+				}
+				if (*b++ != ',')
+					return false;
+			}
+		}
+		// b is just past the opening brace
+		template<class H>
+		inline bool parse_object(const char*& b, const char* e, H& h, std::string& buf)
+		{
+			json::string s;
+
+			if (!h.start_object())
+				return false;
+
+			b = parse::skip(b, e);
+			if (b != e && *b == '}') {
+				++b;
+
+				return h.end_object();
+			}
+
+			for (;;) {
+				b = parse::skip(b, e);
+				if (b == e || *b++ != '"' || !parse::read_chars(b, e, s, buf) || !h.key(s))
+					return false;
+				b = parse::skip(b, e);
+				if (b == e || *b++ != ':')
+					return false;
+
+				if (!parse_value(b, e, h, buf))
+					return false;
+
+				b = parse::skip(b, e);
+				if (b == e)
+					return false;
+				if (*b == '}') {
+					++b;
+
+					return h.end_object();
+				}
+				if (*b++ != ',')
+					return false;
+			}
+		}
+		template<class H>
+		inline bool parse_value(const char*& b, const char* e, H& h, std::string& buf)
+		{
+			b = parse::skip(b, e);
+			if (b == e)
+				return false;
+
+			switch (*b) {
+			case '"': {
+				json::string s;
+
+				return parse::read_chars(++b, e, s, buf) && h.string(s);
+			}
+			case '[':
+				return parse_array(++b, e, h, buf);
+			case '{':
+				return parse_object(++b, e, h, buf);
+			case 't':
+				return parse::read_literal(b, e, "true", 4) && h.boolean(true);
+			case 'f':
+				return parse::read_literal(b, e, "false", 5) && h.boolean(false);
+			case 'n':
+				return parse::read_literal(b, e, "null", 4) && h.null();
+			default: {
+				json::element n;
+
+				if (!parse::scan_number(b, e, n))
+					return false;
+#ifndef JSON_ONLY
+				if (n.type == JSON_INT32)
+					return integer(h, n.data.int32, 0);
+				if (n.type == JSON_INT64)
+					return integer(h, n.data.int64, 0);
+#endif
+
+				return h.number(n.data.number);
+			}
+			}
+		}
+
+		// parse one value from [b, e) and advance b past it
+		template<class H>
+		inline bool parse(const char*& b, const char* e, H& h)
+		{
+			std::string buf;
+
+			return parse_value(b, e, h, buf);
+		}
+
+	} // namespace sax
+
+} // namespace json
@@ -0,0 +1,45 @@
+// simd.h - instruction set detection shared by the SIMD code paths
+#pragma once
+#include <cstdint>
+
+#if defined(_M_X64) || defined(__x86_64__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define JSON_SSE2
+#include <emmintrin.h>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define JSON_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define JSON_TARGET_AVX2
+#endif
+
+namespace json {
+
+	// index of the lowest set bit, x must not be 0
+	inline unsigned trailing_zeros(uint64_t x)
+	{
+#if defined(__GNUC__) || defined(__clang__)
+		return __builtin_ctzll(x);
+#elif defined(_M_X64)
+		unsigned long i;
+		_BitScanForward64(&i, x);
+
+		return i;
+#else
+		unsigned long i;
+		if (static_cast<uint32_t>(x)) {
+			_BitScanForward(&i, static_cast<uint32_t>(x));
+
+			return i;
+		}
+		_BitScanForward(&i, static_cast<uint32_t>(x >> 32));
+
+		return i + 32;
+#endif
+	}
+
+} // namespace json
@@ -0,0 +1,141 @@
+// sortkey.h - byte strings that sort like the values they encode
+// memcmp on two keys, shorter first when one is a prefix of the other, gives
+// the same order as operator< on the elements:
+//	std::string a = json::sort_key(x), b = json::sort_key(y);
+//	assert ((a < b) == (x < y));
+// A key starts with a type byte, so values sort by type first, as operator<
+// does. After that:
+//	string, bytes  the bytes with 00 written as 00 FF, then 00 01
+//	number         big endian with the sign bit flipped, or every bit if
+//	               negative. -0 is written as 0 because -0 == 0.
+//	int32, int64, date  big endian with the sign bit flipped, 4 bytes for int32
+//	array          the keys of the elements, then 00
+//	object         01, key, value for every member in key order, then 00
+//	true, false, null, undefined  only the type byte
+// Type bytes start at 01, so a container that ends first sorts first.
+// NaN has no place in the order of operator<. It sorts after every other number.
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include "json.h"
+
+namespace json {
+
+	namespace sortkey {
+		enum { END = 0, MEMBER = 1 };
+
+		inline void put_type(buffer& k, json_element_type t)
+		{
+			k.put(static_cast<char>(t + 1));
+		}
+		inline void put_uint64(buffer& k, uint64_t u)
+		{
+			char* p = k.reserve(8);
+			for (int i = 7; i >= 0; --i, u >>= 8)
+				p[i] = static_cast<char>(u & 0xFF);
+			k.advance(8);
+		}
+		inline void put_int32(buffer& k, int32_t i)
+		{
+			uint32_t u = static_cast<uint32_t>(i) ^ (uint32_t(1) << 31);
+			char* p = k.reserve(4);
+			for (int j = 3; j >= 0; --j, u >>= 8)
+				p[j] = static_cast<char>(u & 0xFF);
+			k.advance(4);
+		}
+		inline void put_int64(buffer& k, int64_t i)
+		{
+			put_uint64(k, static_cast<uint64_t>(i) ^ (uint64_t(1) << 63));
+		}
+		inline void put_double(buffer& k, double x)
+		{
+			uint64_t u;
+
+			if (x == 0)
+				x = 0; // -0
+			else if (x != x)
+				x = std::numeric_limits<double>::quiet_NaN();
+			memcpy(&u, &x, sizeof(x));
+
+			put_uint64(k, u >> 63 ? ~u : u | (uint64_t(1) << 63));
+		}
+		// runs without a 00 are copied as is
+		inline void put_bytes(buffer& k, const char* s, size_t n)
+		{
+			const char* e = s + n;
+
+			while (s != e) {
+				const char* z = static_cast<const char*>(memchr(s, 0, e - s));
+				if (!z) {
+					k.append(s, e - s);
+					break;
+				}
+				k.append(s, z - s);
+				k.append("\0\xFF", 2);
+				s = z + 1;
+			}
+			k.append("\0\x01", 2);
+		}
+	}
+
+	// append the key of e to k
+	inline void sort_key(buffer& k, const json::element& e)
+	{
+		sortkey::put_type(k, e.type);
+
+		switch (e.type) {
+		case JSON_STRING:
+			sortkey::put_bytes(k, e.str().data, e.str().size);
+			break;
+		case JSON_NUMBER:
+			sortkey::put_double(k, e.data.number);
+			break;
+		case JSON_OBJECT:
+			for (json::object::const_iterator i = e.data.object->begin(); i != e.data.object->end(); ++i) {
+				k.put(sortkey::MEMBER);
+				sortkey::put_bytes(k, i->first.data(), i->first.size());
+				sort_key(k, i->second);
+			}
+			k.put(sortkey::END);
+			break;
+		case JSON_ARRAY:
+			if (e.flags & JSON_FLAG_TYPED) {
+				for (size_t i = 0; i < e.data.array.size; ++i)
+					sort_key(k, e.at(i));
+			}
+			else {
+				for (size_t i = 0; i < e.data.array.size; ++i)
+					sort_key(k, e.data.array.element[i]);
+			}
+			k.put(sortkey::END);
+			break;
+#ifndef JSON_ONLY
+		case JSON_BYTE:
+			sortkey::put_bytes(k, reinterpret_cast<const char*>(e.data.byte.data), e.data.byte.size);
+			break;
+		case JSON_INT32:
+			sortkey::put_int32(k, e.data.int32);
+			break;
+		case JSON_INT64:
+			sortkey::put_int64(k, e.data.int64);
+			break;
+		case JSON_DATE:
+			sortkey::put_int64(k, e.data.date);
+			break;
+#endif
+		default: // true, false, null and undefined
+			break;
+		}
+	}
+	inline std::string sort_key(const json::element& e)
+	{
+		buffer k(64);
+
+		sort_key(k, e);
+
+		return k.str();
+	}
+
+} // namespace json
@@ -0,0 +1,429 @@
+// structural.h - two stage JSON parser driven by an index of structural characters
+// Stage 1 classifies 64 bytes at a time (AVX2 or SSE2, picked at runtime, with a
+// scalar fallback) and records the offsets of {}[],: opening quotes and the first
+// character of every number or literal. Stage 2 walks the offsets to build values,
+// taking the extent of every string and scalar from them, so strings without
+// escapes are not scanned again.
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "json.h"
+#include "simd.h"
+
+namespace json {
+
+	namespace structural {
+
+		// bit i is set if byte i of a 64 byte block is in the class
+		struct block {
+			uint64_t quote;
+			uint64_t backslash;
+			uint64_t op; // {}[],:
+			uint64_t space;
+		};
+
+		// bit i of the result is the xor of bits 0 through i
+		inline uint64_t prefix_xor(uint64_t x)
+		{
+			x ^= x << 1;
+			x ^= x << 2;
+			x ^= x << 4;
+			x ^= x << 8;
+			x ^= x << 16;
+			x ^= x << 32;
+
+			return x;
+		}
+
+		inline void classify_scalar(const char* p, block& m)
+		{
+			m.quote = m.backslash = m.op = m.space = 0;
+
+			for (unsigned i = 0; i < 64; ++i) {
+				uint64_t bit = uint64_t(1) << i;
+
+				switch (p[i]) {
+				case '"':  m.quote |= bit; break;
+				case '\\': m.backslash |= bit; break;
+				case '{': case '}': case '[': case ']': case ',': case ':':
+					m.op |= bit;
+					break;
+				case ' ': case '\t': case '\n': case '\r':
+					m.space |= bit;
+					break;
+				}
+			}
+		}
+
+#ifdef JSON_SSE2
+		inline void classify_sse2(const char* p, block& m)
+		{
+			m.quote = m.backslash = m.op = m.space = 0;
+
+			for (unsigned i = 0; i < 64; i += 16) {
+				__m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+				// '[' | 0x20 == '{' and ']' | 0x20 == '}'
+				__m128i c20 = _mm_or_si128(c, _mm_set1_epi8(0x20));
+				__m128i op = _mm_or_si128(
+					_mm_or_si128(_mm_cmpeq_epi8(c20, _mm_set1_epi8('{')), _mm_cmpeq_epi8(c20, _mm_set1_epi8('}'))),
+					_mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8(',')), _mm_cmpeq_epi8(c, _mm_set1_epi8(':'))));
+				__m128i space = _mm_or_si128(
+					_mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(c, _mm_set1_epi8('\t'))),
+					_mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(c, _mm_set1_epi8('\r'))));
+
+				m.quote |= uint64_t(static_cast<uint16_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8('"'))))) << i;
+				m.backslash |= uint64_t(static_cast<uint16_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8('\\'))))) << i;
+				m.op |= uint64_t(static_cast<uint16_t>(_mm_movemask_epi8(op))) << i;
+				m.space |= uint64_t(static_cast<uint16_t>(_mm_movemask_epi8(space))) << i;
+			}
+		}
+
+		JSON_TARGET_AVX2
+		inline void classify_avx2(const char* p, block& m)
+		{
+			m.quote = m.backslash = m.op = m.space = 0;
+
+			for (unsigned i = 0; i < 64; i += 32) {
+				__m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+				__m256i c20 = _mm256_or_si256(c, _mm256_set1_epi8(0x20));
+				__m256i op = _mm256_or_si256(
+					_mm256_or_si256(_mm256_cmpeq_epi8(c20, _mm256_set1_epi8('{')), _mm256_cmpeq_epi8(c20, _mm256_set1_epi8('}'))),
+					_mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8(',')), _mm256_cmpeq_epi8(c, _mm256_set1_epi8(':'))));
+				__m256i space = _mm256_or_si256(
+					_mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(c, _mm256_set1_epi8('\t'))),
+					_mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('\n')), _mm256_cmpeq_epi8(c, _mm256_set1_epi8('\r'))));
+
+				m.quote |= uint64_t(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('"'))))) << i;
+				m.backslash |= uint64_t(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('\\'))))) << i;
+				m.op |= uint64_t(static_cast<uint32_t>(_mm256_movemask_epi8(op))) << i;
+				m.space |= uint64_t(static_cast<uint32_t>(_mm256_movemask_epi8(space))) << i;
+			}
+		}
+
+		inline bool has_avx2(void)
+		{
+#if defined(__GNUC__) || defined(__clang__)
+			return __builtin_cpu_supports("avx2") != 0;
+#elif defined(_MSC_VER)
+			int info[4];
+
+			__cpuid(info, 0);
+			if (info[0] < 7)
+				return false;
+			__cpuid(info, 1);
+			if (!(info[2] & (1 << 27)) || !(info[2] & (1 << 28))) // OSXSAVE and AVX
+				return false;
+			if ((_xgetbv(0) & 6) != 6) // OS saves ymm registers
+				return false;
+			__cpuidex(info, 7, 0);
+
+			return (info[1] & (1 << 5)) != 0;
+#else
+			return false;
+#endif
+		}
+#endif // JSON_SSE2
+
+		typedef void (*classify_function)(const char*, block&);
+
+		inline classify_function classify(void)
+		{
+#ifdef JSON_SSE2
+			static const classify_function f = has_avx2() ? classify_avx2 : classify_sse2;
+#else
+			static const classify_function f = classify_scalar;
+#endif
+			return f;
+		}
+
+		// Stage 1: offsets of structural characters in [b, b + n)
+		// Returns false if a string is not terminated or n does not fit the offsets.
+		inline bool index(const char* b, size_t n, std::vector<uint32_t>& idx, classify_function f = classify())
+		{
+			idx.clear();
+			if (n >= UINT32_MAX)
+				return false;
+
+			idx.reserve(n/8);
+
+			uint64_t prev_escape = 0;   // last byte of previous block was an unescaped backslash
+			uint64_t prev_string = 0;   // all ones if previous block ended inside a string
+			uint64_t prev_scalar = 0;   // last byte of previous block was part of a scalar
+
+			for (size_t i = 0; i < n; i += 64) {
+				block m;
+				if (n - i >= 64) {
+					f(b + i, m);
+				}
+				else {
+					char pad[64];
+					memset(pad, ' ', sizeof(pad));
+					memcpy(pad, b + i, n - i);
+					f(pad, m);
+				}
+
+				// characters following an odd number of backslashes
+				uint64_t escaped = prev_escape;
+				prev_escape = 0;
+				for (uint64_t bs = m.backslash & ~escaped; bs; bs &= bs - 1) {
+					unsigned j = trailing_zeros(bs);
+					uint64_t bit = uint64_t(1) << j;
+					if (escaped & bit)
+						continue;
+					if (j == 63)
+						prev_escape = 1;
+					else
+						escaped |= bit << 1;
+				}
+
+				uint64_t quote = m.quote & ~escaped;
+				uint64_t string = prefix_xor(quote) ^ prev_string; // includes opening quote
+				prev_string = static_cast<uint64_t>(static_cast<int64_t>(string) >> 63);
+
+				uint64_t scalar = ~(m.op | m.space | quote) & ~string;
+				uint64_t start = scalar & ~((scalar << 1) | prev_scalar);
+				prev_scalar = scalar >> 63;
+
+				uint64_t s = (m.op & ~string) | (quote & string) | start;
+				if (n - i < 64)
+					s &= (uint64_t(1) << (n - i)) - 1;
+
+				for (; s; s &= s - 1)
+					idx.push_back(static_cast<uint32_t>(i + trailing_zeros(s)));
+			}
+
+			return prev_string == 0;
+		}
+
+		// Stage 2: build values from the index
+		// The parser can be reused to avoid reallocating the index.
+		class parser {
+			const char* b_;
+			const char* e_;
+			json::arena* a_;
+			std::vector<uint32_t> idx_;
+			size_t i_; // next index
+
+			// character at the next index
+			char peek(void) const
+			{
+				return i_ < idx_.size() ? b_[idx_[i_]] : 0;
+			}
+			// end of the token at index i, without the whitespace before the next one
+			const char* token_end(size_t i) const
+			{
+				const char* b = b_ + idx_[i] + 1;
+				const char* p = i + 1 < idx_.size() ? b_ + idx_[i + 1] : e_;
+
+				while (p != b && (p[-1] == ' ' || p[-1] == '\t' || p[-1] == '\n' || p[-1] == '\r'))
+					--p;
+
+				return p;
+			}
+			// The string at the next index. Everything after its closing quote
+			// starts a token, so the quote is the last byte of the token.
+			// s refers to the buffer, or to buf if the string has escapes.
+			bool read_chars(json::string& s, std::string& buf)
+			{
+				const char* b = b_ + idx_[i_] + 1;
+				const char* q = token_end(i_++) - 1;
+
+				if (q < b || *q != '"')
+					return false;
+				if (!memchr(b, '\\', q - b)) {
+					s = string_(q - b, b);
+					buf.clear();
+
+					return true;
+				}
+
+				return parse::read_chars(b, q + 1, s, buf) && b == q + 1;
+			}
+			bool read_string(json::value& v)
+			{
+				std::string buf;
+				json::string s;
+
+				if (!read_chars(s, buf))
+					return false;
+
+				if (buf.empty())
+					v.view(s);
+				else if (s.size <= inline_capacity)
+					v = s;
+				else if (a_)
+					v.view(string_(s.size, a_->copy(s.data, s.size)));
+				else
+					v = s;
+
+				return true;
+			}
+			// number or literal, which must fill its token
+			bool read_scalar(json::value& v)
+			{
+				const char* b = b_ + idx_[i_];
+				const char* e = token_end(i_++);
+
+				switch (*b) {
+				case 't':
+					if (e - b != 4 || memcmp(b, "true", 4))
+						return false;
+					v = true;
+					break;
+				case 'f':
+					if (e - b != 5 || memcmp(b, "false", 5))
+						return false;
+					v = false;
+					break;
+				case 'n': {
+					if (e - b != 4 || memcmp(b, "null", 4))
+						return false;
+					json::value n;
+					v.swap(n);
+					v.type = JSON_NULL;
+					break;
+				}
+				default:
+					return parse::read_number(b, e, v) && b == e;
+				}
+
+				return true;
+			}
+			bool read_array(json::value& v)
+			{
+				json::array x = array_(0, 0); // arena storage
+				size_t capacity = 0;
+
+				if (a_) {
+					v.view(x);
+				}
+				else {
+					json::value h(0);
+					v.swap(h);
+				}
+
+				++i_;
+				if (peek() == ']') {
+					++i_;
+
+					return true;
+				}
+
+				for (;;) {
+					json::value* w;
+					if (a_) {
+						w = &parse::push_back(*a_, x, capacity);
+					}
+					else {
+						w = &v.emplace_back();
+					}
+					if (!read_value(*w))
+						return false;
+
+					char c = peek();
+					++i_;
+					if (c == ']') {
+						if (a_)
+							v.view(x);
+
+						return true;
+					}
+					if (c != ',')
+						return false;
+				}
+			}
+			template<class O>
+			bool read_members(O& o)
+			{
+				std::string buf;
+				json::string key;
+
+				++i_;
+				if (peek() == '}') {
+					++i_;
+
+					return true;
+				}
+
+				for (;;) {
+					if (peek() != '"' || !read_chars(key, buf) || peek() != ':')
+						return false;
+					++i_;
+
+					std::pair<typename O::iterator,bool> j = o.insert(typename O::value_type(typename O::key_type(key.data, key.size), json::value()));
+					json::value dup;
+					if (!read_value(j.second ? j.first->second : dup))
+						return false;
+
+					char c = peek();
+					++i_;
+					if (c == '}')
+						return true;
+					if (c != ',')
+						return false;
+				}
+			}
+			bool read_value(json::value& v)
+			{
+				if (i_ == idx_.size())
+					return false;
+
+				switch (peek()) {
+				case '"':
+					return read_string(v);
+				case '[':
+					return read_array(v);
+				case '{':
+					return read_members(parse::make_object(v, a_));
+				case ']': case '}': case ',': case ':':
+					return false;
+				default:
+					return read_scalar(v);
+				}
+			}
+
+		public:
+			parser()
+				: b_(0), e_(0), a_(0), i_(0)
+			{ }
+
+			// strings without escapes refer to [b, b + n)
+			// other storage comes from the arena if there is one
+			bool parse(const char* b, size_t n, json::value& v, json::arena* a = 0)
+			{
+				b_ = b;
+				e_ = b + n;
+				a_ = a;
+				i_ = 0;
+
+				if (!index(b, n, idx_))
+					return false;
+
+				return read_value(v) && i_ == idx_.size();
+			}
+			// O is json::object, json::flat_object or json::interned_object,
+			// for the top level only as in parse::read_members
+			template<class O>
+			bool parse(const char* b, size_t n, O& o, json::arena* a = 0)
+			{
+				b_ = b;
+				e_ = b + n;
+				a_ = a;
+				i_ = 0;
+
+				if (!index(b, n, idx_) || peek() != '{')
+					return false;
+
+				return read_members(o) && i_ == idx_.size();
+			}
+
+			const std::vector<uint32_t>& structurals(void) const
+			{
+				return idx_;
+			}
+		};
+
+	} // namespace structural
+
+} // namespace json
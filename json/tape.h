@@ -0,0 +1,589 @@
+// tape.h - immutable document stored as one array of 64-bit words and one string buffer
+// Every value is a word with a type tag in the high byte and a payload below it:
+//	{ [      index just past the matching close, member/element count in bits 32-55
+//	} ]      index of the matching open
+//	"        offset of a uint32_t length, the bytes and a null in the string buffer
+//	i        int32 in the low 32 bits
+//	d l T    double, int64 or date in the following word
+//	b        offset of raw bytes in the string buffer, laid out like strings
+//	t f n u  true, false, null, undefined
+// Object members are a string word for the key followed by the value.
+// Walking the tape is sequential and a document costs two allocations, not one per node.
+#pragma once
+#include <string>
+#include <vector>
+#include "json.h"
+
+namespace json {
+
+	class tape {
+		std::vector<uint64_t> tape_;
+		std::vector<char> strings_;
+
+		static const uint64_t payload_mask = (uint64_t(1) << 56) - 1;
+
+		static uint64_t word(char tag, uint64_t payload = 0)
+		{
+			return (uint64_t(static_cast<unsigned char>(tag)) << 56) | (payload & payload_mask);
+		}
+		char tag(size_t i) const
+		{
+			return static_cast<char>(tape_[i] >> 56);
+		}
+		uint64_t payload(size_t i) const
+		{
+			return tape_[i] & payload_mask;
+		}
+		// index just past the value at i
+		size_t skip(size_t i) const
+		{
+			switch (tag(i)) {
+			case '{': case '[':
+				return static_cast<uint32_t>(payload(i));
+			case 'd': case 'l': case 'T':
+				return i + 2;
+			}
+
+			return i + 1;
+		}
+		json::string string_at(size_t i) const
+		{
+			const char* p = &strings_[payload(i)];
+			uint32_t n;
+			memcpy(&n, p, sizeof(n));
+
+			return string_(n, p + sizeof(n));
+		}
+
+		void push(char tag, uint64_t payload = 0)
+		{
+			tape_.push_back(word(tag, payload));
+		}
+		void push_bits(char tag, const void* x)
+		{
+			uint64_t u;
+			memcpy(&u, x, sizeof(u));
+			tape_.push_back(word(tag));
+			tape_.push_back(u);
+		}
+		void push_string(char tag, const char* s, size_t n)
+		{
+			ensure (n <= UINT32_MAX);
+			uint32_t n32 = static_cast<uint32_t>(n);
+			size_t off = strings_.size();
+
+			strings_.resize(off + sizeof(n32) + n + 1);
+			memcpy(&strings_[off], &n32, sizeof(n32));
+			if (n)
+				memcpy(&strings_[off + sizeof(n32)], s, n);
+			strings_[off + sizeof(n32) + n] = 0;
+			push(tag, off);
+		}
+		size_t open(char c)
+		{
+			push(c);
+
+			return tape_.size() - 1;
+		}
+		void close(char c, size_t i, size_t count)
+		{
+			ensure (tape_.size() < UINT32_MAX);
+			if (count > 0xFFFFFF)
+				count = 0xFFFFFF; // size() counts past this
+			push(c, i);
+			tape_[i] = word(tag(i), (uint64_t(count) << 32) | tape_.size());
+		}
+
+		// recursive descent straight onto the tape
+		bool read_value(const char*& b, const char* e, std::string& buf)
+		{
+			b = parse::skip(b, e);
+			if (b == e)
+				return false;
+
+			json::string s;
+			switch (*b) {
+			case '"':
+				if (!parse::read_chars(++b, e, s, buf))
+					return false;
+				push_string('"', s.data, s.size);
+
+				return true;
+			case '[': {
+				size_t i = open('['), n = 0;
+				b = parse::skip(++b, e);
+				if (b != e && *b == ']') {
+					++b;
+					close(']', i, 0);
+
+					return true;
+				}
+				for (;; ++n) {
+					if (!read_value(b, e, buf))
+						return false;
+					b = parse::skip(b, e);
+					if (b == e)
+						return false;
+					if (*b == ']')
+						break;
+					if (*b++ != ',')
+						return false;
+				}
+				++b;
+				close(']', i, n + 1);
+
+				return true;
+			}
+			case '{': {
+				size_t i = open('{'), n = 0;
+				b = parse::skip(++b, e);
+				if (b != e && *b == '}') {
+					++b;
+					close('}', i, 0);
+
+					return true;
+				}
+				for (;; ++n) {
+					b = parse::skip(b, e);
+					if (b == e || *b++ != '"' || !parse::read_chars(b, e, s, buf))
+						return false;
+					push_string('"', s.data, s.size);
+					b = parse::skip(b, e);
+					if (b == e || *b++ != ':' || !read_value(b, e, buf))
+						return false;
+					b = parse::skip(b, e);
+					if (b == e)
+						return false;
+					if (*b == '}')
+						break;
+					if (*b++ != ',')
+						return false;
+				}
+				++b;
+				close('}', i, n + 1);
+
+				return true;
+			}
+			case 't':
+				if (!parse::read_literal(b, e, "true", 4))
+					return false;
+				push('t');
+
+				return true;
+			case 'f':
+				if (!parse::read_literal(b, e, "false", 5))
+					return false;
+				push('f');
+
+				return true;
+			case 'n':
+				if (!parse::read_literal(b, e, "null", 4))
+					return false;
+				push('n');
+
+				return true;
+			}
+
+			json::element x;
+			if (!parse::scan_number(b, e, x))
+				return false;
+			append(x);
+
+			return true;
+		}
+
+		void append(const json::element& e)
+		{
+			switch (e.type) {
+			case JSON_STRING:
+				push_string('"', e.str().data, e.str().size);
+				break;
+			case JSON_NUMBER:
+				push_bits('d', &e.data.number);
+				break;
+			case JSON_OBJECT: {
+				size_t i = open('{');
+				const json::object& o = *e.data.object;
+				for (json::object::const_iterator m = o.begin(); m != o.end(); ++m) {
+					push_string('"', m->first.data(), m->first.size());
+					append(m->second);
+				}
+				close('}', i, o.size());
+				break;
+			}
+			case JSON_ARRAY: {
+				size_t i = open('[');
+				for (size_t j = 0; j < e.data.array.size; ++j)
+					append(e.at(j));
+				close(']', i, e.data.array.size);
+				break;
+			}
+			case JSON_TRUE:
+				push('t');
+				break;
+			case JSON_FALSE:
+				push('f');
+				break;
+			case JSON_NULL:
+				push('n');
+				break;
+#ifndef JSON_ONLY
+			case JSON_BYTE:
+				push_string('b', reinterpret_cast<const char*>(e.data.byte.data), e.data.byte.size);
+				break;
+			case JSON_INT32:
+				push('i', static_cast<uint32_t>(e.data.int32));
+				break;
+			case JSON_INT64:
+				push_bits('l', &e.data.int64);
+				break;
+			case JSON_DATE: {
+				int64_t t = e.data.date;
+				push_bits('T', &t);
+				break;
+			}
+#endif
+			default:
+				push('u');
+			}
+		}
+	public:
+		class ref;
+		class iterator;
+
+		tape()
+		{ }
+		explicit tape(const json::element& e)
+		{
+			assign(e);
+		}
+
+		void clear(void)
+		{
+			tape_.clear();
+			strings_.clear();
+		}
+		// copy of a value tree
+		void assign(const json::element& e)
+		{
+			clear();
+			append(e);
+		}
+		// one value from [b, b + n), empty if it is not JSON
+		bool parse(const char* b, size_t n)
+		{
+			std::string buf;
+			const char* e = b + n;
+
+			clear();
+			tape_.reserve(n/4 + 2);
+			strings_.reserve(n/2 + 8);
+			if (!read_value(b, e, buf) || parse::skip(b, e) != e) {
+				clear();
+
+				return false;
+			}
+
+			return true;
+		}
+
+		bool empty(void) const
+		{
+			return tape_.empty();
+		}
+		// words on the tape and bytes in the string buffer
+		size_t words(void) const
+		{
+			return tape_.size();
+		}
+		size_t bytes(void) const
+		{
+			return strings_.size();
+		}
+
+		inline ref root(void) const;
+	};
+
+	// read only handle to a value on a tape, the tape must outlive it
+	class tape::ref {
+		friend class tape;
+		friend class tape::iterator;
+
+		const tape* t_;
+		size_t i_;
+
+		ref(const tape* t, size_t i)
+			: t_(t), i_(i)
+		{ }
+		template<class T>
+		T bits(void) const
+		{
+			T x;
+			memcpy(&x, &t_->tape_[i_ + 1], sizeof(x));
+
+			return x;
+		}
+	public:
+		ref()
+			: t_(0), i_(0)
+		{ }
+
+		bool valid(void) const
+		{
+			return t_ != 0;
+		}
+		json_element_type type(void) const
+		{
+			switch (t_ ? t_->tag(i_) : 'u') {
+			case '"': return JSON_STRING;
+			case 'd': return JSON_NUMBER;
+			case '{': return JSON_OBJECT;
+			case '[': return JSON_ARRAY;
+			case 't': return JSON_TRUE;
+			case 'f': return JSON_FALSE;
+			case 'n': return JSON_NULL;
+#ifndef JSON_ONLY
+			case 'b': return JSON_BYTE;
+			case 'i': return JSON_INT32;
+			case 'l': return JSON_INT64;
+			case 'T': return JSON_DATE;
+#endif
+			}
+
+			return JSON_UNDEFINED;
+		}
+
+		// elements or members
+		inline size_t size(void) const;
+		inline iterator begin(void) const;
+		inline iterator end(void) const;
+
+		// array element, invalid if out of range
+		inline ref operator[](size_t i) const;
+		ref operator[](int i) const // [0] is not a null key
+		{
+			return operator[](static_cast<size_t>(i));
+		}
+		// object member, invalid if there is no such key
+		inline ref operator[](const char* key) const;
+		inline ref find(const char* key, size_t n) const;
+
+		// not null terminated for bytes, JSON_STRING and JSON_BYTE only
+		json::string string(void) const
+		{
+			return t_->string_at(i_);
+		}
+		// any kind of number as a double
+		double number(void) const
+		{
+			switch (t_->tag(i_)) {
+			case 'd': return bits<double>();
+			case 'i': return static_cast<int32_t>(t_->payload(i_));
+			case 'l': return static_cast<double>(bits<int64_t>());
+			}
+
+			return 0;
+		}
+#ifndef JSON_ONLY
+		int32_t int32(void) const
+		{
+			return static_cast<int32_t>(t_->payload(i_));
+		}
+		int64_t int64(void) const
+		{
+			return bits<int64_t>();
+		}
+		time_t date(void) const
+		{
+			return static_cast<time_t>(bits<int64_t>());
+		}
+#endif
+
+		bool operator==(const char* s) const
+		{
+			return type() == JSON_STRING && string() == s;
+		}
+		bool operator==(double x) const
+		{
+			return type() == JSON_NUMBER && bits<double>() == x;
+		}
+		bool operator==(bool b) const
+		{
+			return type() == (b ? JSON_TRUE : JSON_FALSE);
+		}
+
+		// copy into a value tree
+		inline void get(json::value& v) const;
+	};
+
+	// array elements, or object members with their keys
+	class tape::iterator {
+		friend class tape::ref;
+
+		const tape* t_;
+		size_t i_;   // value
+		bool object_;
+
+		iterator(const tape* t, size_t i, bool object)
+			: t_(t), i_(i), object_(object)
+		{ }
+	public:
+		iterator()
+			: t_(0), i_(0), object_(false)
+		{ }
+
+		tape::ref operator*(void) const
+		{
+			return tape::ref(t_, i_);
+		}
+		// member key, objects only
+		json::string key(void) const
+		{
+			return t_->string_at(i_ - 1);
+		}
+		iterator& operator++(void)
+		{
+			i_ = t_->skip(i_);
+			if (object_)
+				++i_; // past the next key
+			return *this;
+		}
+		iterator operator++(int)
+		{
+			iterator i(*this);
+			operator++();
+
+			return i;
+		}
+		bool operator==(const iterator& i) const
+		{
+			return i_ == i.i_;
+		}
+		bool operator!=(const iterator& i) const
+		{
+			return i_ != i.i_;
+		}
+	};
+
+	inline tape::ref tape::root(void) const
+	{
+		return tape_.empty() ? ref() : ref(this, 0);
+	}
+
+	inline tape::iterator tape::ref::begin(void) const
+	{
+		bool object = type() == JSON_OBJECT;
+
+		return iterator(t_, object || type() == JSON_ARRAY ? i_ + 1 + object : i_, object);
+	}
+	inline tape::iterator tape::ref::end(void) const
+	{
+		bool object = type() == JSON_OBJECT;
+
+		// the closing bracket, plus one to line up with the key skip for objects
+		return iterator(t_, object || type() == JSON_ARRAY ? t_->skip(i_) - 1 + object : i_, object);
+	}
+	inline tape::ref tape::ref::operator[](size_t n) const
+	{
+		if (type() != JSON_ARRAY)
+			return ref();
+
+		for (iterator i = begin(); i != end(); ++i, --n)
+			if (n == 0)
+				return *i;
+
+		return ref();
+	}
+	inline tape::ref tape::ref::find(const char* key, size_t n) const
+	{
+		if (type() != JSON_OBJECT)
+			return ref();
+
+		for (iterator i = begin(); i != end(); ++i) {
+			json::string k = i.key();
+			if (k.size == n && (n == 0 || memcmp(k.data, key, n) == 0))
+				return *i;
+		}
+
+		return ref();
+	}
+	inline tape::ref tape::ref::operator[](const char* key) const
+	{
+		return find(key, strlen(key));
+	}
+	inline size_t tape::ref::size(void) const
+	{
+		if (type() != JSON_ARRAY && type() != JSON_OBJECT)
+			return 0;
+
+		size_t n = static_cast<size_t>(t_->payload(i_) >> 32);
+		if (n == 0xFFFFFF) {
+			n = 0;
+			for (iterator i = begin(); i != end(); ++i)
+				++n;
+		}
+
+		return n;
+	}
+	inline void tape::ref::get(json::value& v) const
+	{
+		json::value w;
+
+		switch (type()) {
+		case JSON_STRING:
+			w = string();
+			break;
+		case JSON_NUMBER:
+			w = bits<double>();
+			break;
+		case JSON_OBJECT: {
+			json::object& o = parse::make_object(w);
+			for (iterator i = begin(); i != end(); ++i) {
+				json::string k = i.key();
+				std::pair<json::object::iterator,bool> m = o.insert(json::pair(std::string(k.data, k.size), json::value()));
+				if (m.second)
+					(*i).get(m.first->second);
+			}
+			break;
+		}
+		case JSON_ARRAY: {
+			json::value a(0);
+			w.swap(a);
+			w.reserve(size());
+			for (iterator i = begin(); i != end(); ++i)
+				(*i).get(w.emplace_back());
+			break;
+		}
+		case JSON_TRUE:
+			w = true;
+			break;
+		case JSON_FALSE:
+			w = false;
+			break;
+		case JSON_NULL:
+			w.type = JSON_NULL;
+			break;
+#ifndef JSON_ONLY
+		case JSON_BYTE: {
+			json::string s = string();
+			w = byte_(s.size, reinterpret_cast<const uint8_t*>(s.data));
+			break;
+		}
+		case JSON_INT32:
+			w = json::int32_(int32());
+			break;
+		case JSON_INT64:
+			w = json::int64_(int64());
+			break;
+		case JSON_DATE:
+			w = date();
+			break;
+#endif
+		default:
+			break;
+		}
+
+		v.swap(w);
+	}
+
+} // namespace json
@@ -0,0 +1,1451 @@
+// tjson.cpp - test json
+#include <cassert>
+#include <clocale>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <unordered_set>
+#include "json.h"
+#include "structural.h"
+#include "sax.h"
+#include "writer.h"
+#include "ndjson.h"
+#include "lazy.h"
+#include "push.h"
+#include "tape.h"
+#include "intern.h"
+#include "compact.h"
+#include "hash.h"
+#include "sortkey.h"
+
+using json::string_;
+
+void test_parse_buffer(void)
+{
+	const char* s = "{\"a\": [1.5, \"xyz\", true, null], \"b\": {\"c\": \"q\\\"\\u00e9\"}, \"d\": false}";
+	const char* b = s;
+	json::object o;
+
+	bool ok = json::parse::read_object(b, s + strlen(s), o);
+	assert (ok);
+	assert (b == s + strlen(s));
+	assert (o.size() == 3);
+
+	const json::value& a = o["a"];
+	assert (a.type == JSON_ARRAY && a.data.array.size == 4);
+	assert (a[0] == 1.5);
+	assert (a[1] == "xyz");
+	assert (a[1].flags & JSON_FLAG_VIEW); // no copy
+	assert (a[1].data.string.data == strstr(s, "xyz"));
+	assert (a[2] == true);
+	assert (a[3].type == JSON_NULL);
+
+	const json::value& c = o["b"]["c"];
+	assert (c == "q\"\xc3\xa9");
+	assert (!(c.flags & JSON_FLAG_VIEW)); // unescaped copy
+
+	json::value v(a[1]); // copies own their storage
+	assert (!(v.flags & JSON_FLAG_VIEW));
+	assert (v == a[1]);
+
+	json::value q(o["b"]); // deep copy of object
+	assert (q.data.object != o["b"].data.object);
+	assert (q == o["b"]);
+
+	const char* bad = "[1, 2";
+	b = bad;
+	json::value w;
+	ok = json::parse::read_value(b, bad + strlen(bad), w);
+	assert (!ok);
+}
+
+void test_parse_stream(void)
+{
+	std::istringstream is("{\"hello\": \"world\", \"n\": 1.23}");
+	json::object o;
+
+	is >> o;
+	assert (o["hello"] == "world");
+	assert (o["n"] == 1.23);
+}
+
+void test_structural(void)
+{
+	// backslashes and quotes straddling 64 byte blocks
+	std::string s("{\"k\": [\"");
+	s.append(54, 'x');
+	s += "\\\\\\\"y\", 12, -3.5e2 , true,{\"n\":null}], \"\\u0041\" : \"\"}";
+
+	json::object o, p;
+	const char* b = s.data();
+	bool ok = json::parse::read_object(b, s.data() + s.size(), o);
+	assert (ok);
+
+	json::structural::parser sp;
+	ok = sp.parse(s.data(), s.size(), p);
+	assert (ok);
+	assert (p.size() == 2);
+	assert (p["k"][0] == o["k"][0]);
+	assert (p["k"][0].data.string.size == 54 + 3);
+	assert (p["k"][1] == json::int32_(12));
+	assert (p["k"][2] == -350.);
+	assert (p["k"][3] == true);
+	assert (p["A"] == "");
+
+	std::vector<uint32_t> idx;
+	json::structural::index(s.data(), s.size(), idx, json::structural::classify_scalar);
+	assert (idx == sp.structurals());
+
+	json::value v;
+	ok = sp.parse("[1, 2] 3", 8, v);
+	assert (!ok);
+	ok = sp.parse("[\"abc]", 6, v);
+	assert (!ok);
+	ok = sp.parse(" [ ] ", 5, v);
+	assert (ok && v.type == JSON_ARRAY && v.data.array.size == 0);
+
+	// strings and scalars must fill their tokens
+	const char* bad[] = { "[\"a\"x]", "[\"a\" \"b\"]", "[tru]", "[truex]", "[nul ]", "[1.5.2]", "[1 2]", "{\"a\" x: 1}", "[\"a\\\"]" };
+	for (size_t i = 0; i < sizeof(bad)/sizeof(bad[0]); ++i) {
+		ok = sp.parse(bad[i], strlen(bad[i]), v);
+		assert (!ok);
+	}
+	const char* good = "[ \"a\\\"b\" , \"\" ,false\t,null ,-0 , 1e3]";
+	ok = sp.parse(good, strlen(good), v);
+	assert (ok && v[0] == "a\"b" && v[1] == "" && v[2] == false && v[3].type == JSON_NULL && v[5] == 1000.);
+}
+
+void test_arena(void)
+{
+	const char* s = "{\"a\": [1, [2, \"x\\ty\"], {\"long key that does not fit inline\": true}], \"b\": \"z\"}";
+	json::document d;
+
+	bool ok = d.parse(s, strlen(s));
+	assert (ok);
+	assert (d.arena().size() > 0);
+
+	const json::value& r = d.root();
+	assert (r.type == JSON_OBJECT && (r.flags & JSON_FLAG_VIEW));
+	assert (r.data.object->get_allocator().arena == &d.arena());
+
+	const json::object& o = *r.data.object;
+	const json::value& a = o.find("a")->second;
+	assert (a.data.array.size == 3 && (a.flags & JSON_FLAG_VIEW));
+	assert (a[0] == json::int32_(1));
+	assert (a[1][1] == "x\ty");
+	assert (a[2].data.object->find("long key that does not fit inline")->second == true);
+	assert (o.find("b")->second == "z");
+
+	// copies go to the heap
+	json::value c(a);
+	assert (!(c.flags & JSON_FLAG_VIEW));
+	assert (c[2].data.object->get_allocator().arena == 0);
+
+	ok = d.parse("[true]", 6);
+	assert (ok && d.root().data.array.size == 1);
+
+	ok = d.parse("[1,", 3);
+	assert (!ok);
+
+	// aligned allocations after an odd sized copy that fills a block
+	json::arena small(64);
+	std::string big(5000, 'x');
+	small.copy(big.data(), big.size());
+	char* p = static_cast<char*>(small.allocate(48));
+	memset(p, 0, 48);
+	json::document e(64);
+	std::string t = "[\"\\n" + big + "\",[1,2,3],\"\\t" + big.substr(0, 333) + "\",{\"a\":[4]}]";
+	ok = e.parse(t.data(), t.size());
+	assert (ok && e.root()[1][2] == json::int32_(3) && e.root()[2].str().size == 334);
+}
+
+void test_move(void)
+{
+	json::value a;
+	const json::element* p = 0;
+	size_t moves = 0;
+
+	for (int i = 0; i < 1000; ++i) {
+		a.emplace_back(static_cast<double>(i));
+		if (a.data.array.element != p) {
+			p = a.data.array.element;
+			++moves;
+		}
+	}
+	assert (a.data.array.size == 1000);
+	assert (a[999] == 999.);
+	assert (moves <= 11); // geometric growth
+
+	json::value s("longer than inline strings");
+	const char* data = s.data.string.data;
+	a.push_back(std::move(s));
+	assert (s.type == JSON_UNDEFINED);
+	assert (a[1000].data.string.data == data); // no copy
+
+	json::value b(std::move(a));
+	assert (a.type == JSON_UNDEFINED);
+	assert (b.data.array.size == 1001);
+
+	a = std::move(b);
+	assert (a.data.array.size == 1001 && b.type == JSON_UNDEFINED);
+
+	json::value v;
+	v.view(string_(3, "abc"));
+	json::value w(std::move(v));
+	assert (w.flags & JSON_FLAG_VIEW);
+
+	json::value x(1.5);
+	x.push_back(x); // scalar becomes an array
+	x.push_back(x.data.array);
+	assert (x.data.array.size == 4 && x[3] == 1.5);
+	x.reserve(100);
+	assert (x.data.array.size == 4 && x.capacity() == 100);
+	p = x.data.array.element;
+	for (int i = 0; i < 96; ++i)
+		x.emplace_back(static_cast<double>(i));
+	assert (x.data.array.size == 100 && x.data.array.element == p && x[99] == 95.0);
+	x.emplace_back(true); // full, grows by doubling
+	assert (x.capacity() == 200 && x[100] == true);
+	x.reserve(10); // never shrinks
+	assert (x.capacity() == 200);
+
+	// elements of the array itself are read before it grows
+	json::value r;
+	r.emplace_back("a string that is not inline");
+	while (r.data.array.size < r.capacity())
+		r.emplace_back(1.0);
+	size_t n = r.data.array.size;
+	r.push_back(std::move(r[0]));
+	assert (r.capacity() > n && r[0].type == JSON_UNDEFINED && r[n] == "a string that is not inline");
+	while (r.data.array.size < r.capacity())
+		r.emplace_back(r[n]);
+	n = r.data.array.size;
+	r.emplace_back(r[n - 1]);
+	assert (r.capacity() > n && r[n] == "a string that is not inline" && r[n - 1] == r[n]);
+}
+
+void test_flat_object(void)
+{
+	const char* s = "{\"z\": 1, \"a\": [true], \"m\": {\"x\": \"y\"}, \"z\": 2}";
+	const char* b = s;
+	json::flat_object o;
+
+	bool ok = json::parse::read_object(b, s + strlen(s), o);
+	assert (ok);
+	assert (o.size() == 3);
+	assert (o.begin()->first == "z"); // insertion order
+	assert (o.find("z")->second == json::int32_(1)); // first key wins
+	assert (o.find("m")->second.type == JSON_OBJECT);
+	assert (o.find("m")->second.object().find("x")->second == "y"); // only the top level is flat
+	assert (o.find("q") == o.end());
+
+	std::ostringstream os;
+	os << o;
+	assert (os.str() == "{\"z\":1,\"a\":[true],\"m\":{\"x\":\"y\"}}");
+
+	json::flat_object p;
+	json::structural::parser sp;
+	ok = sp.parse(s, strlen(s), p);
+	assert (ok);
+	assert (p.find("a")->second == o.find("a")->second);
+
+	// large objects use a hash table
+	json::flat_object l;
+	for (int i = 0; i < 100; ++i)
+		l[std::to_string(i)] = json::value(static_cast<double>(i));
+	assert (l.size() == 100);
+	for (int i = 0; i < 100; ++i)
+		assert (l.find(std::to_string(i))->second == static_cast<double>(i));
+	assert (l.erase("50") == 1 && l.erase("50") == 0);
+	assert (l.size() == 99 && l.count("51") && !l.count("50"));
+	assert ((l.begin() + 50)->first == "51");
+	const json::flat_object& cl = l;
+	assert (cl.find("99")->second == 99.0 && cl.find("9") != cl.find("99") && cl.find("990") == cl.end());
+
+	json::flat_object m(l);
+	assert (m == l);
+	m["51"] = json::value(0.);
+	assert (m != l);
+	assert (m < l && !(l < m)); // 0 < 51
+
+	// < agrees with ==, which ignores insertion order
+	json::flat_object f, g;
+	f["b"] = json::value(1.0);
+	f["a"] = json::value(2.0);
+	g["a"] = json::value(2.0);
+	g["b"] = json::value(1.0);
+	assert (f == g && !(f < g) && !(g < f));
+	g["a"] = json::value(3.0);
+	assert (f < g && !(g < f));
+	json::compact c = json::compact::object(), d = json::compact::object();
+	c.set("y", json::compact(1.0)).set("x", json::compact(2.0));
+	d.set("x", json::compact(2.0)).set("y", json::compact(1.0));
+	assert (c == d && !(c < d) && !(d < c));
+}
+
+// sum the "x" members of the top level objects
+struct sum_x : public json::sax::handler {
+	int depth;
+	bool x;
+	double sum;
+	size_t events;
+
+	sum_x()
+		: depth(0), x(false), sum(0), events(0)
+	{ }
+
+	bool start_object(void)
+	{
+		++depth;
+		++events;
+
+		return true;
+	}
+	bool end_object(void)
+	{
+		--depth;
+
+		return true;
+	}
+	bool key(const json::string& k)
+	{
+		x = depth == 1 && k == "x";
+
+		return true;
+	}
+	bool number(double d)
+	{
+		if (x)
+			sum += d;
+		x = false;
+
+		return true;
+	}
+	bool string(const json::string& s)
+	{
+		x = false;
+
+		return !(s == "stop");
+	}
+};
+
+void test_sax(void)
+{
+	const char* s = " {\"x\": 1, \"y\": {\"x\": 100}, \"z\": [\"\\\"\", null, false], \"x\": 2.5}";
+	const char* b = s;
+	sum_x h;
+
+	bool ok = json::sax::parse(b, s + strlen(s), h);
+	assert (ok);
+	assert (b == s + strlen(s));
+	assert (h.sum == 3.5);
+	assert (h.events == 2);
+
+	const char* t = "[\"go\", \"stop\", 3]";
+	b = t;
+	ok = json::sax::parse(b, t + strlen(t), h);
+	assert (!ok);
+
+	json::sax::handler null;
+	const char* u = "{\"a\" 1}";
+	b = u;
+	ok = json::sax::parse(b, u + strlen(u), null);
+	assert (!ok);
+}
+
+void test_number(void)
+{
+	struct {
+		const char* s;
+		json_element_type type;
+		double x;
+	} n[] = {
+		{ "0", JSON_INT32, 0 },
+		{ "-2147483648", JSON_INT32, -2147483648. },
+		{ "2147483648", JSON_INT64, 2147483648. },
+		{ "-0", JSON_NUMBER, -0. },
+		{ "1.5", JSON_NUMBER, 1.5 },
+		{ "0.1", JSON_NUMBER, 0.1 },
+		{ "-0.000123", JSON_NUMBER, -0.000123 },
+		{ "1e3", JSON_NUMBER, 1000 },
+		{ "12.5E-1", JSON_NUMBER, 1.25 },
+		{ "18446744073709551616", JSON_NUMBER, 18446744073709551616. },
+		{ "1.7976931348623157e308", JSON_NUMBER, 1.7976931348623157e308 },
+		{ "4.9e-324", JSON_NUMBER, 4.9e-324 },
+		{ "1e-400", JSON_NUMBER, 0 },
+		{ "3.14159265358979323846", JSON_NUMBER, 3.14159265358979323846 },
+	};
+
+	for (size_t i = 0; i < sizeof(n)/sizeof(*n); ++i) {
+		const char* b = n[i].s;
+		json::element e;
+		bool ok = json::parse::scan_number(b, n[i].s + strlen(n[i].s), e);
+		assert (ok && *b == 0);
+		assert (e.type == n[i].type);
+		assert (e.type == JSON_NUMBER ? e.data.number == n[i].x
+			: e.type == JSON_INT32 ? e.data.int32 == n[i].x
+			: e.data.int64 == n[i].x);
+	}
+
+	const char* id = "[9007199254740993, -9223372036854775808]";
+	const char* b = id;
+	json::value v;
+	bool ok = json::parse::read_value(b, id + strlen(id), v);
+	assert (ok);
+	assert (v[0] == json::int64_(9007199254740993LL)); // not representable as a double
+	assert (v[1] == json::int64_(INT64_MIN));
+
+	const char* bad[] = { "-", "01", "1.", ".5", "1e", "+1" };
+	for (size_t i = 0; i < sizeof(bad)/sizeof(*bad); ++i) {
+		b = bad[i];
+		json::element e;
+		ok = json::parse::scan_number(b, bad[i] + strlen(bad[i]), e) && *b == 0;
+		assert (!ok);
+	}
+
+	std::istringstream is("[1, 2.5, -3]");
+	is >> v;
+	assert (v[0] == json::int32_(1) && v[1] == 2.5 && v[2] == json::int32_(-3));
+}
+
+void test_serialize(void)
+{
+	double x[] = { 0.1, 1.5, -0.000123, 1e21, 1e-7, 3.14159265358979323846, 1.7976931348623157e308, 4.9e-324, 2./3, 100, -0., 1e300, -1e300, 1e16 };
+	for (size_t i = 0; i < sizeof(x)/sizeof(*x); ++i) {
+		char s[32];
+		size_t n = json::format_double(x[i], s);
+		const char* b = s;
+		json::element e;
+		bool ok = json::parse::scan_number(b, s + n, e);
+		assert (ok && b == s + n);
+		assert (e.type == JSON_NUMBER && e.data.number == x[i]);
+	}
+
+	char s[32];
+	assert (std::string(s, json::format_double(0.1, s)) == "0.1");
+	assert (std::string(s, json::format_double(100, s)) == "100.0");
+	// shortest digits, subnormals and whole numbers past 2^53 included
+	assert (std::string(s, json::format_double(5e-324, s)) == "5e-324");
+	assert (std::string(s, json::format_double(2.225073858507201e-308, s)) == "2.225073858507201e-308"); // largest subnormal
+	assert (std::string(s, json::format_double(2.2250738585072014e-308, s)) == "2.2250738585072014e-308");
+	assert (std::string(s, json::format_double(9007199254740993., s)) == "9007199254740992.0"); // 2^53 + 1 rounds to 2^53
+	assert (std::string(s, json::format_double(9007199254740995., s)) == "9007199254740996.0");
+	assert (std::string(s, json::format_double(1152921504606846976., s)) == "1152921504606847000.0"); // 2^60
+	assert (std::string(s, json::format_double(1e21, s)) == "1e+21" && std::string(s, json::format_double(1e-7, s)) == "1e-7");
+	assert (std::string(s, json::format_double(-0.000001, s)) == "-0.000001");
+	assert (std::string(s, json::format_double(1.7976931348623157e308, s)) == "1.7976931348623157e+308");
+	uint64_t r = 88172645463325252ULL;
+	for (int i = 0; i < 20000; ++i) {
+		r ^= r << 13;
+		r ^= r >> 7;
+		r ^= r << 17;
+		uint64_t u = i%2 ? r : r & 0x000FFFFFFFFFFFFFULL; // half subnormal
+		double y;
+		memcpy(&y, &u, 8);
+		if (y != y || y - y != 0)
+			continue;
+		size_t n = json::format_double(y, s);
+		s[n] = 0;
+		std::string digits; // significant
+		for (const char* c = s; *c && *c != 'e'; ++c)
+			if ((*c >= '1' && *c <= '9') || (*c == '0' && !digits.empty()))
+				digits += *c;
+		while (digits.size() > 1 && digits[digits.size() - 1] == '0')
+			digits.erase(digits.size() - 1);
+		char t[32];
+		int p = 1;
+		while (snprintf(t, sizeof(t), "%.*e", p - 1, y), strtod(t, 0) != y)
+			++p;
+		assert (strtod(s, 0) == y);
+		assert (digits.size() == static_cast<size_t>(p));
+	}
+	assert (std::string(s, json::format_integer(INT64_MIN, s)) == "-9223372036854775808");
+
+	// escapes on both sides of a 16 byte block
+	std::string raw("quote\" backslash\\ tab\t control\x01 and some more text\n");
+	json::buffer buf;
+	json::serialize_string(buf, raw.data(), raw.size());
+	assert (buf.str() == "\"quote\\\" backslash\\\\ tab\\t control\\u0001 and some more text\\n\"");
+
+	const char* j = "{\"a\":[1,2.5,\"x\\\"y\",true,false,null],\"b\":{},\"c\":[]}";
+	const char* b = j;
+	json::value v;
+	bool ok = json::parse::read_value(b, j + strlen(j), v);
+	assert (ok);
+	assert (json::to_string(v) == j);
+
+	std::string p = json::to_string(v, 2);
+	assert (p == "{\n  \"a\": [\n    1,\n    2.5,\n    \"x\\\"y\",\n    true,\n    false,\n    null\n  ],\n  \"b\": {},\n  \"c\": []\n}");
+	b = p.data();
+	json::value w;
+	ok = json::parse::read_value(b, p.data() + p.size(), w);
+	assert (ok && json::to_string(w) == j); // null != null
+
+	// caller storage spills to the heap
+	char small[8];
+	json::buffer sb(small, sizeof(small));
+	json::serialize(sb, v);
+	assert (sb.size() == strlen(j) && sb.data() != small);
+
+	std::ostringstream os;
+	os << v;
+	assert (os.str() == j);
+}
+
+void test_locale(void)
+{
+	// a decimal comma in the program locale changes nothing
+	const char* names[] = { "de_DE.UTF-8", "de_DE.utf8", "de_DE", "fr_FR.UTF-8", "fr_FR.utf8", "German" };
+	std::string old = setlocale(LC_NUMERIC, 0);
+	const char* l = 0;
+	for (size_t i = 0; !l && i < sizeof(names)/sizeof(names[0]); ++i)
+		l = setlocale(LC_NUMERIC, names[i]);
+	if (!l)
+		return; // none installed
+
+	char c[8];
+	snprintf(c, sizeof(c), "%g", 1.5);
+	const char* j = "[1.5, 0.12345678901234567890, 2.5e-300]"; // the last two take the slow path
+	json::value v;
+	bool ok = json::parse::read_value(j, j + strlen(j), v);
+	std::string s = json::to_string(v);
+	setlocale(LC_NUMERIC, old.c_str());
+	assert (ok && v[0] == 1.5 && v[1] == 0.12345678901234567890 && v[2] == 2.5e-300);
+	assert (s == "[1.5,0.12345678901234568,2.5e-300]");
+	assert (std::string(c) == "1,5"); // the locale did use a comma
+}
+
+void test_writer(void)
+{
+	json::buffer buf(0);
+	json::writer w(buf);
+
+	w.begin_object();
+	w.key("a");
+	w.value(1.5);
+	w.key(std::string("b"));
+	w.begin_array();
+	w.value(1);
+	w.value(int64_t(-9007199254740993LL));
+	w.value("x\"y");
+	w.value(true);
+	w.null();
+	w.begin_object();
+	w.end_object();
+	w.end_array();
+	w.key("c");
+	w.begin_array();
+	w.end_array();
+	w.end_object();
+	assert (w.done());
+	assert (buf.str() == "{\"a\":1.5,\"b\":[1,-9007199254740993,\"x\\\"y\",true,null,{}],\"c\":[]}");
+
+	const char* b = buf.data();
+	json::value v;
+	bool ok = json::parse::read_value(b, buf.data() + buf.size(), v);
+	assert (ok && json::to_string(v) == buf.str());
+
+	// same bytes as serializing the tree
+	json::buffer pretty;
+	json::writer p(pretty, 2);
+	p.value(v);
+	assert (pretty.str() == json::to_string(v, 2));
+
+	pretty.clear();
+	json::writer q(pretty, 2);
+	q.begin_object();
+	q.key("a");
+	q.value(1.5);
+	q.key("b");
+	q.begin_array();
+	q.value(false);
+	q.value(v["c"]);
+	q.end_array();
+	q.end_object();
+	assert (pretty.str() == "{\n  \"a\": 1.5,\n  \"b\": [\n    false,\n    []\n  ]\n}");
+
+	// small flush size forces several writes to the stream
+	std::ostringstream os;
+	{
+		json::writer s(os, 0, 8);
+		s.begin_array();
+		for (int i = 0; i < 100; ++i)
+			s.value(i);
+		s.end_array();
+		assert (s.done());
+	}
+	assert (os.str().size() == 2 + 10 + 2*90 + 99);
+	assert (os.str().substr(0, 8) == "[0,1,2,3");
+
+	// containers flush too, so empty ones do not pile up in the buffer
+	std::ostringstream es;
+	json::writer ew(es, 0, 64);
+	ew.begin_array();
+	for (int i = 0; i < 10000; ++i) {
+		ew.begin_object();
+		ew.key("a");
+		ew.begin_array();
+		ew.end_array();
+		ew.end_object();
+	}
+	size_t written = es.str().size();
+	ew.end_array();
+	assert (ew.done() && written > 80000 && es.str().size() == 2 + 10000*8 + 9999);
+
+	// every integer type, unsigned ones past INT64_MAX too
+	buf.clear();
+	json::writer i(buf);
+	i.begin_array();
+	i.value(-1L);
+	i.value(-2LL);
+	i.value(3u);
+	i.value(4ul);
+	i.value(18446744073709551615ull);
+	i.value(static_cast<short>(-5));
+	i.end_array();
+	assert (i.done() && buf.str() == "[-1,-2,3,4,18446744073709551615,-5]");
+
+	// calls that do not fit are not written, in release builds too
+	buf.clear();
+	json::writer e(buf);
+	e.end_array();
+	assert (!e.ok() && !e.done() && buf.size() == 0);
+	e.value(1);
+	e.begin_object();
+	assert (!e.ok() && buf.size() == 0);
+	buf.clear();
+	json::writer m(buf);
+	m.begin_object();
+	m.value(1); // key expected
+	m.key("a");
+	m.end_object();
+	assert (!m.ok() && !m.done() && buf.str() == "{");
+	buf.clear();
+	json::writer t(buf);
+	t.value(1);
+	t.value(2); // second top level value
+	t.begin_array();
+	t.end_array();
+	assert (!t.ok() && !t.done() && buf.str() == "1");
+	buf.clear();
+	json::writer k(buf);
+	k.begin_array();
+	k.key("a");
+	k.end_object();
+	assert (!k.ok() && buf.str() == "[");
+}
+
+void test_ndjson(void)
+{
+	std::string s;
+	for (int i = 0; i < 1000; ++i) {
+		s += "{\"i\":";
+		s += std::to_string(i);
+		s += ",\"s\":\"x\\ty\"}";
+		s += i % 7 ? "\n" : "\r\n\n"; // blank lines are skipped
+	}
+
+	json::pool p(4);
+	std::vector<json::value> v;
+	bool ok = json::ndjson::parse(s.data(), s.size(), v, p, 100);
+	assert (ok && v.size() == 1000);
+	for (int i = 0; i < 1000; ++i) {
+		const json::object& o = *v[i].data.object;
+		assert (o.find("i")->second == json::int32_(i));
+		assert (o.find("s")->second == "x\ty");
+	}
+
+	std::mutex m;
+	long sum = 0;
+	size_t count = 0;
+	ok = json::ndjson::for_each(s.data(), s.size(), [&](size_t offset, json::value& w) {
+		std::lock_guard<std::mutex> lock(m);
+		assert (s[offset] == '{');
+		sum += w.data.object->find("i")->second.data.int32;
+		++count;
+	}, p, 100);
+	assert (ok && count == 1000 && sum == 999*1000/2);
+
+	// blocks smaller than a record
+	std::istringstream is(s);
+	sum = 0;
+	count = 0;
+	ok = json::ndjson::for_each(is, [&](size_t offset, json::value& w) {
+		std::lock_guard<std::mutex> lock(m);
+		assert (s[offset] == '{');
+		sum += w.data.object->find("i")->second.data.int32;
+		++count;
+	}, p, 16, 64);
+	assert (ok && count == 1000 && sum == 999*1000/2);
+
+	std::string bad = "[1]\n[2] [3]\n{\n";
+	v.clear();
+	ok = json::ndjson::parse(bad.data(), bad.size(), v, p);
+	assert (!ok);
+	ok = json::ndjson::for_each(bad.data(), bad.size(), [](size_t, json::value&) { }, p);
+	assert (!ok);
+}
+
+void test_lazy(void)
+{
+	const char* j = "{\"id\": 7, \"name\": \"a\\u0062c\", \"skip\": [[1, 2], {\"x\": [3]}],"
+		" \"a\\u0062\": {\"x\": 1.5, \"tags\": [\"p\", \"q\", \"r\"]}, \"big\": 9007199254740993, \"e\": {}}";
+	json::lazy_document d;
+	bool ok = d.parse(j, strlen(j));
+	assert (ok);
+
+	json::lazy_value r = d.root();
+	assert (r.type() == JSON_OBJECT && r.size() == 6);
+	assert (r["id"].type() == JSON_INT32 && r["id"].number() == 7);
+	assert (r["name"].str() == "abc");
+	assert (r["ab"]["x"].number() == 1.5); // escaped key
+	assert (r["ab"]["tags"].size() == 3);
+	assert (r["ab"]["tags"][2].str() == "r");
+	assert (!r["ab"]["tags"][3].valid());
+	assert (d["skip"][1]["x"][0].number() == 3);
+	assert (d["skip"][0].size() == 2);
+	assert (r["big"].type() == JSON_INT64);
+	assert (r["e"].type() == JSON_OBJECT && r["e"].size() == 0 && !r["e"]["x"].valid());
+	assert (!r["missing"].valid() && !r["missing"]["x"].valid());
+	assert (!r[0].valid() && r["id"].type() != JSON_UNDEFINED);
+
+	json::value v;
+	ok = r["ab"].get(v);
+	assert (ok && json::to_string(v) == "{\"tags\":[\"p\",\"q\",\"r\"],\"x\":1.5}");
+
+	ok = d.parse("[true, false, null, -0.5, \"\"]", 29);
+	assert (ok && d.root().size() == 5);
+	assert (d[0].type() == JSON_TRUE && d[2].type() == JSON_NULL && d[3].number() == -0.5);
+	assert (d[4].type() == JSON_STRING && d[4].str().empty());
+
+	const char* bad[] = {
+		"", " ", "{", "[1,]", "[1 2]", "{\"a\" 1}", "{\"a\":1,}", "{,}", "[01]", "{\"a\":tru}",
+		"[\"abc]", "1 2", "[1]]", "{\"a\":1]", "[\"\\q\"]", "{1:2}", "[:]",
+	};
+	for (size_t i = 0; i < sizeof(bad)/sizeof(*bad); ++i) {
+		ok = d.parse(bad[i], strlen(bad[i]));
+		assert (!ok && !d.root().valid());
+	}
+}
+
+void test_push(void)
+{
+	const char* j = "{\"a\": [1, -2.5e3, \"x\\u00e9\\\"y\\\\\", true, false, null, {}, []], \"b\": {\"c\": 12345678901}}";
+	const char* b = j;
+	json::value v;
+	bool ok = json::parse::read_value(b, j + strlen(j), v);
+	assert (ok);
+
+	// every split point, one byte at a time
+	for (size_t n = 1; n <= 7; ++n) {
+		json::push_parser p;
+		json::value w;
+		for (size_t i = 0; i < strlen(j); i += n) {
+			assert (!p.next(w));
+			ok = p.feed(j + i, std::min(n, strlen(j) - i));
+			assert (ok);
+		}
+		ok = p.next(w);
+		assert (ok && json::to_string(w) == json::to_string(v));
+		assert (p.finish() && !p.next(w));
+	}
+
+	// several documents, top level scalars end at whitespace or finish
+	size_t count = 0;
+	json::push_parser q([&count](json::value& w) {
+		assert (count != 0 || w == "s");
+		assert (count != 1 || w == json::int32_(12));
+		assert (count != 2 || w.type == JSON_ARRAY);
+		assert (count != 3 || w == true);
+		++count;
+	});
+	ok = q.feed("\"s\" 1", 5) && q.feed("2 [", 3) && q.feed("]\ntr", 4) && q.feed("ue", 2);
+	assert (ok && count == 3 && q.depth() == 0);
+	ok = q.finish(); // true could have been continued
+	assert (ok && count == 4);
+
+	json::push_parser r;
+	ok = r.feed("[1, 2", 5);
+	assert (ok && r.depth() == 1 && !r.finish());
+
+	const char* bad[] = { "[1,]", "{\"a\" 1}", "{1:2}", "[1 2]", "]", "[tru]", "[\"\\q\"]", "{\"a\":1]", "01", "[-]" };
+	for (size_t i = 0; i < sizeof(bad)/sizeof(*bad); ++i) {
+		json::push_parser p;
+		ok = p.feed(bad[i], strlen(bad[i])) && p.finish();
+		assert (!ok);
+	}
+}
+
+void test_tape(void)
+{
+	const char* j = "{\"a\": [1, -2.5, \"x\\ny\", true, false, null, {}, []], \"b\": {\"c\": 12345678901, \"\": \"\"}, \"d\": 0.1}";
+	json::tape t;
+	bool ok = t.parse(j, strlen(j));
+	assert (ok);
+
+	json::tape::ref r = t.root();
+	assert (r.type() == JSON_OBJECT && r.size() == 3);
+	assert (r["a"].size() == 8);
+	assert (r["a"][0].type() == JSON_INT32 && r["a"][0].int32() == 1);
+	assert (r["a"][1] == -2.5);
+	assert (r["a"][2] == "x\ny");
+	assert (r["a"][3] == true && r["a"][4] == false && r["a"][5].type() == JSON_NULL);
+	assert (r["a"][6].size() == 0 && r["a"][7].type() == JSON_ARRAY && r["a"][7].size() == 0);
+	assert (!r["a"][8].valid() && !r["x"].valid() && !r[0].valid());
+	assert (r["b"]["c"].type() == JSON_INT64 && r["b"]["c"].int64() == 12345678901LL);
+	assert (r["b"][""] == "");
+	assert (r["d"].number() == 0.1);
+
+	// members in document order
+	std::string keys;
+	for (json::tape::iterator i = r.begin(); i != r.end(); ++i)
+		keys.append((i.key()).data, (i.key()).size);
+	assert (keys == "abd");
+
+	// both ways through json::value
+	const char* b = j;
+	json::value v;
+	ok = json::parse::read_value(b, j + strlen(j), v);
+	assert (ok);
+	json::value w;
+	r.get(w);
+	assert (json::to_string(w) == json::to_string(v));
+
+	json::tape u(v);
+	json::value x;
+	u.root().get(x);
+	assert (json::to_string(x) == json::to_string(v));
+	assert (u.words() == t.words());
+
+	json::value bytes;
+	uint8_t data[] = { 0, 1, 2, 255 };
+	bytes = json::byte_(4, data);
+	json::tape tb(bytes);
+	assert (tb.root().type() == JSON_BYTE && tb.root().string().size == 4);
+	tb.root().get(x);
+	assert (x == json::byte_(4, data));
+
+	const char* bad[] = { "", "[1,]", "{\"a\" 1}", "[1 2]", "[1] 2", "{\"a\":tru}" };
+	for (size_t i = 0; i < sizeof(bad)/sizeof(*bad); ++i) {
+		ok = t.parse(bad[i], strlen(bad[i]));
+		assert (!ok && t.empty() && !t.root().valid());
+	}
+}
+
+void test_inline_string(void)
+{
+	json::value s("fifteen chars..");
+	json::value l("sixteen chars...");
+	assert (s.flags & JSON_FLAG_INLINE);
+	assert (!(l.flags & JSON_FLAG_INLINE));
+	assert (s.str().size == 15 && s.str().data[15] == 0);
+	assert (s == "fifteen chars.." && l == "sixteen chars...");
+	assert (s < l && !(l < s));
+
+	// views and inline strings compare by content
+	const char* buf = "fifteen chars..";
+	json::value v;
+	v.view(json::string_(15, buf));
+	assert (v == s && s == v);
+
+	// copies, moves and array growth carry the bytes with them
+	json::value a(0);
+	for (int i = 0; i < 100; ++i)
+		a.push_back(json::value(std::to_string(i).c_str()));
+	json::value b(a);
+	for (int i = 0; i < 100; ++i)
+		assert (b[i] == std::to_string(i).c_str() && (b[i].flags & JSON_FLAG_INLINE));
+	json::value c(std::move(s));
+	assert (c == "fifteen chars.." && s.type == JSON_UNDEFINED);
+	c = "";
+	assert (c.str().size == 0 && c == "");
+
+	// short strings with escapes take no arena memory
+	const char* j = "[\"a\\tb\", \"plain\"]";
+	json::document d;
+	bool ok = d.parse(j, strlen(j));
+	assert (ok && d.root()[0] == "a\tb" && (d.root()[0].flags & JSON_FLAG_INLINE));
+	assert (d.root()[1].flags & JSON_FLAG_VIEW);
+	assert (json::to_string(d.root()) == "[\"a\\tb\",\"plain\"]");
+}
+
+void test_intern(void)
+{
+	json::key a("id"), b(std::string("id")), c("name"), e;
+	assert (a == b && a.data() == b.data() && a != c);
+	assert (a.hash() == json::key_hash("id", 2) && a.size() == 2);
+	assert (e.empty() && e == json::key("") && e < a && a < c && !(c < a));
+
+	// separate pools do not share storage
+	json::key_pool pool;
+	json::key d("id", 2, pool);
+	assert (d.str() == "id" && d.data() != a.data());
+	assert (json::key("id", 2, pool) == d && pool.size() == 1);
+
+	const char* j = "{\"id\": 1, \"name\": \"x\", \"tags\": {\"a\": []}, \"id\": 2}";
+	const char* p = j;
+	json::interned_object o;
+	bool ok = json::parse::read_object(p, j + strlen(j), o);
+	assert (ok && o.size() == 3);
+	assert (o.find(a)->second == json::int32_(1)); // first key wins
+	assert (o.find("name")->first.data() == c.data());
+	assert (json::to_string(o) == "{\"id\":1,\"name\":\"x\",\"tags\":{\"a\":[]}}");
+
+	// looking names up does not intern them
+	size_t n = json::key_pool::global().size();
+	const json::interned_object& co = o;
+	assert (o.find("not a member") == o.end() && o.count(std::string("nor this")) == 0);
+	assert (co["name"] == "x" && co.count("id") == 1);
+	bool thrown = false;
+	try {
+		co["missing"];
+	}
+	catch (const std::out_of_range&) {
+		thrown = true;
+	}
+	assert (thrown && json::key_pool::global().size() == n);
+
+	json::structural::parser sp;
+	json::interned_object q;
+	ok = sp.parse(j, strlen(j), q);
+	assert (ok && q == o);
+
+	// many threads interning the same names
+	std::vector<std::thread> t;
+	std::vector<const char*> seen(8);
+	for (size_t i = 0; i < seen.size(); ++i) {
+		t.push_back(std::thread([&seen, &pool, i]() {
+			for (int k = 0; k < 1000; ++k)
+				json::key("k" + std::to_string(k));
+			seen[i] = json::key("shared", 6, pool).data();
+		}));
+	}
+	for (size_t i = 0; i < t.size(); ++i)
+		t[i].join();
+	for (size_t i = 1; i < seen.size(); ++i)
+		assert (seen[i] == seen[0]);
+	assert (pool.size() == 2);
+
+	// names in another pool are found there, not in the global one
+	json::interned_object l;
+	l[json::key("only in pool", 12, pool)] = json::value(true);
+	assert (l.find("only in pool") == l.end() && l.find("only in pool", pool)->second == true);
+	assert (l.count(std::string("only in pool"), pool) == 1 && l.count("shared", pool) == 0);
+
+	// lookups do not wait for names being added, or miss any while the table grows
+	json::key_pool g;
+	json::key first("first", 5, g);
+	size_t missed = 0;
+	std::thread r([&g, &first, &missed]() {
+		for (int k = 0; k < 20000; ++k) {
+			const json::key_pool::rep* f = g.lookup("first", 5);
+			if (!f || f->data != first.data())
+				++missed;
+		}
+	});
+	for (int k = 0; k < 20000; ++k) {
+		std::string name = "g" + std::to_string(k);
+		json::key(name.data(), name.size(), g);
+	}
+	r.join();
+	assert (missed == 0 && g.size() == 20001);
+}
+
+void test_shared(void)
+{
+	const char* j = "{\"config\": [\"a string longer than fifteen\", 1.5, {\"k\": [1, 2, 3]}], \"n\": null}";
+	const char* b = j;
+	json::value v;
+	bool ok = json::parse::read_value(b, j + strlen(j), v);
+	assert (ok);
+	json::value c(v); // owns its copy, v's strings refer to j
+	c.share();
+	assert (c.flags & JSON_FLAG_SHARED && c.use_count() == 1);
+
+	// copies share storage
+	json::value d(c), e;
+	e = c;
+	assert (c.use_count() == 3 && d.data.object == c.data.object && e.data.object == c.data.object);
+	assert (json::to_string(d) == json::to_string(v));
+
+	// modifying a copy leaves the others alone
+	const json::value& cd = d;
+	const json::value& dc = cd["config"];
+	json::value x(dc);
+	assert (x.use_count() == 2 && (x[2].flags & JSON_FLAG_SHARED)); // non-const [] unshares x only
+	x.push_back(json::value(true));
+	assert (x.use_count() == 0 && x.data.array.size == 4 && dc.data.array.size == 3);
+	assert (x[2].use_count() == 2); // members stay shared until modified
+	x[0] = "changed";
+	assert (x[0] == "changed" && dc[0] == "a string longer than fifteen");
+	json::value f(c);
+	f["n"] = "set"; // members through object() or [] copy first
+	f.object().erase("config");
+	assert (f.use_count() == 0 && c.use_count() == 3 && cd["n"].type == JSON_NULL && cd.object().size() == 2);
+	bool thrown = false;
+	try {
+		cd["missing"];
+	}
+	catch (const std::out_of_range&) {
+		thrown = true;
+	}
+	assert (thrown && f.object().size() == 1 && f["n"] == "set");
+
+	json::value y(dc);
+	json::value z;
+	z.swap(y);
+	d = json::value();
+	e = json::value();
+	c = json::value();
+	assert (z.use_count() == 1);
+
+	// readers on many threads
+	std::vector<std::thread> t;
+	std::vector<size_t> n(8);
+	for (size_t i = 0; i < n.size(); ++i) {
+		t.push_back(std::thread([&z, &n, i]() {
+			for (int k = 0; k < 1000; ++k) {
+				json::value u(z);
+				const json::value& cu = u;
+				n[i] += cu[2].data.object->size() + cu[0].str().size;
+			}
+		}));
+	}
+	for (size_t i = 0; i < t.size(); ++i)
+		t[i].join();
+	for (size_t i = 0; i < n.size(); ++i)
+		assert (n[i] == 1000*(1 + 28));
+	assert (z.use_count() == 1);
+
+	// the last reference takes the storage without copying members
+	const json::object* k = z[2].data.object;
+	z.push_back(json::value(false));
+	assert (z.use_count() == 0 && z[2].data.object == k && z.data.array.size == 4);
+}
+
+void test_compact(void)
+{
+	static_assert(sizeof(json::compact) == 8, "compact is one word");
+
+	// scalars in the NaN payload
+	json::compact n(1.5), t(true), s("text"), u;
+	assert (n.type() == JSON_NUMBER && n == 1.5);
+	assert (t.type() == JSON_TRUE && t == true && !(t == false));
+	assert (s.type() == JSON_STRING && s == "text" && s.size() == 0);
+	assert (u.type() == JSON_UNDEFINED && json::compact::null().type() == JSON_NULL);
+	json::compact nan(std::numeric_limits<double>::quiet_NaN());
+	assert (nan.type() == JSON_NUMBER && nan.number() != nan.number());
+	json::compact inf(-std::numeric_limits<double>::infinity());
+	assert (inf.type() == JSON_NUMBER && inf.number() < 0);
+
+	// round trip with json::value
+	const char* j = "{\"a\": [1, -2.5, \"s\", true, false, null, {\"b\": []}], \"c\": \"a string longer than fifteen\"}";
+	const char* b = j;
+	json::value v;
+	bool ok = json::parse::read_value(b, j + strlen(j), v);
+	assert (ok);
+	json::compact c(v);
+	assert (c.type() == JSON_OBJECT && c.size() == 2);
+	assert (c["a"].size() == 7 && c["a"][1] == -2.5 && c["a"][2] == "s" && c["c"] == "a string longer than fifteen");
+	assert (c["a"][6]["b"].type() == JSON_ARRAY && c["missing"].type() == JSON_UNDEFINED);
+	assert (json::to_string(c) == json::to_string(v));
+	json::value w;
+	c.get(w);
+	assert (json::to_string(w) == json::to_string(v));
+
+	json::value x;
+	x = json::int32_(-7);
+	json::value y;
+	y = json::int64_(INT64_C(1) << 40);
+	json::compact cx(x), cy(y);
+	assert (cx.type() == JSON_INT32 && cx.int32() == -7);
+	assert (cy.type() == JSON_INT64 && cy.int64() == INT64_C(1) << 40);
+
+	// copies are deep, comparisons follow json::element
+	const json::compact& cb = c["a"][6]; // no nulls, they never compare equal
+	json::compact d(cb);
+	assert (d == cb && !(d < cb) && !(cb < d));
+	d.find("b")->push_back(json::compact(1.0));
+	assert (d.find("missing") == 0 && d.size() == 1);
+	assert (!(d == cb) && cb < d && cb["b"].size() == 0);
+	json::value ea, eb;
+	ea = "a";
+	eb = 1.0;
+	assert ((json::compact("a") < json::compact(1.0)) == (ea < eb));
+	ea = true;
+	eb = false;
+	assert ((json::compact(true) < json::compact(false)) == (ea < eb));
+	assert (!(json::compact::null() == json::compact::null()));
+
+	// building
+	json::compact a;
+	for (int i = 0; i < 100; ++i)
+		a.push_back(json::compact(static_cast<double>(i)));
+	a.push_back(a[0]);
+	assert (a.type() == JSON_ARRAY && a.size() == 101 && a[99] == 99.0 && a[100] == 0.0);
+	json::compact o;
+	o.set("k", std::move(a)).set("m", json::compact("v"));
+	assert (a.type() == JSON_UNDEFINED && o["k"].size() == 101 && o["m"] == "v");
+	o.set("m", json::compact(1.0));
+	assert (o.size() == 2 && o["m"] == 1.0);
+}
+
+void test_typed_array(void)
+{
+	const char* j = "{\"t\": [0.5, 1.5, 2.5], \"i\": [1, 2, 3], \"m\": [1, 2.5], \"e\": [], \"n\": [[1, 2], \"x\"]}";
+	const char* b = j;
+	json::value v;
+	bool ok = json::parse::read_value(b, j + strlen(j), v);
+	assert (ok);
+	std::string text = json::to_string(v);
+
+	json::value p(v);
+	bool packed = p.pack();
+	assert (!packed); // only the members are typed
+	const json::object& o = *p.data.object;
+	json::span<const double> t = o.find("t")->second.span<double>();
+	assert (t.size == 3 && t[0] == 0.5 && t[2] == 2.5);
+	assert (o.find("i")->second.typed() == JSON_INT32 && o.find("i")->second.span<int32_t>()[1] == 2);
+	assert (o.find("i")->second.span<double>().size == 0); // not doubles
+	assert (o.find("m")->second.typed() == JSON_UNDEFINED && o.find("e")->second.typed() == JSON_UNDEFINED);
+	assert (o.find("n")->second[0].typed() == JSON_INT32);
+	assert (json::to_string(p) == text); // same text, same comparisons
+	assert (o.find("t")->second == v.data.object->find("t")->second);
+	assert (o.find("i")->second.at(2) == json::int32_(3));
+
+	// copies, sharing and modification
+	json::value c = o.find("t")->second;
+	c.share();
+	json::value d(c);
+	assert (d.typed() == JSON_NUMBER && d.use_count() == 2);
+	json::span<double> s = d.span<double>();
+	s[0] = -1;
+	assert (d.use_count() == 0 && c.span<double>()[0] == 0.5 && d.at(0) == -1.0);
+	d[1] = "x"; // back to elements
+	assert (d.typed() == JSON_UNDEFINED && d[1] == "x" && d[2] == 2.5);
+	d.push_back(json::value(1.0));
+	assert (d.data.array.size == 4);
+
+	// built from native numbers
+	double x[] = { 1, 2, 3, 4 };
+	json::value a(x, 4);
+	assert (a.typed() == JSON_NUMBER && a.span<double>().size == 4 && json::to_string(a) == "[1.0,2.0,3.0,4.0]");
+	int64_t y[] = { INT64_C(1) << 40, -1 };
+	json::value w(y, 2);
+	assert (json::to_string(w) == "[1099511627776,-1]");
+	assert ((w < a) == (json::value(json::int64_(1)) < json::value(1.0)));
+
+	// const [] has no element to refer to
+	const json::value& ca = a;
+	bool threw = false;
+	try {
+		(void)ca[0];
+	}
+	catch (const std::logic_error&) {
+		threw = true;
+	}
+	assert (threw && ca.at(0) == 1.0);
+}
+
+void test_hash(void)
+{
+	const char* j = "{\"a\": [1, 2.5, \"a string longer than fifteen\", true], \"b\": {\"c\": \"d\"}, \"z\": -0.0}";
+	const char* k = "{\"z\": 0.0, \"b\": {\"c\": \"d\"}, \"a\": [1, 2.5, \"a string longer than fifteen\", true]}";
+	json::value v, w;
+	const char* b = j;
+	bool ok = json::parse::read_value(b, j + strlen(j), v);
+	b = k;
+	ok = ok && json::parse::read_value(b, k + strlen(k), w);
+	assert (ok && v == w);
+
+	// equal values hash the same whatever their storage
+	std::hash<json::value> h;
+	assert (h(v) == h(w));
+	json::value s(v);
+	s.share();
+	assert (h(s) == h(v) && s == v);
+	assert (json::shared::header(s.data.object)->hash != 0); // cached
+	assert (h(s) == h(v));
+	double x[] = { 0.5, 1.5 };
+	json::value t(x, 2), u(2);
+	u[0] = 0.5;
+	u[1] = 1.5;
+	assert (t == u && h(t) == h(u));
+	assert (std::hash<json::string>()(v.data.object->find("a")->second[2].str()) == h(v.data.object->find("a")->second[2]));
+
+	// different values almost never do
+	json::value n(v);
+	n["b"] = "e";
+	assert (h(n) != h(v) && !(n == v));
+	json::value m(1.0), o(json::int32_(1));
+	assert (h(m) != h(o));
+
+	// cached hashes that differ end the comparison
+	n.share();
+	h(n);
+	assert (!(n == s));
+
+	// unordered containers
+	std::unordered_set<json::value, std::hash<json::value>, json::equal_to> set;
+	set.insert(v);
+	set.insert(s);
+	set.insert(w);
+	set.insert(n);
+	assert (set.size() == 2 && set.count(w) == 1);
+
+	// null != null, but equal_to finds every value equal to itself
+	const char* z = "{\"id\": 1, \"x\": null, \"a\": [null, {\"u\": null}]}";
+	json::value nv;
+	b = z;
+	ok = json::parse::read_value(b, z + strlen(z), nv);
+	json::value nw(nv);
+	assert (ok && !(nv == nw) && json::equal(nv, nw));
+	set.insert(nv);
+	set.insert(nv);
+	set.insert(nw);
+	assert (set.size() == 3 && set.count(nw) == 1);
+	json::value nan(std::numeric_limits<double>::quiet_NaN()), neg(-std::numeric_limits<double>::quiet_NaN());
+	assert (json::equal(nan, neg) && h(nan) == h(neg));
+
+	json::flat_object f, g;
+	f["x"] = json::value(1.0);
+	f["y"] = "y";
+	g["y"] = "y";
+	g["x"] = json::value(1.0);
+	assert (f == g && json::hash(f) == json::hash(g));
+}
+
+void test_sort_key(void)
+{
+	const char* j = "[\"\", \"a\", \"a\\u0000\", \"a\\u0001\", \"ab\", \"\\u00ff\", \"a string longer than fifteen\","
+		" -1e300, -2.5, -0.0, 0.0, 1e-300, 3.25, 1e300, -2147483648, -1, 0, 7, -9007199254740993, 9007199254740993,"
+		" [], [1], [1, 2], [2], [[]], [\"a\", null], {}, {\"a\": 1}, {\"a\": 1, \"b\": 2}, {\"a\": 2}, {\"b\": 0},"
+		" {\"\": []}, true, false, null]";
+	const char* b = j;
+	json::value v;
+	bool ok = json::parse::read_value(b, j + strlen(j), v);
+	assert (ok);
+	double x[] = { 1, 2 };
+	v.push_back(json::value(x, 2));
+	v.push_back(json::value(static_cast<time_t>(-5)));
+	uint8_t y[] = { 0, 255 };
+	json::value by;
+	by = json::byte_(2, y);
+	v.push_back(by);
+
+	const json::value& cv = v;
+	std::vector<std::string> k;
+	for (size_t i = 0; i < cv.data.array.size; ++i)
+		k.push_back(json::sort_key(cv.at(i)));
+	for (size_t i = 0; i < k.size(); ++i)
+		for (size_t m = 0; m < k.size(); ++m)
+			assert ((k[i] < k[m]) == (cv.at(i) < cv.at(m)));
+
+	assert (json::sort_key(cv[9]) == json::sort_key(cv[10])); // -0 and 0
+	json::buffer buf;
+	json::sort_key(buf, cv[1]);
+	assert (buf.str() == std::string("\x01" "a\0\x01", 4));
+}
+
+#ifdef JSON_BENCH
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <set>
+
+void bench_parse(void)
+{
+	std::string s("[");
+	for (int i = 0; i < 200000; ++i) {
+		if (i) s += ',';
+		s += "[12345, \"some name\", [\"a\", \"b\", true, null], 1.25]"; // istream parser has no objects
+	}
+	s += ']';
+	double mb = s.size()/1e6;
+
+	clock_t t = clock();
+	{
+		std::istringstream is(s);
+		json::value v;
+		is >> v;
+	}
+	std::cout << "istream:    " << mb/(double(clock() - t)/CLOCKS_PER_SEC) << " MB/s" << std::endl;
+
+	t = clock();
+	{
+		const char* b = s.data();
+		json::value v;
+		json::parse::read_value(b, s.data() + s.size(), v);
+	}
+	std::cout << "buffer:     " << mb/(double(clock() - t)/CLOCKS_PER_SEC) << " MB/s" << std::endl;
+
+	t = clock();
+	{
+		json::structural::parser p;
+		json::value v;
+		p.parse(s.data(), s.size(), v);
+	}
+	std::cout << "structural: " << mb/(double(clock() - t)/CLOCKS_PER_SEC) << " MB/s" << std::endl;
+
+	t = clock();
+	{
+		json::document d;
+		d.parse(s.data(), s.size());
+	}
+	std::cout << "arena:      " << mb/(double(clock() - t)/CLOCKS_PER_SEC) << " MB/s" << std::endl;
+
+	t = clock();
+	{
+		json::tape tp;
+		tp.parse(s.data(), s.size());
+	}
+	std::cout << "tape:       " << mb/(double(clock() - t)/CLOCKS_PER_SEC) << " MB/s" << std::endl;
+
+	std::vector<uint32_t> idx;
+	t = clock();
+	json::structural::index(s.data(), s.size(), idx);
+	std::cout << "  stage 1:  " << mb/(double(clock() - t)/CLOCKS_PER_SEC) << " MB/s" << std::endl;
+
+	// a few fields out of a wide document
+	std::string w("{");
+	for (int i = 0; i < 200; ++i) {
+		if (i) w += ", ";
+		w += "\"field" + std::to_string(i) + "\": [1.5, \"text\", {\"deep\": [1, 2, 3]}]";
+	}
+	w += "}";
+	double x = 0;
+	t = clock();
+	for (int i = 0; i < 2000; ++i) {
+		json::lazy_document d;
+		d.parse(w.data(), w.size());
+		x += d["field3"][0].number() + d["field100"][0].number() + d["field199"][0].number();
+	}
+	std::cout << "lazy 3/200: " << 2000*w.size()/1e6/(double(clock() - t)/CLOCKS_PER_SEC) << " MB/s" << std::endl;
+	t = clock();
+	for (int i = 0; i < 2000; ++i) {
+		json::document d;
+		d.parse(w.data(), w.size());
+	}
+	std::cout << "full 200:   " << 2000*w.size()/1e6/(double(clock() - t)/CLOCKS_PER_SEC) << " MB/s" << std::endl;
+
+	// a million numbers as elements and as compact values
+	json::value na(1000000);
+	for (int i = 0; i < 1000000; ++i)
+		na[i] = i*0.5;
+	json::compact ca(na);
+	const json::value& cna = na;
+	t = clock();
+	for (int k = 0; k < 20; ++k)
+		for (size_t i = 0; i < cna.data.array.size; ++i)
+			x += cna[i].data.number;
+	std::cout << "sum value:  " << 20/(double(clock() - t)/CLOCKS_PER_SEC) << " arrays/s, " << sizeof(json::element) << " bytes each" << std::endl;
+	t = clock();
+	for (int k = 0; k < 20; ++k)
+		for (size_t i = 0; i < ca.size(); ++i)
+			x += ca[i].number();
+	std::cout << "sum compact:" << 20/(double(clock() - t)/CLOCKS_PER_SEC) << " arrays/s, " << sizeof(json::compact) << " bytes each (" << x << ")" << std::endl;
+	na.pack();
+	json::span<const double> sa = cna.span<double>();
+	t = clock();
+	for (int k = 0; k < 20; ++k)
+		for (size_t i = 0; i < sa.size; ++i)
+			x += sa[i];
+	std::cout << "sum typed:  " << 20/(double(clock() - t)/CLOCKS_PER_SEC) << " arrays/s, " << sizeof(double) << " bytes each (" << x << ")" << std::endl;
+
+	// deduplicating documents, half of them repeats
+	std::vector<json::value> docs(200000);
+	for (size_t i = 0; i < docs.size(); ++i) {
+		std::string d = "{\"id\": " + std::to_string(i % 100000) + ", \"name\": \"some name\", \"tags\": [\"a\", \"b\"]}";
+		const char* p = d.data();
+		json::value v;
+		json::parse::read_value(p, p + d.size(), v);
+		docs[i] = v; // owns its strings, v refers to d
+	}
+	t = clock();
+	std::set<json::value> tree(docs.begin(), docs.end());
+	std::cout << "dedup set:  " << docs.size()/(double(clock() - t)/CLOCKS_PER_SEC)/1e6 << " M docs/s (" << tree.size() << ")" << std::endl;
+	t = clock();
+	std::unordered_set<json::value, std::hash<json::value>, json::equal_to> hashed(docs.size());
+	hashed.insert(docs.begin(), docs.end());
+	std::cout << "dedup hash: " << docs.size()/(double(clock() - t)/CLOCKS_PER_SEC)/1e6 << " M docs/s (" << hashed.size() << ")" << std::endl;
+
+	// sorting by operator< and by sort key
+	std::vector<json::value> by_value(docs.begin(), docs.end());
+	t = clock();
+	std::sort(by_value.begin(), by_value.end());
+	std::cout << "sort value: " << docs.size()/(double(clock() - t)/CLOCKS_PER_SEC)/1e6 << " M docs/s" << std::endl;
+	t = clock();
+	std::vector<std::string> by_key(docs.size());
+	for (size_t i = 0; i < docs.size(); ++i)
+		by_key[i] = json::sort_key(docs[i]);
+	std::sort(by_key.begin(), by_key.end());
+	std::cout << "sort key:   " << docs.size()/(double(clock() - t)/CLOCKS_PER_SEC)/1e6 << " M docs/s, keys included" << std::endl;
+
+	// wall clock since the work is spread over threads
+	std::string l;
+	for (int i = 0; i < 200000; ++i)
+		l += "{\"id\": 12345, \"name\": \"some name\", \"tags\": [\"a\", \"b\"], \"ok\": true, \"x\": 1.25}\n";
+	mb = l.size()/1e6;
+	for (size_t n = 1; n <= std::thread::hardware_concurrency(); n *= 2) {
+		json::pool p(n);
+		std::vector<json::value> v;
+		std::chrono::steady_clock::time_point c = std::chrono::steady_clock::now();
+		json::ndjson::parse(l.data(), l.size(), v, p);
+		double dt = std::chrono::duration<double>(std::chrono::steady_clock::now() - c).count();
+		std::cout << "ndjson x" << n << ":  " << mb/dt << " MB/s" << std::endl;
+	}
+}
+#endif // JSON_BENCH
+
+int main()
+{
+	test_parse_buffer();
+
+	test_parse_stream();
+
+	test_structural();
+
+	test_arena();
+
+	test_move();
+
+	test_flat_object();
+
+	test_sax();
+
+	test_number();
+
+	test_serialize();
+
+	test_locale();
+
+	test_writer();
+
+	test_ndjson();
+
+	test_lazy();
+
+	test_push();
+
+	test_tape();
+
+	test_inline_string();
+
+	test_intern();
+
+	test_shared();
+
+	test_compact();
+
+	test_typed_array();
+
+	test_hash();
+
+	test_sort_key();
+
+#ifdef JSON_BENCH
+	bench_parse();
+#endif
+
+	return 0;
+}
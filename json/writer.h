@@ -0,0 +1,280 @@
+// writer.h - streaming JSON output without building a json::value tree
+// Calls are made in document order and bytes go straight into a json::buffer,
+// optionally flushed to a std::ostream whenever it fills up.
+//	json::writer w(buf);
+//	w.begin_object();
+//	w.key("a"); w.value(1.5);
+//	w.key("b"); w.begin_array(); w.value(true); w.null(); w.end_array();
+//	w.end_object();
+// Keys and values must alternate and brackets match. The first call that does
+// not fit is not written and neither is anything after it, ok() tells.
+#pragma once
+#include <string>
+#include <vector>
+#include "json.h"
+
+namespace json {
+
+	class writer {
+		enum state {
+			TOP,         // no value written yet
+			DONE,        // top level value written
+			OBJECT,      // expecting the first key
+			OBJECT_NEXT, // expecting another key
+			MEMBER,      // expecting the value after a key
+			ARRAY,       // expecting the first element
+			ARRAY_NEXT,  // expecting another element
+		};
+
+		json::buffer own_;
+		json::buffer& buf_;
+		std::ostream* os_;
+		size_t flush_; // write to os_ when buf_ has this many bytes
+		int indent_;
+		std::vector<char> state_; // one per open container, back is current
+		bool error_;              // a call did not fit, nothing more is written
+
+		writer(const writer&);
+		writer& operator=(const writer&);
+
+		state current(void) const
+		{
+			return static_cast<state>(state_.back());
+		}
+
+		// separator and indentation before a value, false if there cannot be one
+		bool prefix(void)
+		{
+			if (error_)
+				return false;
+
+			switch (current()) {
+			case TOP:
+				state_.back() = DONE;
+				break;
+			case MEMBER:
+				state_.back() = OBJECT_NEXT;
+				break;
+			case ARRAY:
+				state_.back() = ARRAY_NEXT;
+				serialize_indent(buf_, indent_, depth());
+				break;
+			case ARRAY_NEXT:
+				buf_.put(',');
+				serialize_indent(buf_, indent_, depth());
+				break;
+			default: // a key is expected or the value is complete
+				error_ = true;
+				return false;
+			}
+
+			return true;
+		}
+		void open(char c, state s)
+		{
+			if (!prefix())
+				return;
+			buf_.put(c);
+			state_.push_back(static_cast<char>(s));
+			scalar();
+		}
+		void close(char c, state first, state next)
+		{
+			if (error_ || (current() != first && current() != next)) {
+				error_ = true;
+				return;
+			}
+			bool empty = current() == first;
+
+			state_.pop_back();
+			if (!empty)
+				serialize_indent(buf_, indent_, depth());
+			buf_.put(c);
+			if (state_.size() == 1)
+				flush();
+			else
+				scalar();
+		}
+		int depth(void) const
+		{
+			return static_cast<int>(state_.size()) - 1;
+		}
+		void integer(int64_t i)
+		{
+			if (!prefix())
+				return;
+			buf_.advance(format_integer(i, buf_.reserve(21)));
+			scalar();
+		}
+		void unsigned_integer(uint64_t u)
+		{
+			if (!prefix())
+				return;
+			buf_.advance(format_unsigned(u, buf_.reserve(20)));
+			scalar();
+		}
+		// flush to the stream if the buffer is full, after anything but a key
+		void scalar(void)
+		{
+			if (os_ && buf_.size() >= flush_)
+				flush();
+		}
+	public:
+		// compact if indent is 0, otherwise indent spaces per level
+		explicit writer(json::buffer& buf, int indent = 0)
+			: own_(0), buf_(buf), os_(0), flush_(0), indent_(indent), state_(1, TOP), error_(false)
+		{ }
+		// output goes through an internal buffer of about flush bytes
+		explicit writer(std::ostream& os, int indent = 0, size_t flush = 4096)
+			: own_(flush + 64), buf_(own_), os_(&os), flush_(flush), indent_(indent), state_(1, TOP), error_(false)
+		{ }
+		~writer()
+		{
+			flush();
+		}
+
+		void begin_object(void)
+		{
+			open('{', OBJECT);
+		}
+		void end_object(void)
+		{
+			close('}', OBJECT, OBJECT_NEXT);
+		}
+		void begin_array(void)
+		{
+			open('[', ARRAY);
+		}
+		void end_array(void)
+		{
+			close(']', ARRAY, ARRAY_NEXT);
+		}
+
+		void key(const char* s, size_t n)
+		{
+			if (error_ || (current() != OBJECT && current() != OBJECT_NEXT)) {
+				error_ = true;
+				return;
+			}
+			if (current() == OBJECT_NEXT)
+				buf_.put(',');
+			serialize_indent(buf_, indent_, depth());
+			serialize_string(buf_, s, n);
+			buf_.put(':');
+			if (indent_ > 0)
+				buf_.put(' ');
+			state_.back() = MEMBER;
+		}
+		void key(const char* s)
+		{
+			key(s, strlen(s));
+		}
+		void key(const std::string& s)
+		{
+			key(s.data(), s.size());
+		}
+
+		void value(const char* s, size_t n)
+		{
+			if (!prefix())
+				return;
+			serialize_string(buf_, s, n);
+			scalar();
+		}
+		void value(const char* s)
+		{
+			value(s, strlen(s));
+		}
+		void value(const std::string& s)
+		{
+			value(s.data(), s.size());
+		}
+		void value(double x)
+		{
+			if (!prefix())
+				return;
+			buf_.advance(format_double(x, buf_.reserve(32)));
+			scalar();
+		}
+		// every integer type so that none is ambiguous
+		void value(int i)
+		{
+			integer(i);
+		}
+		void value(long i)
+		{
+			integer(i);
+		}
+		void value(long long i)
+		{
+			integer(i);
+		}
+		void value(unsigned i)
+		{
+			unsigned_integer(i);
+		}
+		void value(unsigned long i)
+		{
+			unsigned_integer(i);
+		}
+		void value(unsigned long long i)
+		{
+			unsigned_integer(i);
+		}
+		void value(bool b)
+		{
+			if (!prefix())
+				return;
+			if (b)
+				buf_.append("true", 4);
+			else
+				buf_.append("false", 5);
+			scalar();
+		}
+#ifndef JSON_ONLY
+		// base64 string
+		void value(const json::byte& b)
+		{
+			if (!prefix())
+				return;
+			serialize_base64(buf_, b.data, b.size);
+			scalar();
+		}
+#endif
+		void null(void)
+		{
+			if (!prefix())
+				return;
+			buf_.append("null", 4);
+			scalar();
+		}
+		// an existing element, indented to fit
+		void value(const json::element& e)
+		{
+			if (!prefix())
+				return;
+			serialize(buf_, e, indent_, depth());
+			scalar();
+		}
+
+		// a complete top level value has been written
+		bool done(void) const
+		{
+			return !error_ && state_.size() == 1 && current() == DONE;
+		}
+		// false once a call did not fit, such as a value where a key belongs
+		bool ok(void) const
+		{
+			return !error_;
+		}
+		// write buffered output to the stream, if there is one
+		void flush(void)
+		{
+			if (os_ && buf_.size()) {
+				os_->write(buf_.data(), buf_.size());
+				buf_.clear();
+			}
+		}
+	};
+
+} // namespace json